@@ -30,5 +30,105 @@ struct msg_server_s {
 #define MSG_CLT_SIZE sizeof(msg_clt_t)
 #define MSG_SERVER_SIZE sizeof(msg_server_t)
 
+/*
+ * Capabilities announced in clt_ip of the version message.  An intercept
+ * that knows them may answer with compact records, older ones ignore
+ * them and keep sending msg_server_t.
+ */
+#define TC_MSG_CAP_COMPACT   0x01
+#define TC_MSG_CAP_PAYLOAD   0x02       /* payload prefixes are wanted */
+/*
+ * tcpcopy sends all router info of a session on one connection, and
+ * wants the session's responses back on that connection, in order.
+ */
+#define TC_MSG_CAP_AFFINE    0x04
+
+/*
+ * A compact record starts with a tag byte whose two high bits are set,
+ * which the IPv4 header of a msg_server_t never starts with:
+ *
+ *   tag      TC_CMSG_TAG and the TC_CMSG_* bits below
+ *   flags    tcp flags, fin 0x01 syn 0x02 rst 0x04 psh 0x08 ack 0x10 urg 0x20
+ *   doff     tcp header length of the packet in 32 bit words
+ *   addrs    saddr, daddr, source and dest as in the packet, unless SAME
+ *   seq, ack varints, zigzag deltas to the previous record if SAME
+ *   window   varint
+ *   len      payload length, varint
+ *   ts       tsval and tsecr varints if TS
+ *   wscale   one byte if WS
+ *   payload  a varint length and the first bytes of payload if PAYLOAD
+ *
+ * SAME means the four tuple of the previous record on the connection.
+ * Varints are little endian groups of 7 bits, at most 5 bytes.  In
+ * combined mode a batch header with TC_CMSG_BATCH set holds the byte
+ * length of the compact records following it instead of a count.
+ */
+#define TC_CMSG_TAG          0xc0
+#define TC_CMSG_SAME         0x01
+#define TC_CMSG_TS           0x02
+#define TC_CMSG_WS           0x04
+#define TC_CMSG_PAYLOAD      0x08
+
+#define TC_CMSG_BATCH        0x8000
+
+#define tc_cmsg_is_compact(p)  ((*(u_char *) (p) & 0xc0) == TC_CMSG_TAG)
+
+
+/* returns the bytes used, 0 if more are needed or -1 if malformed */
+static inline int
+tc_cmsg_varint(u_char *p, u_char *end, uint32_t *v)
+{
+    int       i;
+    uint32_t  val;
+
+    val = 0;
+    for (i = 0; i < 5; i++) {
+        if (p + i >= end) {
+            return 0;
+        }
+
+        val |= (uint32_t) (p[i] & 0x7f) << (7 * i);
+        if (!(p[i] & 0x80)) {
+            *v = val;
+            return i + 1;
+        }
+    }
+
+    return -1;
+}
+
+
+/*
+ * Responses through shared memory.
+ *
+ * A co-located intercept can write the responses of a connection into a
+ * ring shared with tcpcopy instead of the connection itself.  tcpcopy
+ * creates the ring and an eventfd and passes both over intercept's unix
+ * socket with a tc_msg_shm_hello_t naming the connection by its local
+ * port.  The ring carries the same bytes the connection would.  Intercept
+ * copies them in, advances head and then writes to the eventfd; tcpcopy
+ * advances tail as it consumes them.  The data follows the header.
+ */
+#define TC_MSG_SHM_MAGIC     0x7463736d
+#define TC_MSG_SHM_SIZE      (4 * 1024 * 1024)      /* a power of two */
+
+typedef struct {
+    uint32_t  magic;
+    uint32_t  size;                     /* of the data */
+    u_char    pad0[56];
+    uint64_t  head;                     /* written by intercept */
+    u_char    pad1[56];
+    uint64_t  tail;                     /* written by tcpcopy */
+    u_char    pad2[56];
+} tc_msg_shm_t;
+
+/* sent with the ring and eventfd descriptors, in network byte order */
+typedef struct {
+    uint32_t  magic;
+    uint32_t  size;                     /* of the mapping */
+    uint16_t  port;                     /* local port of the connection */
+    uint16_t  reserved;
+} tc_msg_shm_hello_t;
+
 #endif /*  TC_MSG_INCLUDED */
 
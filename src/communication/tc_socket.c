@@ -202,7 +202,7 @@ tc_raw_socket_out_init(void)
 
 #if (TC_PCAP_SND)
 
-static pcap_t *pcap = NULL;
+static tc_thread_local pcap_t *pcap = NULL;
 
 int
 tc_pcap_snd_init(char *if_name, int mtu)
@@ -357,11 +357,104 @@ tc_socket_set_nodelay(int fd)
 }
 
 
+/* let the kernel poll the device queue for usec before sleeping */
+int
+tc_socket_set_busy_poll(int fd, int usec)
+{
+#if defined(SO_BUSY_POLL)
+    socklen_t len;
+#if defined(SO_PREFER_BUSY_POLL)
+    int       flag;
+#endif
+
+    len = (socklen_t) sizeof(usec);
+
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, (char *) &usec, len) == -1) {
+        tc_log_info(LOG_WARN, errno, "set SO_BUSY_POLL on socket(%d) failed",
+                fd);
+        return TC_ERR;
+    }
+
+#if defined(SO_PREFER_BUSY_POLL)
+    flag = 1;
+    len = (socklen_t) sizeof(flag);
+
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, (char *) &flag, len)
+            == -1)
+    {
+        tc_log_info(LOG_WARN, errno, 
+                "set SO_PREFER_BUSY_POLL on socket(%d) failed", fd);
+    }
+#endif
+
+    return TC_OK;
+#else
+    tc_log_info(LOG_WARN, 0, "SO_BUSY_POLL is not supported");
+    return TC_ERR;
+#endif
+}
+
+
+/* the bytes waiting in the receive queue of the socket, -1 if unknown */
+int
+tc_socket_rcv_queued(int fd)
+{
+#if defined(SO_MEMINFO)
+    uint32_t  meminfo[SK_MEMINFO_VARS];
+    socklen_t len;
+
+    len = (socklen_t) sizeof(meminfo);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) == -1) {
+        return -1;
+    }
+
+    return (int) tc_min(meminfo[SK_MEMINFO_RMEM_ALLOC], INT_MAX);
+#else
+    return -1;
+#endif
+}
+
+
+/* gives up a connection whose peer went away without telling */
+int
+tc_socket_set_keepalive(int fd)
+{
+    int  flag;
+
+    flag = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &flag, sizeof(flag)) == -1) {
+        tc_log_info(LOG_ERR, errno, "Set SO_KEEPALIVE to socket(%d) failed",
+                fd);
+        return TC_ERR;
+    }
+
+#if (TC_HAVE_KEEPALIVE_TUNABLE)
+    flag = KEEPALIVE_IDLE;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &flag, sizeof(flag));
+    flag = KEEPALIVE_INTVL;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &flag, sizeof(flag));
+    flag = KEEPALIVE_CNT;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &flag, sizeof(flag));
+#endif
+
+#if defined(TCP_USER_TIMEOUT)
+    /* unacknowledged messages give it up as well */
+    flag = (KEEPALIVE_IDLE + KEEPALIVE_INTVL * KEEPALIVE_CNT) * 1000;
+    setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &flag, sizeof(flag));
+#endif
+
+    return TC_OK;
+}
+
+
+/* returns TC_AGAIN if a nonblocking connect is in progress */
 int
 tc_socket_connect(int fd, uint32_t ip, uint16_t port)
 {
-    socklen_t           len;
-    struct sockaddr_in  remote_addr;                           
+    socklen_t                   len;
+    struct sockaddr_in          remote_addr;                           
+    static tc_thread_local int  told;
 
     tc_memzero(&remote_addr, sizeof(remote_addr));               
 
@@ -372,10 +465,19 @@ tc_socket_connect(int fd, uint32_t ip, uint16_t port)
     len = (socklen_t) (sizeof(remote_addr));
 
     if (connect(fd, (struct sockaddr *) &remote_addr, len) == -1) {
+        if (errno == EINPROGRESS) {
+            /* a nonblocking socket, it becomes writable when done */
+            return TC_AGAIN;
+        }
         tc_log_info(LOG_ERR, errno, "Can not connect to remote server(%s:%d)",
                 inet_ntoa(remote_addr.sin_addr), port);
-        fprintf(stderr, "Can not connect to remote server(%s:%d), err:%s\n", 
-                inet_ntoa(remote_addr.sin_addr), port, strerror(errno));
+        /* the retries while it is down go to the log only */
+        if (!told) {
+            told = 1;
+            fprintf(stderr, "Can not connect to remote server(%s:%d), "
+                    "err:%s\n", inet_ntoa(remote_addr.sin_addr), port,
+                    strerror(errno));
+        }
         tc_socket_close(fd);
         return TC_ERR;
     } else {
@@ -387,108 +489,141 @@ tc_socket_connect(int fd, uint32_t ip, uint16_t port)
 }
 
 
+/* ip in network order, INADDR_ANY for all of them */
 int
-tc_socket_rcv(int fd, char *buffer, ssize_t len)
+tc_socket_listen(int fd, uint32_t ip, uint16_t port)
 {
-    int     cnt = 0;
-    size_t  last;
-    ssize_t n;
+    int                 flag;
+    socklen_t           len;
+    struct sockaddr_in  local_addr;
 
-    last = 0;
+    flag = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag)) == -1) {
+        tc_log_info(LOG_ERR, errno, "Set SO_REUSEADDR to socket(%d) failed",
+                fd);
+        tc_socket_close(fd);
+        return TC_ERR;
+    }
 
-    for ( ;; ) {
-        n = recv(fd, buffer + last, len, 0);
+    tc_memzero(&local_addr, sizeof(local_addr));
 
-        if (n >= 0) {
-            if (n == 0) {
-                tc_log_info(LOG_NOTICE, 0, "recv length 0,fd:%d", fd);
-                return TC_ERR;
-            }
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_addr.s_addr = ip;
+    local_addr.sin_port = htons(port);
 
-            last += n;
+    len = (socklen_t) (sizeof(local_addr));
 
-            if ((len -= n) == 0) {
-                break;
-            }
+    if (bind(fd, (struct sockaddr *) &local_addr, len) == -1) {
+        tc_log_info(LOG_ERR, errno, "Bind socket(%d) to port:%d failed",
+                fd, port);
+        fprintf(stderr, "Bind socket(%d) to port:%d failed, err:%s\n",
+                fd, port, strerror(errno));
+        tc_socket_close(fd);
+        return TC_ERR;
+    }
 
-        } else {
-            if (errno == EAGAIN || errno == EINTR) {
-                cnt++;
-                if (cnt % MAX_READ_LOG_TRIES == 0) {
-                    tc_log_info(LOG_NOTICE, 0, "recv tries:%d,fd:%d", cnt, fd);
-                }
-                continue;
-            } else {
-                tc_log_info(LOG_NOTICE, errno, "return -1,fd:%d", fd);
-                return TC_ERR;
-            }
-        }
+    if (listen(fd, 5) == -1) {
+        tc_log_info(LOG_ERR, errno, "Listen on socket(%d) failed", fd);
+        tc_socket_close(fd);
+        return TC_ERR;
     }
 
     return TC_OK;
 }
 
-#if (TC_COMBINED)
+
+/* reads what is there without blocking, returns its length or TC_ERR */
 int
-tc_socket_cmb_rcv(int fd, int *num, char *buffer)
+tc_socket_recv(int fd, char *buffer, size_t len)
 {
-    int     read_num = 0, cnt = 0;
-    size_t  last;
-    ssize_t n, len;
-
-    last = 0;
-    len = sizeof(uint16_t);
+    ssize_t n;
 
     for ( ;; ) {
-        n = recv(fd, buffer + last, len, 0);
+        n = recv(fd, buffer, len, 0);
 
-        if (n >= 0) {
+        if (n > 0) {
+            return (int) n;
+        }
 
-            if (n == 0) {
-                tc_log_info(LOG_NOTICE, 0, "recv length 0,fd:%d", fd);
-                return TC_ERR;
-            }
+        if (n == 0) {
+            tc_log_info(LOG_NOTICE, 0, "recv length 0,fd:%d", fd);
+            return TC_ERR;
+        }
 
-            last += n;
+        if (errno == EINTR) {
+            continue;
+        }
 
-            if ((!read_num) && last >= sizeof(uint16_t)) {
-                *num = (int) ntohs(*(uint16_t *) buffer);
-                if (*num > COMB_MAX_NUM) {
-                    tc_log_info(LOG_WARN, 0, "num:%d > threshold", *num);
-                    return TC_ERR;
-                }
-                read_num = 1;
-                len = ((*num) * MSG_SERVER_SIZE) + len;
-            }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
 
-            if ((len -= n) == 0) {
-                break;
-            }
+        tc_log_info(LOG_NOTICE, errno, "return -1,fd:%d", fd);
+        return TC_ERR;
+    }
+}
 
-            if (len < 0) {
-                tc_log_info(LOG_WARN, 0, "read:%d,num packs:%d, remain:%d",
-                        n, *num, len);
-                break;
-            }
 
-        } else {
-            if (errno == EAGAIN || errno == EINTR) {
-                cnt++;
-                if (cnt % MAX_READ_LOG_TRIES == 0) {
-                    tc_log_info(LOG_NOTICE, 0, "recv tries:%d,fd:%d", cnt, fd);
-                }
-                continue;
-            } else {
-                tc_log_info(LOG_NOTICE, errno, "return -1,fd:%d", fd);
-                return TC_ERR;
-            }
-        }
+/* passes n descriptors with buf to the process listening on path */
+int
+tc_socket_send_fds(char *path, void *buf, size_t len, int *fds, int n)
+{
+    int                 fd;
+    char                control[CMSG_SPACE(sizeof(int) * 2)];
+    ssize_t             ret;
+    struct iovec        iov;
+    struct msghdr       msg;
+    struct cmsghdr     *cmsg;
+    struct sockaddr_un  addr;
+
+    if (n > 2 || strlen(path) >= sizeof(addr.sun_path)) {
+        return TC_ERR;
+    }
 
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        tc_log_info(LOG_ERR, errno, "socket(AF_UNIX) failed");
+        return TC_ERR;
+    }
+
+    tc_memzero(&addr, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        tc_log_info(LOG_ERR, errno, "Can not connect to %s", path);
+        close(fd);
+        return TC_ERR;
+    }
+
+    iov.iov_base = buf;
+    iov.iov_len  = len;
+
+    tc_memzero(&msg, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(int) * n);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n);
+
+    do {
+        ret = sendmsg(fd, &msg, 0);
+    } while (ret == -1 && errno == EINTR);
+
+    close(fd);
+
+    if (ret != (ssize_t) len) {
+        tc_log_info(LOG_ERR, errno, "sendmsg to %s failed", path);
+        return TC_ERR;
     }
 
     return TC_OK;
 }
-#endif
 
 
 int
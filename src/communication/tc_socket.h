@@ -25,11 +25,13 @@ int tc_pcap_over(void);
 int tc_socket_init(void);
 int tc_socket_set_nonblocking(int fd);
 int tc_socket_set_nodelay(int fd);
+int tc_socket_set_busy_poll(int fd, int usec);
+int tc_socket_rcv_queued(int fd);
+int tc_socket_set_keepalive(int fd);
 int tc_socket_connect(int fd, uint32_t ip, uint16_t port);
-int tc_socket_rcv(int fd, char *buffer, ssize_t len);
-#if (TC_COMBINED)
-int tc_socket_cmb_rcv(int fd, int *num, char *buffer);
-#endif
+int tc_socket_listen(int fd, uint32_t ip, uint16_t port);
+int tc_socket_recv(int fd, char *buffer, size_t len);
+int tc_socket_send_fds(char *path, void *buf, size_t len, int *fds, int n);
 int tc_socket_snd(int fd, char *buffer, int len);
 
 #endif /* TC_SOCKET_INCLUDED */
@@ -0,0 +1,248 @@
+
+/* for the cpu_set_t macros */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <xcopy.h>
+
+#define TC_MPOL_PREFERRED  1
+
+#if defined(CPU_SETSIZE)
+#define TC_CPU_MAX         CPU_SETSIZE
+#else
+#define TC_CPU_MAX         1024
+#endif
+
+
+/*
+ * "0,2,4-7" to cpu numbers, returns the number of them or -1, also if one
+ * is past what a cpu set holds
+ */
+int
+tc_cpu_list_parse(char *list, int *cpus, int max)
+{
+    int    n, from, to;
+    char  *p, *end;
+
+    n = 0;
+    p = list;
+
+    while (*p) {
+        from = strtol(p, &end, 10);
+        if (end == p || from < 0) {
+            return -1;
+        }
+
+        to = from;
+        p = end;
+        if (*p == '-') {
+            p++;
+            to = strtol(p, &end, 10);
+            if (end == p || to < from) {
+                return -1;
+            }
+            p = end;
+        }
+
+        if (to >= TC_CPU_MAX) {
+            return -1;
+        }
+
+        for (; from <= to; from++) {
+            if (n == max) {
+                return -1;
+            }
+            cpus[n++] = from;
+        }
+
+        /* trailing newlines come from sysfs */
+        while (*p == ',' || *p == '\n' || *p == ' ') {
+            p++;
+        }
+    }
+
+    return n;
+}
+
+
+/* pins the calling thread */
+int
+tc_cpu_bind(int cpu)
+{
+#if (TC_HAVE_SCHED_SETAFFINITY)
+    cpu_set_t set;
+
+    if (cpu < 0 || cpu >= TC_CPU_MAX) {
+        tc_log_info(LOG_ERR, 0, "invalid cpu:%d", cpu);
+        return TC_ERR;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &set) == -1) {
+        tc_log_info(LOG_ERR, errno, "bind to cpu %d failed", cpu);
+        return TC_ERR;
+    }
+
+    return TC_OK;
+#else
+    tc_log_info(LOG_WARN, 0, "sched_setaffinity is not supported");
+    return TC_ERR;
+#endif
+}
+
+
+int
+tc_cpu_node(int cpu)
+{
+    int             node;
+    DIR            *dir;
+    char            path[64];
+    struct dirent  *entry;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+    dir = opendir(path);
+    if (dir == NULL) {
+        return -1;
+    }
+
+    node = -1;
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "node%d", &node) == 1) {
+            break;
+        }
+        node = -1;
+    }
+
+    closedir(dir);
+
+    return node;
+}
+
+
+static int
+tc_read_line(char *path, char *buf, int len)
+{
+    int     fd;
+    ssize_t n;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return TC_ERR;
+    }
+
+    n = read(fd, buf, len - 1);
+    close(fd);
+
+    if (n <= 0) {
+        return TC_ERR;
+    }
+
+    while (n > 0 && buf[n - 1] == '\n') {
+        n--;
+    }
+    buf[n] = '\0';
+
+    return TC_OK;
+}
+
+
+/* the node the device is attached to */
+int
+tc_dev_node(char *dev)
+{
+    char path[128], buf[16];
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", dev);
+
+    if (tc_read_line(path, buf, sizeof(buf)) != TC_OK) {
+        return -1;
+    }
+
+    return atoi(buf);
+}
+
+
+int
+tc_mem_bind_node(int node)
+{
+#if (TC_HAVE_SET_MEMPOLICY)
+    unsigned long mask[4];
+
+    if (node < 0 || node >= (int) (sizeof(mask) * 8)) {
+        tc_log_info(LOG_ERR, 0, "invalid numa node:%d", node);
+        return TC_ERR;
+    }
+
+    tc_memzero(mask, sizeof(mask));
+    mask[node / (sizeof(long) * 8)] |= 1UL << (node % (sizeof(long) * 8));
+
+    if (syscall(SYS_set_mempolicy, TC_MPOL_PREFERRED, mask,
+                sizeof(mask) * 8) == -1)
+    {
+        tc_log_info(LOG_ERR, errno, "bind memory to node %d failed", node);
+        return TC_ERR;
+    }
+
+    return TC_OK;
+#else
+    tc_log_info(LOG_WARN, 0, "set_mempolicy is not supported");
+    return TC_ERR;
+#endif
+}
+
+
+/* warns about the interrupts of the device served off the node */
+void
+tc_irq_check_node(char *dev, int node)
+{
+    int             i, n, irq, cpu_node, cpus[TC_MAX_CPU_LIST];
+    DIR            *dir;
+    char            path[128], buf[1024];
+    struct dirent  *entry;
+
+    if (node < 0) {
+        return;
+    }
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/msi_irqs", dev);
+
+    dir = opendir(path);
+    if (dir == NULL) {
+        tc_log_info(LOG_NOTICE, 0, "no msi irqs found for %s", dev);
+        return;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "%d", &irq) != 1) {
+            continue;
+        }
+
+        /* the cpus really serving it if the kernel tells */
+        snprintf(path, sizeof(path), "/proc/irq/%d/effective_affinity_list",
+                irq);
+        if (tc_read_line(path, buf, sizeof(buf)) != TC_OK || buf[0] == '\0') {
+            snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", 
+                    irq);
+            if (tc_read_line(path, buf, sizeof(buf)) != TC_OK) {
+                continue;
+            }
+        }
+
+        n = tc_cpu_list_parse(buf, cpus, TC_MAX_CPU_LIST);
+        for (i = 0; i < n; i++) {
+            /* cpus of no known node, as without numa, are not told */
+            cpu_node = tc_cpu_node(cpus[i]);
+            if (cpu_node >= 0 && cpu_node != node) {
+                tc_log_info(LOG_WARN, 0, "irq %d of %s is served by cpus %s "
+                        "off node %d", irq, dev, buf, node);
+                break;
+            }
+        }
+    }
+
+    closedir(dir);
+}
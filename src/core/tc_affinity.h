@@ -0,0 +1,24 @@
+#ifndef  TC_AFFINITY_INCLUDED
+#define  TC_AFFINITY_INCLUDED
+
+#include <xcopy.h>
+
+/*
+ * Cpu and NUMA placement.
+ *
+ * Cpus are pinned per thread.  Memory is placed with a preferred node
+ * policy of the calling thread, which later threads inherit, so that
+ * pages fall back to other nodes instead of failing when the node is
+ * short of memory.  Nodes are read from sysfs, -1 stands for unknown.
+ */
+
+#define TC_MAX_CPU_LIST  256
+
+int tc_cpu_list_parse(char *list, int *cpus, int max);
+int tc_cpu_bind(int cpu);
+int tc_cpu_node(int cpu);
+int tc_dev_node(char *dev);
+int tc_mem_bind_node(int node);
+void tc_irq_check_node(char *dev, int node);
+
+#endif /* TC_AFFINITY_INCLUDED */
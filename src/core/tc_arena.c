@@ -0,0 +1,177 @@
+
+#include <xcopy.h>
+
+
+static tc_arena_region_t *
+tc_arena_map(tc_arena_t *arena, size_t size)
+{
+    u_char            *m;
+    size_t             len;
+    tc_arena_region_t *r;
+
+    r = tc_alloc(sizeof(tc_arena_region_t));
+    if (r == NULL) {
+        return NULL;
+    }
+
+    size = tc_align(size, TC_ARENA_HUGE_PAGE_SIZE);
+    r->huge = 0;
+    m = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    /* huge pages are aligned to their size, so chunks are aligned too */
+    len = size;
+    m = mmap(NULL, len, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if (m != MAP_FAILED) {
+        r->huge = 1;
+    }
+#endif
+
+    if (m == MAP_FAILED) {
+        /* leave room for aligning to the huge page size */
+        len = size + TC_ARENA_HUGE_PAGE_SIZE;
+        m = mmap(NULL, len, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (m == MAP_FAILED) {
+            tc_log_info(LOG_ERR, errno, "mmap arena region failed");
+            tc_free(r);
+            return NULL;
+        }
+    }
+
+    r->base = m;
+    r->len  = len;
+    r->last = tc_align_ptr(m, TC_ARENA_HUGE_PAGE_SIZE);
+    r->end  = r->last + size;
+
+#ifdef MADV_HUGEPAGE
+    if (!r->huge && madvise(r->last, size, MADV_HUGEPAGE) == -1) {
+        tc_log_info(LOG_WARN, errno, "madvise MADV_HUGEPAGE failed");
+    }
+#endif
+
+    r->next = arena->regions;
+    arena->regions = r;
+    arena->region_cnt++;
+    arena->huge_cnt += r->huge;
+    arena->mapped += size;
+
+    tc_log_info(LOG_NOTICE, 0, "arena region:%p, size:%llu, huge:%d",
+            r->last, (unsigned long long) size, r->huge);
+
+    return r;
+}
+
+
+tc_arena_t *
+tc_arena_create(void)
+{
+    tc_arena_t *arena;
+
+    arena = tc_alloc(sizeof(tc_arena_t));
+    if (arena != NULL) {
+        tc_memzero(arena, sizeof(tc_arena_t));
+    }
+
+    return arena;
+}
+
+
+void
+tc_arena_destroy(tc_arena_t *arena)
+{
+    tc_arena_region_t *r, *next;
+
+    for (r = arena->regions; r; r = next) {
+        next = r->next;
+        munmap(r->base, r->len);
+        tc_free(r);
+    }
+
+    tc_free(arena);
+}
+
+
+/*
+ * returns TC_SLAB_CHUNK_SIZE aligned memory of size rounded up to
+ * TC_SLAB_CHUNK_SIZE, or NULL if the caller should fall back to the heap
+ */
+void *
+tc_arena_alloc(tc_arena_t *arena, size_t size)
+{
+    u_char            *m;
+    tc_arena_region_t *r;
+
+    size = tc_align(size, TC_SLAB_CHUNK_SIZE);
+
+    if (size == TC_SLAB_CHUNK_SIZE && arena->free) {
+        m = arena->free;
+        arena->free = *(void **) m;
+        return m;
+    }
+
+    if (size > TC_ARENA_REGION_SIZE) {
+        return NULL;
+    }
+
+    for (r = arena->regions; r; r = r->next) {
+        if ((size_t) (r->end - r->last) >= size) {
+            break;
+        }
+    }
+
+    if (r == NULL) {
+        r = tc_arena_map(arena, TC_ARENA_REGION_SIZE);
+        if (r == NULL) {
+            return NULL;
+        }
+    }
+
+    m = r->last;
+    r->last += size;
+
+    return m;
+}
+
+
+void
+tc_arena_free(tc_arena_t *arena, void *p, size_t size)
+{
+    u_char *m, *end;
+
+    m   = p;
+    end = m + tc_align(size, TC_SLAB_CHUNK_SIZE);
+
+    /* large blocks are split back into chunks */
+    for ( ;m < end; m += TC_SLAB_CHUNK_SIZE) {
+        *(void **) m = arena->free;
+        arena->free = m;
+    }
+}
+
+
+/* map and touch regions so that the first burst does not page-fault */
+size_t
+tc_arena_prefault(tc_arena_t *arena, size_t size)
+{
+    size_t             done;
+    u_char            *m;
+    tc_arena_region_t *r;
+
+    done = 0;
+    while (done < size) {
+        r = tc_arena_map(arena, tc_min(size - done, TC_ARENA_REGION_SIZE));
+        if (r == NULL) {
+            break;
+        }
+
+        for (m = r->last; m < r->end; m += tc_pagesize) {
+            *m = 0;
+        }
+        done += r->end - r->last;
+    }
+
+    return done;
+}
+
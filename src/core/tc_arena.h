@@ -0,0 +1,44 @@
+#ifndef  TC_ARENA_INCLUDED
+#define  TC_ARENA_INCLUDED
+
+#include <xcopy.h>
+
+/*
+ * Huge page backed memory for slab chunks.
+ *
+ * Regions are mapped with MAP_HUGETLB when the system has huge pages
+ * reserved, otherwise with normal pages advised for transparent huge
+ * pages.  They are carved into TC_SLAB_CHUNK_SIZE aligned chunks; freed
+ * chunks are kept for reuse and regions are unmapped only on destroy.
+ */
+
+#define TC_ARENA_HUGE_PAGE_SIZE  (2 * 1024 * 1024)
+#define TC_ARENA_REGION_SIZE     (32 * 1024 * 1024)
+
+typedef struct tc_arena_region_s tc_arena_region_t;
+
+struct tc_arena_region_s {
+    tc_arena_region_t *next;
+    u_char            *base;      /* as mapped */
+    size_t             len;
+    u_char            *last;
+    u_char            *end;
+    unsigned int       huge:1;
+};
+
+struct tc_arena_s {
+    tc_arena_region_t *regions;
+    void              *free;      /* freed chunks */
+    uint32_t           region_cnt;
+    uint32_t           huge_cnt;
+    uint64_t           mapped;
+};
+
+
+tc_arena_t *tc_arena_create(void);
+void tc_arena_destroy(tc_arena_t *arena);
+void *tc_arena_alloc(tc_arena_t *arena, size_t size);
+void tc_arena_free(tc_arena_t *arena, void *p, size_t size);
+size_t tc_arena_prefault(tc_arena_t *arena, size_t size);
+
+#endif /* TC_ARENA_INCLUDED */
@@ -4,6 +4,29 @@
 static void *tc_palloc_block(tc_pool_t *pool, size_t size);
 static void *tc_palloc_large(tc_pool_t *pool, size_t size);
 
+
+static inline void *
+tc_pool_block_alloc(tc_slab_t *slab, size_t size)
+{
+    if (slab) {
+        return tc_slab_alloc(slab, size);
+    }
+
+    return tc_memalign(TC_POOL_ALIGNMENT, size);
+}
+
+
+static inline void
+tc_pool_block_free(tc_slab_t *slab, void *p)
+{
+    if (slab) {
+        tc_slab_free(slab, p);
+    } else {
+        tc_free(p);
+    }
+}
+
+
 /*
  * 创建内存池
  * size:     内存池初始大小
@@ -12,6 +35,17 @@ static void *tc_palloc_large(tc_pool_t *pool, size_t size);
 */
 tc_pool_t *
 tc_create_pool(int size, int sub_size, int pool_max)
+{
+    return tc_create_slab_pool(NULL, size, sub_size, pool_max);
+}
+
+
+/*
+ * 创建内存块来自 slab 的内存池
+ * 块的释放是 O(1) 的，池子频繁创建销毁时块可以在池子之间复用
+*/
+tc_pool_t *
+tc_create_slab_pool(tc_slab_t *slab, int size, int sub_size, int pool_max)
 {
     tc_pool_t  *p;
 
@@ -21,7 +55,7 @@ tc_create_pool(int size, int sub_size, int pool_max)
         size = TC_MIN_POOL_SIZE;
     }
 
-    p = tc_memalign(TC_POOL_ALIGNMENT, size);
+    p = tc_pool_block_alloc(slab, size);
     if (p != NULL) {
         /*
          * 初始化内存池结构
@@ -59,6 +93,7 @@ tc_create_pool(int size, int sub_size, int pool_max)
 
         p->current = p;
         p->sh_pt.large = NULL;
+        p->slab = slab;
     }
     
     return p;
@@ -73,6 +108,7 @@ tc_destroy_pool(tc_pool_t *pool)
 #if (TC_DEBUG)
     int                 tot_size, sub_size;
 #endif
+    tc_slab_t          *slab;
     tc_pool_t          *p, *n;
     tc_pool_large_t    *l;
 
@@ -87,11 +123,12 @@ tc_destroy_pool(tc_pool_t *pool)
     tot_size = pool->main_size - pool->sub_size;
     sub_size = pool->sub_size;
 #endif
+    slab = pool->slab;
     for (p = pool, n = pool->d.next; /* void */; p = n, n = n->d.next) {
 #if (TC_DEBUG)
         tot_size += sub_size;
 #endif
-        tc_free(p);
+        tc_pool_block_free(slab, p);
 
         if (n == NULL) {
             break;
@@ -192,6 +229,38 @@ tc_palloc(tc_pool_t *pool, size_t size)
 }
 
 
+/*
+ * 申请按 alignment 对齐的内存
+ * 只有第一个池子不会被 tc_check_block_free 逐块遍历，所以只在第一个池子里
+ * 对齐（中间的填充不会被当作块头）；第一个池子放不下时退化为 tc_palloc
+*/
+void *
+tc_pmemalign(tc_pool_t *pool, size_t size, size_t alignment)
+{
+    u_char            *m;
+    tc_mem_hid_info_t *hid;
+
+    size = size + MEM_HID_INFO_SZ;
+
+    m = tc_align_ptr(pool->d.last + MEM_HID_INFO_SZ, alignment);
+    m = m - MEM_HID_INFO_SZ;
+
+    if ((int) size <= pool->sh_num.max && m + size <= pool->d.end) {
+        pool->d.objs++;
+        pool->d.last = m + size;
+        hid = (tc_mem_hid_info_t *) m;
+        hid->large = 0;
+        hid->len = size;
+        hid->try_rel_cnt = 0;
+        hid->released = 0;
+
+        return m + MEM_HID_INFO_SZ;
+    }
+
+    return tc_palloc(pool, size - MEM_HID_INFO_SZ);
+}
+
+
 static bool 
 tc_check_block_free(tc_pool_t *root, tc_pool_t *p)
 {
@@ -292,7 +361,7 @@ tc_palloc_block(tc_pool_t *pool, size_t size)
         } else {
             psize = (size_t) (pool->d.end - (u_char *) pool);
         }
-        m = tc_memalign(TC_POOL_ALIGNMENT, psize);
+        m = tc_pool_block_alloc(pool->slab, psize);
 
         if (m == NULL) {
             return NULL;
@@ -53,14 +53,18 @@ struct tc_pool_s {
         tc_mem_hid_info_t *fp;            /*指向第一块未释放内存的附加信息(第二个及以后的内存池使用)*/
         tc_pool_large_t   *large;         /*大内存链表(第一个内存池使用)*/
     } sh_pt;
+    tc_slab_t             *slab;          /*内存块来自的slab，为NULL时直接向系统申请(第一个内存池使用)*/
 };
 
 
 tc_pool_t *tc_create_pool(int size, int sub_size, int pool_max);
+tc_pool_t *tc_create_slab_pool(tc_slab_t *slab, int size, int sub_size, 
+        int pool_max);
 void tc_destroy_pool(tc_pool_t *pool);
 
 void *tc_palloc(tc_pool_t *pool, size_t size);
 void *tc_pcalloc(tc_pool_t *pool, size_t size);
+void *tc_pmemalign(tc_pool_t *pool, size_t size, size_t alignment);
 tc_int_t tc_pfree(tc_pool_t *pool, void *p);
 
 
@@ -0,0 +1,114 @@
+
+#include <xcopy.h>
+
+#define tc_ring_rec_size(len)                                                \
+    tc_align(sizeof(tc_ring_rec_t) + (len), sizeof(tc_ring_rec_t))
+
+
+/* size is rounded up to a power of two */
+int
+tc_ring_init(tc_ring_t *ring, size_t size)
+{
+    uint64_t n;
+
+    for (n = TC_CPU_CACHE_LINE; n < size; n <<= 1) {
+        /* void */
+    }
+
+    tc_memzero(ring, sizeof(tc_ring_t));
+
+    ring->buf = tc_memalign(TC_CPU_CACHE_LINE, n);
+    if (ring->buf == NULL) {
+        return TC_ERR;
+    }
+
+    ring->size = n;
+    ring->mask = n - 1;
+
+    return TC_OK;
+}
+
+
+void
+tc_ring_destroy(tc_ring_t *ring)
+{
+    if (ring->buf != NULL) {
+        tc_free(ring->buf);
+        ring->buf = NULL;
+    }
+}
+
+
+/* returns room for len bytes or NULL if the ring is full */
+void *
+tc_ring_reserve(tc_ring_t *ring, uint32_t len, uint32_t type)
+{
+    uint64_t        pos, need, skip;
+    tc_ring_rec_t  *rec;
+
+    need = tc_ring_rec_size(len);
+    pos  = ring->head & ring->mask;
+    skip = 0;
+
+    if (pos + need > ring->size) {
+        /* the rest of the buffer is wasted, the record goes to the start */
+        skip = ring->size - pos;
+    }
+
+    if (ring->head + skip + need - ring->tail_cache > ring->size) {
+        ring->tail_cache = tc_ring_load(&ring->tail);
+        if (ring->head + skip + need - ring->tail_cache > ring->size) {
+            return NULL;
+        }
+    }
+
+    if (skip) {
+        rec = (tc_ring_rec_t *) (ring->buf + pos);
+        rec->len = TC_RING_WRAP;
+        pos = 0;
+    }
+
+    rec = (tc_ring_rec_t *) (ring->buf + pos);
+    rec->len  = len;
+    rec->type = type;
+
+    ring->next = ring->head + skip + need;
+
+    return (u_char *) rec + sizeof(tc_ring_rec_t);
+}
+
+
+/* returns the oldest record or NULL if the ring is empty */
+void *
+tc_ring_peek(tc_ring_t *ring, uint32_t *len, uint32_t *type)
+{
+    uint64_t        pos, tail;
+    tc_ring_rec_t  *rec;
+
+    tail = ring->tail;
+
+    if (tail == ring->head_cache) {
+        ring->head_cache = tc_ring_load(&ring->head);
+        if (tail == ring->head_cache) {
+            return NULL;
+        }
+    }
+
+    pos = tail & ring->mask;
+    rec = (tc_ring_rec_t *) (ring->buf + pos);
+
+    if (rec->len == TC_RING_WRAP) {
+        tail += ring->size - pos;
+        rec = (tc_ring_rec_t *) ring->buf;
+    }
+
+    *len = rec->len;
+    if (type) {
+        *type = rec->type;
+    }
+
+    ring->tail_next = tail + tc_ring_rec_size(rec->len);
+
+    return (u_char *) rec + sizeof(tc_ring_rec_t);
+}
+
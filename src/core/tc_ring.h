@@ -0,0 +1,73 @@
+#ifndef  TC_RING_INCLUDED
+#define  TC_RING_INCLUDED
+
+#include <xcopy.h>
+
+/*
+ * Single producer, single consumer ring of variable sized records.
+ *
+ * The producer reserves room for a record, fills it in place and commits
+ * it; the consumer peeks at the oldest record, uses it in place and then
+ * consumes it.  Records never straddle the end of the buffer, a wrap
+ * marker sends the consumer back to the start instead.  The two sides
+ * only share the head and tail counters, which live on separate cache
+ * lines, and each side caches the other's counter so that it reads it
+ * only when the ring looks full or empty.
+ */
+
+#define TC_RING_WRAP  0xffffffff
+
+typedef struct {
+    uint32_t  len;
+    uint32_t  type;
+} tc_ring_rec_t;
+
+struct tc_ring_s {
+    /* written by the producer */
+    uint64_t          head;
+    uint64_t          next;           /* head after the reserved record */
+    uint64_t          tail_cache;
+    u_char            pad0[TC_CPU_CACHE_LINE - 3 * sizeof(uint64_t)];
+
+    /* written by the consumer */
+    uint64_t          tail;
+    uint64_t          tail_next;      /* tail after the peeked record */
+    uint64_t          head_cache;
+    u_char            pad1[TC_CPU_CACHE_LINE - 3 * sizeof(uint64_t)];
+
+    u_char           *buf;
+    uint64_t          size;
+    uint64_t          mask;
+};
+
+#define tc_ring_load(p)      __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define tc_ring_store(p, v)  __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+int tc_ring_init(tc_ring_t *ring, size_t size);
+void tc_ring_destroy(tc_ring_t *ring);
+void *tc_ring_reserve(tc_ring_t *ring, uint32_t len, uint32_t type);
+void *tc_ring_peek(tc_ring_t *ring, uint32_t *len, uint32_t *type);
+
+
+static inline void
+tc_ring_commit(tc_ring_t *ring)
+{
+    tc_ring_store(&ring->head, ring->next);
+}
+
+
+static inline void
+tc_ring_consume(tc_ring_t *ring)
+{
+    tc_ring_store(&ring->tail, ring->tail_next);
+}
+
+
+/* bytes in use, may be read from either side */
+static inline uint64_t
+tc_ring_used(tc_ring_t *ring)
+{
+    return tc_ring_load(&ring->head) - tc_ring_load(&ring->tail);
+}
+
+#endif /* TC_RING_INCLUDED */
@@ -0,0 +1,263 @@
+
+#include <xcopy.h>
+
+#define TC_SLAB_HDR_SIZE                                                     \
+    tc_align(sizeof(tc_slab_chunk_t), TC_CPU_CACHE_LINE)
+
+#define tc_slab_chunk(p)                                                     \
+    ((tc_slab_chunk_t *) ((uintptr_t) (p) &                                  \
+                          ~((uintptr_t) TC_SLAB_CHUNK_SIZE - 1)))
+
+static const uint16_t tc_slab_sizes[TC_SLAB_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    144, 160, 176, 192, 208, 224, 240, 256,
+    320, 384, 448, 512,
+    640, 768, 896, 1024,
+    1280, 1536, 1792, 2048,
+    2560, 3072, 3584, 4096,
+    5120, 6144, 7168, 8192
+};
+
+/* size class of every 16 bytes step */
+static u_char tc_slab_index[(TC_SLAB_MAX_SIZE >> 4) + 1];
+
+
+static void
+tc_slab_link(tc_slab_chunk_t **head, tc_slab_chunk_t *c)
+{
+    c->prev = NULL;
+    c->next = *head;
+    if (*head) {
+        (*head)->prev = c;
+    }
+    *head = c;
+}
+
+
+static void
+tc_slab_unlink(tc_slab_chunk_t **head, tc_slab_chunk_t *c)
+{
+    if (c->prev) {
+        c->prev->next = c->next;
+    } else {
+        *head = c->next;
+    }
+    if (c->next) {
+        c->next->prev = c->prev;
+    }
+    c->prev = NULL;
+    c->next = NULL;
+}
+
+
+static void
+tc_slab_release_chunk(tc_slab_t *slab, tc_slab_chunk_t *c)
+{
+    slab->chunks--;
+
+    if (c->arena) {
+        tc_arena_free(slab->arena, c, c->end - (u_char *) c);
+    } else {
+        tc_free(c);
+    }
+}
+
+
+static tc_slab_chunk_t *
+tc_slab_new_chunk(tc_slab_t *slab, tc_uint_t cls, size_t size)
+{
+    tc_uint_t        from_arena;
+    tc_slab_chunk_t *c;
+
+    c = NULL;
+    from_arena = 0;
+    if (slab->arena) {
+        c = tc_arena_alloc(slab->arena, size);
+        from_arena = (c != NULL);
+    }
+
+    if (c == NULL) {
+        c = tc_memalign(TC_SLAB_CHUNK_SIZE, size);
+        if (c == NULL) {
+            return NULL;
+        }
+    }
+
+    c->prev    = NULL;
+    c->next    = NULL;
+    c->free    = NULL;
+    c->last    = (u_char *) c + TC_SLAB_HDR_SIZE;
+    c->end     = (u_char *) c + size;
+    c->used    = 0;
+    c->cls     = cls;
+    c->partial = 0;
+    c->arena   = from_arena;
+
+    slab->chunks++;
+
+    return c;
+}
+
+
+tc_slab_t *
+tc_slab_create(tc_arena_t *arena)
+{
+    int        i, cls;
+    tc_slab_t *slab;
+
+    if (tc_slab_index[TC_SLAB_MAX_SIZE >> 4] == 0) {
+        cls = 0;
+        for (i = 0; i <= (TC_SLAB_MAX_SIZE >> 4); i++) {
+            while ((i << 4) > tc_slab_sizes[cls]) {
+                cls++;
+            }
+            tc_slab_index[i] = (u_char) cls;
+        }
+    }
+
+    slab = tc_alloc(sizeof(tc_slab_t));
+    if (slab != NULL) {
+        tc_memzero(slab, sizeof(tc_slab_t));
+        slab->arena = arena;
+    }
+
+    return slab;
+}
+
+
+static void
+tc_slab_free_list(tc_slab_chunk_t *c)
+{
+    tc_slab_chunk_t *next;
+
+    while (c) {
+        next = c->next;
+        /* arena chunks go away with the arena */
+        if (!c->arena) {
+            tc_free(c);
+        }
+        c = next;
+    }
+}
+
+
+void
+tc_slab_destroy(tc_slab_t *slab)
+{
+    int i;
+
+    for (i = 0; i < TC_SLAB_CLASSES; i++) {
+        tc_slab_free_list(slab->partial[i]);
+        tc_slab_free_list(slab->full[i]);
+    }
+    tc_slab_free_list(slab->large);
+
+    tc_log_info(LOG_NOTICE, 0, "slab alloc:%llu, free:%llu, chunks:%u",
+            slab->alloc_cnt, slab->free_cnt, slab->chunks);
+
+    tc_free(slab);
+}
+
+
+static void *
+tc_slab_alloc_large(tc_slab_t *slab, size_t size)
+{
+    tc_slab_chunk_t *c;
+
+    c = tc_slab_new_chunk(slab, TC_SLAB_LARGE, TC_SLAB_HDR_SIZE + size);
+    if (c == NULL) {
+        return NULL;
+    }
+
+    c->used = 1;
+    tc_slab_link(&slab->large, c);
+    slab->large_cnt++;
+    slab->alloc_cnt++;
+
+    return c->last;
+}
+
+
+void *
+tc_slab_alloc(tc_slab_t *slab, size_t size)
+{
+    u_char          *m;
+    tc_uint_t        cls, cls_size;
+    tc_slab_chunk_t *c;
+
+    if (size > TC_SLAB_MAX_SIZE) {
+        return tc_slab_alloc_large(slab, size);
+    }
+
+    cls = tc_slab_index[(size + 15) >> 4];
+    cls_size = tc_slab_sizes[cls];
+
+    c = slab->partial[cls];
+    if (c == NULL) {
+        c = tc_slab_new_chunk(slab, cls, TC_SLAB_CHUNK_SIZE);
+        if (c == NULL) {
+            return NULL;
+        }
+        tc_slab_link(&slab->partial[cls], c);
+        c->partial = 1;
+    }
+
+    if (c->free) {
+        m = c->free;
+        c->free = *(void **) m;
+    } else {
+        m = c->last;
+        c->last += cls_size;
+    }
+    c->used++;
+
+    if (c->free == NULL && c->last + cls_size > c->end) {
+        tc_slab_unlink(&slab->partial[cls], c);
+        tc_slab_link(&slab->full[cls], c);
+        c->partial = 0;
+    }
+
+    slab->alloc_cnt++;
+
+    return m;
+}
+
+
+void
+tc_slab_free(tc_slab_t *slab, void *p)
+{
+    tc_uint_t        cls;
+    tc_slab_chunk_t *c;
+
+    if (p == NULL) {
+        return;
+    }
+
+    c   = tc_slab_chunk(p);
+    cls = c->cls;
+    slab->free_cnt++;
+
+    if (cls == TC_SLAB_LARGE) {
+        tc_slab_unlink(&slab->large, c);
+        slab->large_cnt--;
+        tc_slab_release_chunk(slab, c);
+        return;
+    }
+
+    *(void **) p = c->free;
+    c->free = p;
+    c->used--;
+
+    if (!c->partial) {
+        tc_slab_unlink(&slab->full[cls], c);
+        tc_slab_link(&slab->partial[cls], c);
+        c->partial = 1;
+    }
+
+    /* keep the last chunk with free slots of this class for reuse */
+    if (c->used == 0 && (c->prev || c->next)) {
+        tc_slab_unlink(&slab->partial[cls], c);
+        tc_slab_release_chunk(slab, c);
+    }
+}
+
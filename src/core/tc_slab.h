@@ -0,0 +1,56 @@
+#ifndef  TC_SLAB_INCLUDED
+#define  TC_SLAB_INCLUDED
+
+#include <xcopy.h>
+
+/*
+ * Size-class slab allocator.
+ *
+ * Objects carry no header: every chunk is aligned to its own size, so the
+ * chunk (and thereby the size class) of an object is found by masking its
+ * address.  Each chunk keeps its own freelist; chunks with free slots sit
+ * on a per-class partial list, so both alloc and free are O(1), and a
+ * chunk whose objects are all freed goes back to the system unless it is
+ * the last one with free slots of its class.
+ *
+ * Requests above TC_SLAB_MAX_SIZE get a dedicated aligned chunk.  With an
+ * arena, chunks are carved from its huge page regions where possible.
+ */
+
+#define TC_SLAB_CHUNK_SIZE  65536
+#define TC_SLAB_MAX_SIZE    8192
+#define TC_SLAB_CLASSES     36
+#define TC_SLAB_LARGE       TC_SLAB_CLASSES
+
+typedef struct tc_slab_chunk_s tc_slab_chunk_t;
+
+struct tc_slab_chunk_s {
+    tc_slab_chunk_t *prev;
+    tc_slab_chunk_t *next;
+    void            *free;      /* freed slots */
+    u_char          *last;      /* never used slots start here */
+    u_char          *end;
+    uint32_t         used;
+    uint32_t         cls:8;
+    uint32_t         partial:1;
+    uint32_t         arena:1;
+};
+
+struct tc_slab_s {
+    tc_slab_chunk_t *partial[TC_SLAB_CLASSES];
+    tc_slab_chunk_t *full[TC_SLAB_CLASSES];
+    tc_slab_chunk_t *large;
+    tc_arena_t      *arena;
+    uint32_t         chunks;
+    uint32_t         large_cnt;
+    uint64_t         alloc_cnt;
+    uint64_t         free_cnt;
+};
+
+
+tc_slab_t *tc_slab_create(tc_arena_t *arena);
+void tc_slab_destroy(tc_slab_t *slab);
+void *tc_slab_alloc(tc_slab_t *slab, size_t size);
+void tc_slab_free(tc_slab_t *slab, void *p);
+
+#endif /* TC_SLAB_INCLUDED */
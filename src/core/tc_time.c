@@ -1,12 +1,13 @@
 
 #include <xcopy.h>
 
-volatile char      *tc_error_log_time;
-volatile time_t     tc_current_time_sec;
-volatile long       tc_current_time_msec;
-volatile struct tm  tc_current_tm;
+/* every replay worker keeps its own clock */
+tc_thread_local volatile char      *tc_error_log_time;
+tc_thread_local volatile time_t     tc_current_time_sec;
+tc_thread_local volatile long       tc_current_time_msec;
+tc_thread_local volatile struct tm  tc_current_tm;
 
-static char cache_err_log_time[TC_ERR_LOG_TIME_STR_LEN];
+static tc_thread_local char cache_err_log_time[TC_ERR_LOG_TIME_STR_LEN];
 
 void 
 tc_time_init(void)
@@ -12,10 +12,10 @@
     (((s2) * 1000 + (ms2)) - ((s1) * 1000 + (ms1)))
 
 extern volatile int        tc_update_time;
-extern volatile char      *tc_error_log_time;
-extern volatile long       tc_current_time_msec;
-extern volatile time_t     tc_current_time_sec;
-extern volatile struct tm  tc_current_tm;
+extern tc_thread_local volatile char      *tc_error_log_time;
+extern tc_thread_local volatile long       tc_current_time_msec;
+extern tc_thread_local volatile time_t     tc_current_time_sec;
+extern tc_thread_local volatile struct tm  tc_current_tm;
 
 void tc_time_init(void);
 void tc_time_update(void);
@@ -9,6 +9,7 @@
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
 #include <linux/if_ether.h>
+#include <linux/sock_diag.h>
 #if (TC_UDP)
 #include <netinet/udp.h>
 #endif
@@ -20,6 +21,9 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <stddef.h>
 #include <signal.h>
 #include <unistd.h>
@@ -31,6 +35,11 @@
 #include <string.h>
 #include <stdint.h>
 #include <getopt.h>
+#include <dirent.h>
+#include <sys/un.h>
+#if (TC_HAVE_SCHED_SETAFFINITY)
+#include <sched.h>
+#endif
 #if (TC_OFFLINE || TC_PCAP || TC_PCAP_SND)
 #include <pcap.h>
 #endif
@@ -39,6 +48,30 @@
 #undef TC_PCAP
 #endif
 
+#if (TC_HAVE_EVENTFD)
+#include <sys/eventfd.h>
+#endif
+
+#if (TC_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+#if (TC_HAVE_TIMERFD)
+#include <sys/timerfd.h>
+#endif
+
+#if (TC_THREADS || TC_OFFLINE)
+#include <pthread.h>
+#endif
+
+#if (TC_THREADS)
+#include <semaphore.h>
+/* state owned by one replay worker */
+#define tc_thread_local  __thread
+#else
+#define tc_thread_local
+#endif
+
 #define VERSION "1.0.0"  
 
 #define INTERNAL_VERSION 6
@@ -46,6 +79,9 @@
 typedef struct tc_cmd_s         tc_cmd_t;
 typedef struct tc_module_s      tc_module_t;
 typedef struct tc_pool_s        tc_pool_t;
+typedef struct tc_slab_s        tc_slab_t;
+typedef struct tc_arena_s       tc_arena_t;
+typedef struct tc_ring_s        tc_ring_t;
 typedef struct tc_conf_s        tc_conf_t;
 typedef struct tc_file_s        tc_file_t;
 typedef struct tc_buf_s         tc_buf_t;
@@ -73,6 +109,9 @@ typedef struct tc_sess_s        tc_sess_t;
 
 #define MAX_FILTER_LENGH 4096 
 #define M_IP_NUM 4096
+#define MAX_CLT_RANGES 256      /* registered when connecting */
+#define MAX_REPLAY_CLTS 64      /* -E clients of an archive */
+#define MAX_PCAP_FILES 16       /* files mixed by -i */
 
 #define TC_PCAP_BUF_SIZE 16777216
 
@@ -97,7 +136,8 @@ typedef struct tc_sess_s        tc_sess_t;
 #define TC_MIN_SESS_POOL_SIZE                                                    \
         tc_align((TC_MIN_POOL_SIZE + sizeof(tc_sess_t) + sizeof(link_list) +     \
                     2 * sizeof(tc_event_timer_t) + sizeof(link_node) +           \
-                    sizeof(hash_node) + 6 * MEM_HID_INFO_SZ), TC_POOL_ALIGNMENT)
+                    sizeof(hash_node) + 6 * MEM_HID_INFO_SZ +                    \
+                    TC_CPU_CACHE_LINE), TC_POOL_ALIGNMENT)
 
 #define DEFAULT_MTU   1500
 #define DEFAULT_MSS   1460
@@ -108,6 +148,8 @@ typedef struct tc_sess_s        tc_sess_t;
 
 
 #define MAX_REAL_SERVERS 32
+#define TC_SHM_PATH_LEN  108
+#define TC_SHM_PATH      "/tmp/intercept.%u.sock"
 #define MAX_IDLE_TIME 86400
 #define MAX_RETHRESH_TIME 86400
 #define MAX_IDLE_MS_TIME (MAX_IDLE_TIME * 1000)
@@ -116,7 +158,11 @@ typedef struct tc_sess_s        tc_sess_t;
 #define TCP_MS_TIMEOUT 6000
 #define SESS_EST_MS_TIMEOUT 3000
 #define OUTPUT_INTERVAL  30000
-#define RETRY_INTERVAL  12000
+#define RETRY_INTERVAL  12000            /* the longest backoff */
+#define RETRY_MIN_INTERVAL  500
+#define KEEPALIVE_IDLE  10               /* seconds */
+#define KEEPALIVE_INTVL 3
+#define KEEPALIVE_CNT   3
 #define PACK_LOSS_TIMEOUT 10000
 #define DEFAULT_RTO 100
 
@@ -126,7 +172,6 @@ typedef struct tc_sess_s        tc_sess_t;
 #define OFFLINE_TAIL_TIMEOUT 120 
 
 #define MAX_WRITE_TRIES 1024
-#define MAX_READ_LOG_TRIES 65536
 
 #if (TC_MILLION_SUPPORT)
 #define MAX_MEMORY_SIZE 4194304
@@ -177,6 +222,11 @@ typedef struct tc_sess_s        tc_sess_t;
 /* route flags */
 #define  CLIENT_ADD   1
 #define  CLIENT_DEL   2
+/*
+ * clients clt_ip to target_ip, ports clt_port to target_port, all of
+ * them in network byte order, are routed back to this connection
+ */
+#define  CLIENT_RANGE_ADD  3
 
 #define PAYLOAD_FULL 1
 #define PAYLOAD_NOT_FULL 2
@@ -307,10 +357,15 @@ typedef struct connections_s{
     short active;
     uint16_t port;
     uint32_t ip;
-    int index; 
+    uint32_t net;               /* targets routed through it, if mask */
+    uint32_t mask;
     int num;
     int remained_num;
+    int backoff;                /* ms to wait before the next try */
+    long next_try;              /* in ms */
     int fds[MAX_CONN_NUM];
+    /* unix socket of a co-located intercept taking a response ring */
+    char shm_path[TC_SHM_PATH_LEN];
 }conns_t;
 
 /* global functions */
@@ -347,6 +402,7 @@ struct tc_module_s{
 #define TC_ERR    -1
 #define TC_ERR_EXIT  1
 #define TC_DELAYED  -2
+#define TC_AGAIN    -3
 
 #define tc_cpymem(d, s, l) (((char *) memcpy(d, (void *) s, l)) + (l))
 #define tc_memzero(d, l) (memset(d, 0, l))
@@ -355,6 +411,8 @@ struct tc_module_s{
 #define tc_max(val1, val2)  ((val1 < val2) ? (val2) : (val1))
 #define tc_min(val1, val2)  ((val1 > val2) ? (val2) : (val1))
 #define tc_string(str)     { sizeof(str) - 1, (u_char *) str }
+#define tc_static_assert(cond, name)                                         \
+    typedef char tc_static_assert_##name[(cond) ? 1 : -1]
 
 #include <tc_config.h>
 #include <tc_link_list.h>
@@ -371,6 +429,10 @@ struct tc_module_s{
 #include <tc_evp.h>
 #endif
 #include <tc_alloc.h>
+#include <tc_arena.h>
+#include <tc_slab.h>
+#include <tc_ring.h>
+#include <tc_affinity.h>
 #include <tc_palloc.h>
 #include <tc_event.h>
 #include <tc_array.h>
@@ -92,6 +92,7 @@ int tc_epoll_destroy(tc_event_loop_t *loop)
 
 int tc_epoll_add_event(tc_event_loop_t *loop, tc_event_t *ev, int events)
 {
+    int                      op;
     struct epoll_event       event;
     tc_epoll_multiplex_io_t *io;
 
@@ -107,27 +108,30 @@ int tc_epoll_add_event(tc_event_loop_t *loop, tc_event_t *ev, int events)
         return TC_EVENT_ERROR;
     }
 
-    if ((events == TC_EVENT_READ && ev->read_handler
-            && ev->write_handler == NULL))
+    if (((events & TC_EVENT_READ) && ev->read_handler == NULL)
+            || ((events & TC_EVENT_WRITE) && ev->write_handler == NULL))
     {
-        event.data.u64 = 0;
-        event.data.fd = ev->fd;
-        event.events = EPOLLIN;
-        if(epoll_ctl(io->efd, EPOLL_CTL_ADD, ev->fd, &event) == -1) {
-            tc_log_info(LOG_ALERT, 0, "epoll_ctl add read fd failed.");
-            return TC_EVENT_ERROR;
-        }
-    } else if (events == TC_EVENT_WRITE && ev->write_handler
-            && ev->read_handler == NULL) 
-    {
-        event.data.u64 = 0;
-        event.data.fd = ev->fd;
-        event.events = EPOLLOUT;
-        if(epoll_ctl(io->efd, EPOLL_CTL_ADD, ev->fd, &event) == -1) {
-            tc_log_info(LOG_ALERT, 0, "epoll_ctl add write fd failed.");
-            return TC_EVENT_ERROR;
-        }
-    } else {
+        return TC_EVENT_ERROR;
+    }
+
+    /* an event already registered gets the new interest added */
+    events |= ev->reg_evs;
+    op = ev->reg_evs == TC_EVENT_NONE ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+
+    event.data.u64 = 0;
+    event.data.fd = ev->fd;
+    event.events = 0;
+
+    if (events & TC_EVENT_READ) {
+        event.events |= EPOLLIN;
+    }
+
+    if (events & TC_EVENT_WRITE) {
+        event.events |= EPOLLOUT;
+    }
+
+    if (epoll_ctl(io->efd, op, ev->fd, &event) == -1) {
+        tc_log_info(LOG_ALERT, errno, "epoll_ctl add fd(%d) failed.", ev->fd);
         return TC_EVENT_ERROR;
     }
 
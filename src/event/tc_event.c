@@ -42,6 +42,13 @@ int tc_event_loop_init(tc_event_loop_t *loop, int size)
         loop->active_events = NULL;
         loop->pool = pool;
         loop->size = size;
+        loop->budget[TC_EVENT_PRIO_HIGH] = TC_EVENT_HIGH_BUDGET;
+        loop->budget[TC_EVENT_PRIO_LOW] = TC_EVENT_LOW_BUDGET;
+        loop->timer_budget = TC_EVENT_TIMER_BUDGET;
+        loop->pending = 0;
+        loop->busy_poll = 0;
+        loop->flush = NULL;
+        tc_memzero(&loop->stat, sizeof(tc_event_stat_t));
 
         /*
          * 创建action对象
@@ -136,12 +143,98 @@ int tc_event_del(tc_event_loop_t *loop, tc_event_t *ev, int events)
 }
 
 
+/*
+ * 处理active链表中优先级为prio的事件, 处理过的事件从链表中摘除,
+ * 这样被销毁的事件不会在后面的pass中再被访问
+ */
+static int tc_event_dispatch(tc_event_loop_t *loop, int prio)
+{
+    tc_event_t  *act_event, **prev;
+
+    prev = &loop->active_events;
+
+    while ((act_event = *prev) != NULL) {
+
+        if (act_event->prio != prio) {
+            prev = &act_event->next;
+            continue;
+        }
+
+        *prev = act_event->next;
+
+        if (act_event->events & TC_EVENT_READ) {
+            if (act_event->read_handler &&
+                    act_event->read_handler(act_event) == TC_ERR_EXIT)
+            {
+                return TC_ERR_EXIT;
+            }
+        }
+
+        if (act_event->events & TC_EVENT_WRITE) {
+            if (act_event->write_handler &&
+                    act_event->write_handler(act_event) == TC_ERR_EXIT)
+            {
+                return TC_ERR_EXIT;
+            }
+        }
+
+        if (act_event->reg_evs == TC_EVENT_NONE) {
+
+            tc_event_destroy(act_event, 0);
+        }
+    }
+
+    return TC_OK;
+}
+
+
+/*
+ * busy poll: 阻塞之前先以0超时poll最多busy_poll微秒,
+ * 省掉睡眠和唤醒的延迟, 代价是占满一个cpu
+ * 自旋不超过timeout(毫秒), 自旋过的时间从阻塞poll的timeout中扣除,
+ * 这样定时器不会因为自旋而晚到
+ */
+static void tc_event_spin(tc_event_loop_t *loop, long timeout)
+{
+    long             limit, spent;
+    struct timespec  start, now;
+
+    limit = tc_min(loop->busy_poll, timeout * 1000);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for ( ;; ) {
+        loop->actions->poll(loop, 0);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        spent = (now.tv_sec - start.tv_sec) * 1000000 
+            + (now.tv_nsec - start.tv_nsec) / 1000;
+
+        if (loop->active_events != NULL || tc_over) {
+            loop->stat.spins++;
+            loop->stat.spin_usec += spent;
+            return;
+        }
+
+        if (spent >= limit) {
+            break;
+        }
+    }
+
+    loop->stat.sleeps++;
+    loop->stat.spin_usec += spent;
+
+    timeout -= spent / 1000;
+    if (timeout > 0) {
+        loop->actions->poll(loop, timeout);
+    }
+}
+
+
 int tc_event_proc_cycle(tc_event_loop_t *loop)
 {
-    int                  ret;
     long                 timeout;
-    tc_msec_t            delta;
-    tc_event_t          *act_event, *act_next;
+    tc_uint_t            expired;
     tc_event_actions_t  *actions;
 
     actions = loop->actions;
@@ -151,27 +244,32 @@ int tc_event_proc_cycle(tc_event_loop_t *loop)
          * 得到距离当前时间最小的超时时间
          * 把这个时间作为poll的超时时间
          * 就不会影响超时事件的处理
+         * 上一轮有来源用完了budget, 则不等待
         */
-        timeout = tc_event_find_timer();
-        if (timeout == 0 || timeout > 1000) {
-            timeout = 500;
+        if (loop->pending) {
+            timeout = 0;
+        } else {
+            timeout = tc_event_find_timer();
+            if (timeout < 0 || timeout > 1000) {
+                timeout = 500;
+            }
         }
 
         /*
          * 清空active事件链表
         */
         loop->active_events = NULL;
-
-        /*
-         * 记录当前时间
-        */
-        delta = tc_current_time_msec;
+        loop->pending = 0;
 
         /*
          * poll
          * timeout时间内等待网络事件
         */
-        ret = actions->poll(loop, timeout);
+        if (timeout && loop->busy_poll) {
+            tc_event_spin(loop, timeout);
+        } else {
+            actions->poll(loop, timeout);
+        }
         if (tc_over) {
             goto FINISH;
         }
@@ -181,56 +279,38 @@ int tc_event_proc_cycle(tc_event_loop_t *loop)
         */
         tc_time_update();
 
+        loop->stat.rounds++;
+
         /*
-         * 计算时间差值，
+         * 先处理intercept的响应, 它们推进会话的窗口
+         * poll返回error或again时active链表为空, 但仍然要处理到期的定时器
         */
-        delta = tc_current_time_msec - delta;
+        if (tc_event_dispatch(loop, TC_EVENT_PRIO_HIGH) == TC_ERR_EXIT) {
+            goto FINISH;
+        }
 
         /*
-         * 如果poll立即返回, delta 就有可能在1ms内, 本次loop就不用再查找超时事件
-         * 属于优化
+         * 再处理到期的定时器(重传, 延迟ack等)
         */
-        if (delta) {
-            /*
-             * 处理超时事件
-            */
-            tc_event_expire_timers();
+        expired = tc_event_expire_timers(loop->timer_budget);
+        loop->stat.timers += expired;
+        if (expired >= (tc_uint_t) loop->timer_budget) {
+            loop->stat.timer_exhausted++;
+            loop->pending = 1;
         }
 
         /*
-         * poll返回error或again
-         * 则没有网络io事件需要处理, 直接进入下一轮loop
+         * 最后处理抓包
         */
-        if (ret == TC_EVENT_ERROR || ret == TC_EVENT_AGAIN) {
-            continue;
+        if (tc_event_dispatch(loop, TC_EVENT_PRIO_LOW) == TC_ERR_EXIT) {
+            goto FINISH;
         }
 
         /*
-         * 处理所有激活的网络IO事件
+         * 本轮攒下的输出(给intercept的路由信息)一次发出
         */
-        for (act_event = loop->active_events; act_event; act_event = act_next) {
-            act_next = act_event->next;
-
-            if (act_event->events & TC_EVENT_READ) {
-                if (act_event->read_handler &&
-                        act_event->read_handler(act_event) == TC_ERR_EXIT)
-                {
-                    goto FINISH;
-                }
-            }
-
-            if (act_event->events & TC_EVENT_WRITE) {
-                if (act_event->write_handler &&
-                        act_event->write_handler(act_event) == TC_ERR_EXIT)
-                {
-                    goto FINISH;
-                }
-            }
-
-            if (act_event->reg_evs == TC_EVENT_NONE) {
-
-                tc_event_destroy(act_event, 0);
-            }
+        if (loop->flush) {
+            loop->flush(loop);
         }
     }
 
@@ -239,6 +319,46 @@ FINISH:
 }
 
 
+static void tc_event_output_work(tc_event_stat_t *stat, const char *name,
+        int prio)
+{
+    /* the depth is left out where no source of the priority reports it */
+    if (stat->depth_known & (1 << prio)) {
+        tc_log_info(LOG_NOTICE, 0, "%s work:%llu,exhausted:%llu,max depth:%u",
+                name, stat->work[prio], stat->exhausted[prio], 
+                stat->max_depth[prio]);
+    } else {
+        tc_log_info(LOG_NOTICE, 0, "%s work:%llu,exhausted:%llu",
+                name, stat->work[prio], stat->exhausted[prio]);
+    }
+}
+
+
+void tc_event_output_stat(tc_event_loop_t *loop)
+{
+    tc_event_stat_t *stat;
+
+    stat = &loop->stat;
+
+    tc_log_info(LOG_NOTICE, 0, "loop rounds:%llu,timers:%llu,exhausted:%llu",
+            stat->rounds, stat->timers, stat->timer_exhausted);
+    tc_event_output_work(stat, "resp", TC_EVENT_PRIO_HIGH);
+    tc_event_output_work(stat, "capture", TC_EVENT_PRIO_LOW);
+
+    if (loop->busy_poll) {
+        tc_log_info(LOG_NOTICE, 0, 
+                "busy poll spins:%llu,sleeps:%llu,spin hit:%.2f%%,spin:%llums",
+                stat->spins, stat->sleeps, 
+                stat->spins + stat->sleeps ? 
+                100.0 * stat->spins / (stat->spins + stat->sleeps) : 0.0,
+                stat->spin_usec / 1000);
+    }
+
+    stat->max_depth[TC_EVENT_PRIO_HIGH] = 0;
+    stat->max_depth[TC_EVENT_PRIO_LOW] = 0;
+}
+
+
 tc_event_t *tc_event_create(tc_pool_t *pool, int fd, tc_event_handler_pt reader,
         tc_event_handler_pt writer)
 {
@@ -250,6 +370,7 @@ tc_event_t *tc_event_create(tc_pool_t *pool, int fd, tc_event_handler_pt reader,
         ev->events = 0;
         ev->reg_evs = 0;
         ev->index = -1;
+        ev->prio = TC_EVENT_PRIO_LOW;
         ev->fd = fd;
         ev->next = NULL;
         ev->read_handler = reader;
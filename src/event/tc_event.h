@@ -15,6 +15,19 @@
 #define TC_EVENT_READ  1
 #define TC_EVENT_WRITE 2
 
+/*
+ * 每轮loop的调度顺序: 高优先级事件(intercept的响应), 到期定时器,
+ * 低优先级事件(抓包). 每类来源每轮最多处理budget个单位,
+ * 用完budget的来源下一轮poll不再等待, 剩余的工作留给下一轮
+ */
+#define TC_EVENT_PRIO_HIGH   0
+#define TC_EVENT_PRIO_LOW    1
+#define TC_EVENT_PRIO_NUM    2
+
+#define TC_EVENT_HIGH_BUDGET   64      /* messages from intercept */
+#define TC_EVENT_LOW_BUDGET    256     /* captured packets */
+#define TC_EVENT_TIMER_BUDGET  1024    /* expired timers */
+
 #define tc_event_push_active_event(head, ev) \
     ev->next = head; head = ev;
 
@@ -32,6 +45,7 @@ typedef int (*ev_event_poll_pt) (tc_event_loop_t *loop, long timeout);
 
 typedef int (*tc_event_handler_pt) (tc_event_t *ev);
 typedef void (*tc_event_timer_handler_pt) (tc_event_timer_t *evt);
+typedef void (*tc_event_flush_pt) (tc_event_loop_t *loop);
 
 typedef struct {
     ev_create_pt        create;
@@ -47,6 +61,7 @@ struct tc_event_s {
     int                  events;             /*被激活的事件 位或*/
     int                  reg_evs;            /*该fd上注册的事件类型,可读或可写，位或*/
     int                  index;              /*该event序号*/
+    int                  prio;               /*调度优先级 TC_EVENT_PRIO_* */
     tc_event_loop_t     *loop;               /*event所属的event_loop*/
     tc_event_handler_pt  read_handler;
     tc_event_handler_pt  write_handler;
@@ -57,14 +72,39 @@ typedef tc_rbtree_key_t      tc_msec_t;
 typedef tc_rbtree_key_int_t  tc_msec_int_t;
 typedef struct tm            tc_tm_t;
 
+#if (TC_RBTREE_TIMER)
+typedef tc_rbtree_node_t     tc_event_timer_node_t;
+#else
+/* timing wheel slot link */
+typedef struct {
+    tc_msec_t                  key;
+    tc_event_timer_t          *next;
+    tc_event_timer_t         **prev;
+} tc_event_timer_node_t;
+#endif
+
 struct tc_event_timer_s {
     unsigned                   timer_set:1;
     void                      *data;
     tc_pool_t                 *pool;
-    tc_rbtree_node_t           timer;
+    tc_event_timer_node_t      timer;
     tc_event_timer_handler_pt  handler;
 };
 
+/*调度统计*/
+typedef struct {
+    uint64_t            rounds;                          /*loop轮数*/
+    uint64_t            work[TC_EVENT_PRIO_NUM];         /*处理的单位数*/
+    uint64_t            exhausted[TC_EVENT_PRIO_NUM];    /*budget用完的次数*/
+    uint64_t            timers;                          /*执行的定时器数*/
+    uint64_t            timer_exhausted;
+    uint32_t            max_depth[TC_EVENT_PRIO_NUM];    /*统计周期内最大积压字节数*/
+    unsigned            depth_known:TC_EVENT_PRIO_NUM;   /*有来源报告积压的优先级*/
+    uint64_t            spins;                           /*自旋时等到事件的轮数*/
+    uint64_t            sleeps;                          /*自旋后仍然阻塞的轮数*/
+    uint64_t            spin_usec;                       /*自旋花费的微秒数*/
+} tc_event_stat_t;
+
 /*event loop 结构*/
 struct tc_event_loop_s {
     int                 size;                  /*监听的event最大个数*/
@@ -72,8 +112,39 @@ struct tc_event_loop_s {
     tc_pool_t          *pool;                  /*每个event_loop有自己的内存池*/
     tc_event_t         *active_events;         /*被激活的event链表*/
     tc_event_actions_t *actions;               /*event loop 操作, 针对select / epoll 的操作集*/
+    int                 budget[TC_EVENT_PRIO_NUM];
+    int                 timer_budget;
+    unsigned            pending:1;             /*有来源用完了budget, 下一轮不等待*/
+    long                busy_poll;             /*阻塞poll之前自旋的微秒数, 0不自旋*/
+    tc_event_flush_pt   flush;                 /*每轮结束时发出本轮攒下的输出*/
+    tc_event_stat_t     stat;
 };
 
+#define tc_event_budget(ev)  ((ev)->loop->budget[(ev)->prio])
+
+/* handlers report the units they processed in this round */
+static inline void
+tc_event_consumed(tc_event_t *ev, int n)
+{
+    tc_event_loop_t *loop = ev->loop;
+
+    loop->stat.work[ev->prio] += n;
+    if (n >= loop->budget[ev->prio]) {
+        loop->stat.exhausted[ev->prio]++;
+        loop->pending = 1;
+    }
+}
+
+/* and the bytes still queued on their fd if known */
+static inline void
+tc_event_backlog(tc_event_t *ev, int bytes)
+{
+    ev->loop->stat.depth_known |= 1 << ev->prio;
+    if ((uint32_t) bytes > ev->loop->stat.max_depth[ev->prio]) {
+        ev->loop->stat.max_depth[ev->prio] = bytes;
+    }
+}
+
 
 int tc_event_loop_init(tc_event_loop_t *loop, int size);
 int tc_event_loop_finish(tc_event_loop_t *loop);
@@ -84,6 +155,7 @@ int tc_event_del(tc_event_loop_t *loop, tc_event_t *ev, int events);
 tc_event_t *tc_event_create(tc_pool_t *pool, int fd, tc_event_handler_pt reader,
         tc_event_handler_pt writer);
 void tc_event_destroy(tc_event_t *ev, int delayed);
+void tc_event_output_stat(tc_event_loop_t *loop);
 
 extern tc_atomic_t  tc_over;
 
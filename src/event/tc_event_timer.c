@@ -1,8 +1,10 @@
 #include <xcopy.h>
 
 
-tc_rbtree_t                   tc_event_timer_rbtree;
-static tc_rbtree_node_t       tc_event_timer_sentinel;
+#if (TC_RBTREE_TIMER)
+
+tc_thread_local tc_rbtree_t             tc_event_timer_rbtree;
+static tc_thread_local tc_rbtree_node_t tc_event_timer_sentinel;
 
 /*
  * the event timer rbtree may contain the duplicate keys, however,
@@ -41,20 +43,22 @@ tc_event_find_timer(void)
 }
 
 
-void
-tc_event_expire_timers(void)
+/* runs at most budget due timers, returns the number run */
+tc_uint_t
+tc_event_expire_timers(tc_uint_t budget)
 {
+    tc_uint_t          n;
     tc_event_timer_t  *ev;
     tc_rbtree_node_t  *node, *root, *sentinel;
 
     sentinel = tc_event_timer_rbtree.sentinel;
 
-    for ( ;; ) {
+    for (n = 0; n < budget; n++) {
 
         root = tc_event_timer_rbtree.root;
 
         if (root == sentinel) {
-            return;
+            break;
         }
 
         /*
@@ -89,4 +93,199 @@ tc_event_expire_timers(void)
         break;
     }
 
+    return n;
+}
+
+#else
+
+tc_thread_local tc_event_timer_wheel_t  tc_event_timer_wheel;
+
+#define tc_tw_index(now, n)                                                  \
+    (((now) >> (TC_TW_ROOT_BITS + (n) * TC_TW_BITS)) & TC_TW_MASK)
+
+
+tc_int_t
+tc_event_timer_init(void)
+{
+    tc_memzero(&tc_event_timer_wheel, sizeof(tc_event_timer_wheel_t));
+    tc_event_timer_wheel.now = tc_current_time_msec;
+
+    return TC_OK;
+}
+
+
+static void
+tc_event_timer_wheel_add(tc_event_timer_t *ev)
+{
+    tc_uint_t           n;
+    tc_msec_t           key, idx;
+    tc_event_timer_t  **slot;
+
+    key = ev->timer.key;
+    idx = key - tc_event_timer_wheel.now;
+
+    if ((tc_msec_int_t) idx < 0) {
+        /* already due, run it at the next tick */
+        slot = &tc_event_timer_wheel.root[tc_event_timer_wheel.now & 
+            TC_TW_ROOT_MASK];
+
+    } else if (idx < TC_TW_ROOT_SIZE) {
+        slot = &tc_event_timer_wheel.root[key & TC_TW_ROOT_MASK];
+
+    } else {
+        for (n = 0; n < TC_TW_LEVELS - 1; n++) {
+            if (idx < ((tc_msec_t) 1 << (TC_TW_ROOT_BITS + 
+                            (n + 1) * TC_TW_BITS)))
+            {
+                break;
+            }
+        }
+
+        if (n == TC_TW_LEVELS - 1 && 
+                idx >= ((tc_msec_t) 1 << (TC_TW_ROOT_BITS + 
+                        TC_TW_LEVELS * TC_TW_BITS)))
+        {
+            /* beyond the wheel, it is cascaded again when its slot comes */
+            key = tc_event_timer_wheel.now + ((tc_msec_t) 1 << 
+                    (TC_TW_ROOT_BITS + TC_TW_LEVELS * TC_TW_BITS)) - 1;
+        }
+
+        slot = &tc_event_timer_wheel.level[n][tc_tw_index(key, n)];
+    }
+
+    ev->timer.next = *slot;
+    if (*slot) {
+        (*slot)->timer.prev = &ev->timer.next;
+    }
+    ev->timer.prev = slot;
+    *slot = ev;
+}
+
+
+void
+tc_event_timer_link(tc_event_timer_t *ev)
+{
+    tc_event_timer_wheel_add(ev);
+    tc_event_timer_wheel.count++;
+}
+
+
+/* move the timers of a coarse slot down the wheel */
+static tc_uint_t
+tc_event_timer_cascade(tc_uint_t n, tc_uint_t index)
+{
+    tc_event_timer_t  *ev, *next;
+
+    ev = tc_event_timer_wheel.level[n][index];
+    tc_event_timer_wheel.level[n][index] = NULL;
+
+    for ( ;ev; ev = next) {
+        next = ev->timer.next;
+        tc_event_timer_wheel_add(ev);
+    }
+
+    return index;
+}
+
+
+tc_msec_t
+tc_event_find_timer(void)
+{
+    tc_uint_t      i;
+    tc_msec_t      now;
+    tc_msec_int_t  timer;
+
+    if (tc_event_timer_wheel.count == 0) {
+        return TC_TIMER_INFINITE;
+    }
+
+    now = tc_event_timer_wheel.now;
+
+    /* stop at the next cascade, later timers may move into the root */
+    for (i = 0; i < TC_TW_ROOT_SIZE; i++) {
+        if (((now + i) & TC_TW_ROOT_MASK) == 0
+                || tc_event_timer_wheel.root[(now + i) & TC_TW_ROOT_MASK])
+        {
+            break;
+        }
+    }
+
+    timer = (tc_msec_int_t) (now + i - tc_current_time_msec);
+
+    return (tc_msec_t) (timer > 0 ? timer : 0);
 }
+
+
+/*
+ * runs at most budget due timers and returns the number run, the rest of
+ * a slot is moved to the next tick so that it runs first next time
+ */
+tc_uint_t
+tc_event_expire_timers(tc_uint_t budget)
+{
+    tc_uint_t          index, n;
+    tc_event_timer_t  *ev, *work, *next;
+
+    n = 0;
+
+    while ((tc_msec_int_t) (tc_current_time_msec - 
+                tc_event_timer_wheel.now) >= 0)
+    {
+        if (tc_event_timer_wheel.count == 0) {
+            tc_event_timer_wheel.now = tc_current_time_msec + 1;
+            return n;
+        }
+
+        if (n >= budget) {
+            return n;
+        }
+
+        index = tc_event_timer_wheel.now & TC_TW_ROOT_MASK;
+
+        if (index == 0 
+                && !tc_event_timer_cascade(0, tc_tw_index(
+                        tc_event_timer_wheel.now, 0))
+                && !tc_event_timer_cascade(1, tc_tw_index(
+                        tc_event_timer_wheel.now, 1))
+                && !tc_event_timer_cascade(2, tc_tw_index(
+                        tc_event_timer_wheel.now, 2)))
+        {
+            tc_event_timer_cascade(3, 
+                    tc_tw_index(tc_event_timer_wheel.now, 3));
+        }
+
+        /* 
+         * detach the slot so that timers added by handlers go to the next
+         * tick, handlers may still delete timers of this slot
+         */
+        work = tc_event_timer_wheel.root[index];
+        tc_event_timer_wheel.root[index] = NULL;
+        if (work) {
+            work->timer.prev = &work;
+        }
+        tc_event_timer_wheel.now++;
+
+        while ((ev = work) != NULL) {
+            if (n >= budget) {
+                for ( ;ev; ev = next) {
+                    next = ev->timer.next;
+                    tc_event_timer_wheel_add(ev);
+                }
+                return n;
+            }
+
+            tc_event_timer_unlink(ev);
+            ev->timer_set = 0;
+
+#if (TC_DEBUG)
+            tc_log_debug1(LOG_DEBUG, 0, "del timer:%p", ev);
+#endif
+            ev->handler(ev);
+            n++;
+        }
+    }
+
+    return n;
+}
+
+#endif
@@ -12,17 +12,62 @@
 
 tc_int_t tc_event_timer_init(void);
 tc_msec_t tc_event_find_timer(void);
-void tc_event_expire_timers(void);
+tc_uint_t tc_event_expire_timers(tc_uint_t budget);
 
 
-extern tc_rbtree_t  tc_event_timer_rbtree;
+#if (TC_RBTREE_TIMER)
+
+extern tc_thread_local tc_rbtree_t  tc_event_timer_rbtree;
+
+#define tc_event_timer_link(ev)                                              \
+    tc_rbtree_insert(&tc_event_timer_rbtree, &(ev)->timer)
+#define tc_event_timer_unlink(ev)                                            \
+    tc_rbtree_delete(&tc_event_timer_rbtree, &(ev)->timer)
+
+#else
+
+/*
+ * hierarchical timing wheel: 1ms slots for the next 256ms, then four
+ * levels of 64 slots, each 64 times coarser than the previous one;
+ * timers of the coarse levels are cascaded down when their slot comes
+ */
+#define TC_TW_ROOT_BITS   8
+#define TC_TW_BITS        6
+#define TC_TW_ROOT_SIZE   (1 << TC_TW_ROOT_BITS)
+#define TC_TW_SIZE        (1 << TC_TW_BITS)
+#define TC_TW_ROOT_MASK   (TC_TW_ROOT_SIZE - 1)
+#define TC_TW_MASK        (TC_TW_SIZE - 1)
+#define TC_TW_LEVELS      4
+
+typedef struct {
+    tc_msec_t          now;       /* the next tick to run */
+    tc_uint_t          count;
+    tc_event_timer_t  *root[TC_TW_ROOT_SIZE];
+    tc_event_timer_t  *level[TC_TW_LEVELS][TC_TW_SIZE];
+} tc_event_timer_wheel_t;
+
+extern tc_thread_local tc_event_timer_wheel_t  tc_event_timer_wheel;
+
+void tc_event_timer_link(tc_event_timer_t *ev);
+
+static inline void
+tc_event_timer_unlink(tc_event_timer_t *ev)
+{
+    *ev->timer.prev = ev->timer.next;
+    if (ev->timer.next) {
+        ev->timer.next->timer.prev = ev->timer.prev;
+    }
+    tc_event_timer_wheel.count--;
+}
+
+#endif
 
 
 static inline void
 tc_event_del_timer(tc_event_timer_t *ev)
 {
     tc_log_debug2(LOG_DEBUG, 0, "pool:%p, del timer:%p", ev->pool, ev); 
-    tc_rbtree_delete(&tc_event_timer_rbtree, &ev->timer);
+    tc_event_timer_unlink(ev);
     ev->timer_set = 0;
 }
 
@@ -46,7 +91,7 @@ tc_event_update_timer(tc_event_timer_t *ev, tc_msec_t timer)
         ev->timer.key = key;
 
         tc_log_debug2(LOG_DEBUG, 0, "pool:%p, up timer:%p", ev->pool, ev);
-        tc_rbtree_insert(&tc_event_timer_rbtree, &ev->timer);
+        tc_event_timer_link(ev);
 
         ev->timer_set = 1;
     } else {
@@ -62,7 +107,7 @@ tc_event_add_timer(tc_pool_t *pool, tc_msec_t timer, void *data,
     tc_event_timer_t *ev;
 
     /*
-     * 构建event, 并插入rbtree
+     * 构建event, 并加入定时器
     */
     ev = (tc_event_timer_t *) tc_palloc(pool, sizeof(tc_event_timer_t));
     if (ev != NULL) {
@@ -75,7 +120,7 @@ tc_event_add_timer(tc_pool_t *pool, tc_msec_t timer, void *data,
         key = ((tc_msec_t) tc_current_time_msec) + timer;
         ev->timer.key = key;
 
-        tc_rbtree_insert(&tc_event_timer_rbtree, &ev->timer);
+        tc_event_timer_link(ev);
 
         tc_log_debug2(LOG_DEBUG, 0, "pool:%p, add timer:%p", pool, 
                 &ev->timer); 
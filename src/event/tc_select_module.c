@@ -61,6 +61,25 @@ int tc_select_add_event(tc_event_loop_t *loop, tc_event_t *ev, int events)
 
     io = loop->io;
 
+    if (((events & TC_EVENT_READ) && ev->read_handler == NULL)
+            || ((events & TC_EVENT_WRITE) && ev->write_handler == NULL))
+    {
+        return TC_EVENT_ERROR;
+    }
+
+    /*
+     * 已经在数组里的event只增加关注的事件
+    */
+    if (ev->index >= 0) {
+        if (events & TC_EVENT_READ) {
+            FD_SET(ev->fd, &io->r_set);
+        }
+        if (events & TC_EVENT_WRITE) {
+            FD_SET(ev->fd, &io->w_set);
+        }
+        return TC_EVENT_OK;
+    }
+
     /*
      * io event个数超上限
     */
@@ -72,16 +91,12 @@ int tc_select_add_event(tc_event_loop_t *loop, tc_event_t *ev, int events)
     /*
      * fd_set
     */
-    if (events == TC_EVENT_READ && ev->read_handler
-            && ev->write_handler == NULL)
-    {
+    if (events & TC_EVENT_READ) {
         FD_SET(ev->fd, &io->r_set);
-    } else if (events == TC_EVENT_WRITE && ev->write_handler
-            && ev->read_handler == NULL)
-    {
+    }
+
+    if (events & TC_EVENT_WRITE) {
         FD_SET(ev->fd, &io->w_set);
-    } else {
-        return TC_EVENT_ERROR;
     }
 
     /*
@@ -112,12 +127,19 @@ int tc_select_del_event(tc_event_loop_t *loop, tc_event_t *ev, int events)
         return TC_EVENT_ERROR;
     }
 
-    if (events == TC_EVENT_READ) {
+    if (events & TC_EVENT_READ) {
         FD_CLR(ev->fd, &io->r_set);
-    } else if (events == TC_EVENT_WRITE) {
+    }
+
+    if (events & TC_EVENT_WRITE) {
         FD_CLR(ev->fd, &io->w_set);
-    } else {
-        return TC_EVENT_ERROR;
+    }
+
+    /*
+     * 还关注其他事件的event留在数组里
+    */
+    if (ev->reg_evs & ~events) {
+        return TC_EVENT_OK;
     }
 
     /*
@@ -188,19 +210,19 @@ int tc_select_polling(tc_event_loop_t *loop, long to)
         /* clear the active events, and reset */
         evs[i]->events = TC_EVENT_NONE;
 
-        if (evs[i]->read_handler) {
-            if (FD_ISSET(evs[i]->fd, &cur_read_set)) {
-                evs[i]->events |= TC_EVENT_READ;
-                /*
-                 * 事件加入激活事件链表
-                */
-                tc_event_push_active_event(loop->active_events, evs[i]);
-            }
-        } else {
-            if (FD_ISSET(evs[i]->fd, &cur_write_set)) {
-                evs[i]->events |= TC_EVENT_WRITE;
-                tc_event_push_active_event(loop->active_events, evs[i]);
-            }
+        if (FD_ISSET(evs[i]->fd, &cur_read_set)) {
+            evs[i]->events |= TC_EVENT_READ;
+        }
+
+        if (FD_ISSET(evs[i]->fd, &cur_write_set)) {
+            evs[i]->events |= TC_EVENT_WRITE;
+        }
+
+        /*
+         * 事件加入激活事件链表
+        */
+        if (evs[i]->events != TC_EVENT_NONE) {
+            tc_event_push_active_event(loop->active_events, evs[i]);
         }
     }
 
@@ -16,11 +16,16 @@
 #include <tcpcopy.h>
 
 /* global variables for TCPCopy client */
-int                tc_raw_socket_out;
-tc_stat_t          tc_stat;
-hash_table        *sess_table;
-tc_event_loop_t    event_loop;
-xcopy_clt_settings clt_settings;
+tc_thread_local int             tc_raw_socket_out;
+tc_thread_local tc_stat_t       tc_stat;
+tc_thread_local hash_table     *sess_table;
+tc_thread_local tc_event_loop_t event_loop;
+tc_thread_local real_ip_addr_t *real_servers;
+xcopy_clt_settings              clt_settings;
+#if (TC_OFFLINE)
+uint32_t                        tc_loop_live, tc_loop_parked;
+uint64_t                        tc_loop_done;
+#endif
 
 #if (TC_SIGACTION)
 static signal_t signals[] = {
@@ -66,13 +71,43 @@ usage(void)
            "               requests from port '8080' of current online server to the target port\n"
            "               '8080' of target server '192.168.0.2' and modify the client IP to be\n"
            "               one of net 62.135.200.0/24.\n");
+#if (!TC_SINGLE)
+    printf("-G             register the client IP addresses of -c with intercept as ranges\n"
+           "               when connecting instead of sending router info per session.\n"
+           "               It needs an intercept knowing range registration.\n");
+#endif
 #if (TC_OFFLINE)
     printf("-i <file>      set the pcap file used for tcpcopy to <file> (only valid for the\n"
            "               offline version of tcpcopy when it is configured to run at\n"
            "               --offline mode).\n");
-    printf("-a <num>       accelerated times for offline replay\n");
+    printf("               Several files could be mixed in one replay as\n"
+           "               'file[:speed[:weight]],...', e.g. 'login.pcap:4,browse.pcap::3'.\n"
+           "               Their packets are merged as if they all started together,\n"
+           "               each file replayed <speed> times as fast, and every session\n"
+           "               of a file replayed <weight> times on client ports of its own\n"
+           "               (default 1 and 1).\n");
+    printf("-a <num>       accelerated times for offline replay. Fractions are allowed and\n"
+           "               values below 1 slow the replay down.\n");
+    printf("-Q <num>       replay at most <num> packets a second offline\n");
+    printf("-j <num>       closed loop replay: keep <num> sessions in flight and start the\n"
+           "               next captured session as soon as one of them is over, with\n"
+           "               no regard to capture times (-a, -Q and -I are ignored). It\n"
+           "               finds out how fast the target could serve the traffic.\n");
+    printf("-K <num>       replay the pcap file <num> times in a row, 0 for ever. Every\n"
+           "               pass comes later in time than the one before, and the client\n"
+           "               ports of its sessions are rotated, so that they are new\n"
+           "               sessions to the target.\n");
     printf("-I <num>       set the threshold interval for offline replay acceleration\n"
            "               in millisecond.\n");
+    printf("-w <file>      write the packets of -i selected by -x into an indexed replay\n"
+           "               archive <file> and exit. The archive is replayed by giving it\n"
+           "               to -i.\n");
+#if (TC_HAVE_ZLIB)
+    printf("-z             compress the blocks of the archive written by -w\n");
+#endif
+    printf("-T <from[-to]> replay only the sessions of an archive starting in this window,\n"
+           "               in seconds after the first packet of the archive\n");
+    printf("-E <ip[/bits],> replay only the sessions of an archive from these clients\n");
 #endif
 #if (TC_PCAP)
     printf("-i <device,>   The name of the interface to listen on. This is usually a driver\n"
@@ -116,11 +151,59 @@ usage(void)
     printf("-R <num>       set default rtt value\n");
     printf("-U <num>       set user session pool size in kilobytes(default 1).\n"
            "               The maximum value allowed is 63.\n");
+#if (!TC_UDP)
+    printf("-Z <num>       carve session memory and packet buffers from huge page backed\n"
+           "               arenas and pre-fault <num> megabytes of them at startup\n"
+           "               (0: no pre-fault)\n");
+#endif
+#if (TC_THREADS)
+    printf("-W <num>       replay sessions in <num> worker threads sharded by client address.\n"
+           "               Each worker has its own sessions, timers, sending socket,\n"
+           "               intercept connections and arena. The maximum value allowed\n"
+           "               is %d (default 0: replay in the capturing thread).\n", 
+           TC_MAX_WORKERS);
+#if (TC_OFFLINE)
+    printf("               The pcap file is still read and paced by one thread.\n");
+#endif
+#endif
+    printf("-b <num>       busy poll: spin for <num> microseconds before sleeping in poll\n"
+           "               and set SO_BUSY_POLL on the capture and intercept sockets.\n"
+           "               It lowers the replay latency at the cost of a busy cpu\n"
+           "               (default 0: no busy poll).\n");
+    printf("-A <cpu,>      run on the given cpus, e.g. '2,3' or '2-5'. The capturing thread\n"
+           "               is pinned to the first one, replay workers, if any, to the\n"
+           "               others in turn and the -i file reader to the one after them.\n");
+    printf("-N <node>      place session and packet memory on NUMA node <node>. <node>\n"
+           "               could also be a network interface name, in which case the\n"
+           "               node the interface is attached to is used and its interrupts\n"
+           "               are checked to be served on that node.\n");
     printf("-C <num>       parallel connections between tcpcopy and intercept.\n"
            "               The maximum value allowed is 11(default 2 connections).\n");
     printf("-s <server,>   intercept server list\n"
            "               Format:\n"
-           "               ip_addr1:port1, ip_addr2:port2, ...\n");
+           "               ip_addr1:port1, ip_addr2:port2, ...\n"
+           "               ip_addr:port:shm[=path] has a co-located intercept listening\n"
+           "               on the unix socket path write responses into shared memory\n"
+           "               (default path: /tmp/intercept.<port>.sock).\n"
+           "               ip_addr:port@net[/bits] has the intercept get router info of\n"
+           "               the target servers in net only, those of targets no intercept\n"
+           "               is given for go to all of them.\n");
+#if (!TC_OFFLINE)
+    printf("-Y <ip:port>   capture agent: stream the packets selected by -x to the tcpcopy\n"
+           "               listening on ip:port with -y instead of replaying them here.\n"
+           "               -s is not needed then, and -c, -n and the like are given to\n"
+           "               the replaying tcpcopy.\n");
+#if (TC_HAVE_ZLIB)
+    printf("-z             compress the frames streamed by -Y\n");
+#endif
+    printf("-y <[ip:]port> replay the packets of the capture agents connecting to\n"
+           "               [ip:]port instead of capturing packets here\n");
+    printf("-J <num>       delay line: replay the packets <num> seconds after they are\n"
+           "               captured. They are kept in the ring file of -X meanwhile.\n");
+    printf("-X <file[:num]> use <file> of <num> megabytes as the ring of -J\n"
+           "               (default %s:%d). Packets finding it full are dropped.\n",
+           TC_DELAY_FILE, TC_DELAY_SIZE);
+#endif
     printf("-t <num>       set the session timeout limit. If tcpcopy does not receive response\n"
            "               from the target server within the timeout limit, the session would \n"
            "               be dropped by tcpcopy. When the response from the target server is\n"
@@ -155,6 +238,23 @@ read_args(int argc, char **argv)
          "i:" /* input pcap file */
          "a:" /* accelerated times */
          "I:" /* threshold interval time for acceleratation */
+         "Q:" /* max packets per second */
+         "K:" /* passes over the pcap file */
+         "j:" /* sessions in flight for closed loop replay */
+         "w:" /* archive to write */
+#if (TC_HAVE_ZLIB)
+         "z"  /* compress the archive */
+#endif
+         "T:" /* sessions of the archive starting in this window */
+         "E:" /* sessions of the archive from these clients */
+#else
+         "Y:" /* replayer to stream to as an agent */
+         "y:" /* port to take agents on */
+         "J:" /* delay of the delay line */
+         "X:" /* ring file of the delay line */
+#if (TC_HAVE_ZLIB)
+         "z"  /* compress the frames of the agent */
+#endif
 #endif
 #if (TC_PCAP)
          "i:" /* <device,> */
@@ -173,6 +273,15 @@ read_args(int argc, char **argv)
          "M:" /* MTU sent to backend */
          "S:" 
          "U:" 
+#if (!TC_UDP)
+         "Z:" /* huge page arenas and pre-fault size */
+#endif
+#if (TC_THREADS)
+         "W:" /* replay workers */
+#endif
+         "b:" /* busy poll time */
+         "A:" /* cpus to run on */
+         "N:" /* numa node */
          "R:" 
          "D:" /* mss value sent to backend */
          "t:" /* set the session timeout limit */
@@ -181,6 +290,9 @@ read_args(int argc, char **argv)
          "l:" /* error log file */
          "P:" /* save PID in file */
          "L"  /* lonely */
+#if (!TC_SINGLE)
+         "G"  /* register client ranges */
+#endif
          "O"  
          "g"  
          "h"  /* help, licence info */
@@ -202,11 +314,56 @@ read_args(int argc, char **argv)
                 clt_settings.pcap_file = optarg;
                 break;
             case 'a':
-                clt_settings.accelerated_times = atoi(optarg);
+                clt_settings.accelerated_times = atof(optarg);
                 break;
             case 'I':
                 clt_settings.interval = atoi(optarg);
                 break;
+            case 'Q':
+                clt_settings.max_pps = strtoull(optarg, NULL, 10);
+                break;
+            case 'j':
+                clt_settings.loop_sess = atoi(optarg);
+                break;
+            case 'K':
+                clt_settings.loops = atoi(optarg);
+                if (clt_settings.loops <= 0) {
+                    clt_settings.loops = -1;
+                }
+                break;
+            case 'w':
+                clt_settings.archive_file = optarg;
+                break;
+#if (TC_HAVE_ZLIB)
+            case 'z':
+                clt_settings.archive_zlib = 1;
+                break;
+#endif
+            case 'T':
+                clt_settings.raw_replay_window = optarg;
+                break;
+            case 'E':
+                clt_settings.raw_replay_clts = optarg;
+                break;
+#else
+            case 'Y':
+                clt_settings.raw_agent = optarg;
+                break;
+            case 'y':
+                clt_settings.raw_agent_listen = optarg;
+                break;
+            case 'J':
+                clt_settings.delay = (uint64_t) (tc_max(atof(optarg), 0) 
+                        * 1000000);
+                break;
+            case 'X':
+                clt_settings.raw_delay_file = optarg;
+                break;
+#if (TC_HAVE_ZLIB)
+            case 'z':
+                clt_settings.agent_zlib = 1;
+                break;
+#endif
 #endif
 #if (TC_PCAP_SND)
             case 'o':
@@ -243,6 +400,26 @@ read_args(int argc, char **argv)
             case 'U':
                 clt_settings.s_pool_size = 1024 * atoi(optarg);
                 break;
+#if (!TC_UDP)
+            case 'Z':
+                clt_settings.use_arena = 1;
+                clt_settings.arena_prefault = atoi(optarg);
+                break;
+#endif
+#if (TC_THREADS)
+            case 'W':
+                clt_settings.workers = atoi(optarg);
+                break;
+#endif
+            case 'b':
+                clt_settings.busy_poll = atoi(optarg);
+                break;
+            case 'A':
+                clt_settings.cpu_list = optarg;
+                break;
+            case 'N':
+                clt_settings.numa_node = optarg;
+                break;
             case 'l':
                 clt_settings.log_path = optarg;
                 break;
@@ -279,6 +456,11 @@ read_args(int argc, char **argv)
             case 'L':
                 clt_settings.lonely = 1;
                 break;
+#if (!TC_SINGLE)
+            case 'G':
+                clt_settings.range_reg = 1;
+                break;
+#endif
             case 'O':
                 clt_settings.only_replay_full = 1;
                 break;
@@ -303,6 +485,9 @@ read_args(int argc, char **argv)
                         break;
 #if (TC_OFFLINE)
                     case 'i':
+                    case 'w':
+#else
+                    case 'X':
 #endif
                     case 'l':
                     case 'P':
@@ -320,17 +505,46 @@ read_args(int argc, char **argv)
                         fprintf(stderr, "tcpcopy: option -%c require a device name\n",
                                 optopt);
                         break;
+#endif
+#if (TC_OFFLINE)
+                    case 'E':
 #endif
                     case 's':
                         fprintf(stderr, "tcpcopy: option -%c require an ip address list\n",
                                 optopt);
                         break;
+#if (!TC_OFFLINE)
+                    case 'Y':
+                    case 'y':
+                        fprintf(stderr, "tcpcopy: option -%c require an address\n",
+                                optopt);
+                        break;
+#endif
+#if (TC_OFFLINE)
+                    case 'T':
+                        fprintf(stderr, "tcpcopy: option -%c require a time window\n",
+                                optopt);
+                        break;
+#endif
+                    case 'A':
+                        fprintf(stderr, "tcpcopy: option -%c require a cpu list\n",
+                                optopt);
+                        break;
+                    case 'N':
+                        fprintf(stderr, "tcpcopy: option -%c require a node or a device name\n",
+                                optopt);
+                        break;
                     case 'n':
                     case 'f':
                     case 'C':
 #if (TC_OFFLINE)
                     case 'a':
                     case 'I':
+                    case 'Q':
+                    case 'K':
+                    case 'j':
+#else
+                    case 'J':
 #endif
 #if (TC_PCAP)
                     case 'B':
@@ -340,6 +554,13 @@ read_args(int argc, char **argv)
                     case 'M':
                     case 'D':
                     case 'U':
+#if (!TC_UDP)
+                    case 'Z':
+#endif
+#if (TC_THREADS)
+                    case 'W':
+#endif
+                    case 'b':
                     case 't':
                     case 'k':
                     case 'p':
@@ -619,10 +840,12 @@ retr_target_addrs(char *raw_tf, transfer_maps_t *tf)
 
 static int retrieve_real_servers() 
 {
-    int          count = 0;
-    char        *split, *p, *seq, *port_s;
+    int          count = 0, bits;
+    char        *split, *p, *seq, *port_s, *shm, *at, *slash;
+    size_t       len;
     uint16_t     port;
-    uint32_t     ip;
+    uint32_t     ip, net;
+    conns_t     *conns;
 
     p = clt_settings.raw_rs_list;
 
@@ -632,6 +855,11 @@ static int retrieve_real_servers()
             *split = '\0';
         }
 
+        at = strchr(p, '@');
+        if (at != NULL) {
+            *at = '\0';
+        }
+
         if ((seq = strchr(p, ':')) == NULL) {
             tc_log_info(LOG_NOTICE, 0, "set only ip for tcpcopy");
             port  = 0;
@@ -644,13 +872,58 @@ static int retrieve_real_servers()
             *seq = ':';
         }
 
+        conns = &clt_settings.real_servers.conns[count++];
+        conns->ip   = ip;
+        conns->port = port;
+
+        /* ip:port:shm[=path] */
+        shm = (seq != NULL) ? strchr(seq + 1, ':') : NULL;
+        if (shm != NULL) {
+            shm++;
+            len = strlen(shm);
+            if (len > 4 && strncmp(shm, "shm=", 4) == 0 
+                    && len - 4 < TC_SHM_PATH_LEN) 
+            {
+                memcpy(conns->shm_path, shm + 4, len - 4);
+                conns->shm_path[len - 4] = '\0';
+
+            } else if (len == 3 && strncmp(shm, "shm", 3) == 0) {
+                snprintf(conns->shm_path, TC_SHM_PATH_LEN, TC_SHM_PATH,
+                        port ? port : clt_settings.srv_port);
+
+            } else {
+                tc_log_info(LOG_WARN, 0, "unknown option in -s:%s", shm);
+            }
+        }
+
+        /* ip:port@net[/bits], the intercept in front of the targets in net */
+        if (at != NULL) {
+            *at = '@';
+            bits = 32;
+            slash = strchr(at + 1, '/');
+            if (slash != NULL) {
+                *slash = '\0';
+                bits = atoi(slash + 1);
+            }
+            net = inet_addr(at + 1);
+            if (slash != NULL) {
+                *slash = '/';
+            }
+
+            if (net == INADDR_NONE || bits < 1 || bits > 32) {
+                tc_log_info(LOG_WARN, 0, "invalid target net in -s:%s", at);
+            } else {
+                conns->mask = htonl(0xffffffff << (32 - bits));
+                conns->net  = net & conns->mask;
+                tc_log_info(LOG_NOTICE, 0, "intercept %d is for targets in %s",
+                        count - 1, at + 1);
+            }
+        }
+
         if (split != NULL) {
             *split = ',';
         }
 
-        clt_settings.real_servers.conns[count].ip = ip;
-        clt_settings.real_servers.conns[count++].port = port;
-
         if (count == MAX_REAL_SERVERS) {
             tc_log_info(LOG_WARN, 0, "reach the limit for real servers");
             break;
@@ -730,6 +1003,208 @@ check_client_ip_valid(uint32_t ip)
 }
 
 
+static int
+cmp_ip(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+/* merges the client ips of -c into ranges of consecutive addresses */
+static void
+build_clt_ranges()
+{
+    int          i, n;
+    uint32_t     ips[M_IP_NUM];
+    clt_range_t *r;
+
+    for (i = 0; i < clt_settings.clt_tf_ip_num; i++) {
+        ips[i] = ntohl(clt_settings.clt_tf_ip[i]);
+    }
+    qsort(ips, clt_settings.clt_tf_ip_num, sizeof(uint32_t), cmp_ip);
+
+    n = 0;
+    r = clt_settings.clt_ranges;
+    for (i = 0; i < clt_settings.clt_tf_ip_num; i++) {
+        if (n > 0 && ips[i] <= r[n - 1].last + 1) {
+            r[n - 1].last = tc_max(r[n - 1].last, ips[i]);
+            continue;
+        }
+
+        if (n == MAX_CLT_RANGES) {
+            tc_log_info(LOG_WARN, 0, "-c ips make over %d ranges, -G is off",
+                    MAX_CLT_RANGES);
+            clt_settings.range_reg = 0;
+            return;
+        }
+
+        r[n].first = ips[i];
+        r[n].last  = ips[i];
+        n++;
+    }
+
+    clt_settings.clt_range_num = n;
+    tc_log_info(LOG_NOTICE, 0, "client ips registered in %d ranges", n);
+}
+
+
+#if (TC_OFFLINE)
+/* from[-to] in seconds after the first packet of the archive */
+static int
+retrieve_replay_window()
+{
+    char    *p, *end;
+    double   from, to;
+
+    p = clt_settings.raw_replay_window;
+
+    from = strtod(p, &end);
+    to   = 0;
+    if (end != p && *end == '-') {
+        p  = end + 1;
+        to = strtod(p, &end);
+        if (end == p || to <= from) {
+            end = p;
+        }
+    }
+
+    if (end == p || *end != '\0' || from < 0) {
+        tc_log_info(LOG_ERR, 0, "invalid -T:%s", clt_settings.raw_replay_window);
+        fprintf(stderr, "invalid -T:%s\n", clt_settings.raw_replay_window);
+        return -1;
+    }
+
+    clt_settings.replay_from = (uint64_t) (from * 1000000);
+    clt_settings.replay_to   = (uint64_t) (to * 1000000);
+
+    return 0;
+}
+
+
+/* file[:speed[:weight]],... into the files to mix */
+static int
+retrieve_pcap_files()
+{
+    int              slot;
+    char            *split, *colon, *p;
+    tc_pcap_file_t  *f;
+
+    p = clt_settings.pcap_file;
+    slot = 0;
+
+    while (true) {
+        split = strchr(p, ',');
+        if (split != NULL) {
+            *split = '\0';
+        }
+
+        if (clt_settings.pcap_file_num == MAX_PCAP_FILES) {
+            tc_log_info(LOG_WARN, 0, "reach the limit for -i files");
+            break;
+        }
+
+        f = &clt_settings.pcap_files[clt_settings.pcap_file_num++];
+        f->file   = p;
+        f->speed  = 1;
+        f->weight = 1;
+
+        colon = strchr(p, ':');
+        if (colon != NULL) {
+            *colon = '\0';
+            if (colon[1] != ':' && colon[1] != '\0') {
+                f->speed = atof(colon + 1);
+            }
+
+            colon = strchr(colon + 1, ':');
+            if (colon != NULL) {
+                f->weight = atoi(colon + 1);
+            }
+        }
+
+        if (f->file[0] == '\0' || f->speed <= 0 || f->weight < 1) {
+            tc_log_info(LOG_ERR, 0, "invalid file in -i:%s", p);
+            fprintf(stderr, "invalid file in -i:%s\n", p);
+            return -1;
+        }
+
+        f->slot = slot;
+        slot += f->weight;
+
+        tc_log_info(LOG_NOTICE, 0, "pcap file:%s, speed:%.3f, weight:%d",
+                f->file, f->speed, f->weight);
+
+        if (split == NULL) {
+            break;
+        }
+
+        p = split + 1;
+    }
+
+    clt_settings.pcap_slots = slot;
+
+    return 0;
+}
+
+
+/* ip[/bits],... into ranges of client ips */
+static int
+retrieve_replay_clts()
+{
+    int          bits;
+    char        *split, *slash, *p;
+    uint32_t     ip, mask;
+    clt_range_t *r;
+
+    p = clt_settings.raw_replay_clts;
+
+    while (true) {
+        split = strchr(p, ',');
+        if (split != NULL) {
+            *split = '\0';
+        }
+
+        bits  = 32;
+        slash = strchr(p, '/');
+        if (slash != NULL) {
+            *slash = '\0';
+            bits = atoi(slash + 1);
+        }
+        ip = inet_addr(p);
+        if (slash != NULL) {
+            *slash = '/';
+        }
+
+        if (ip == INADDR_NONE || bits < 1 || bits > 32) {
+            tc_log_info(LOG_ERR, 0, "invalid client in -E:%s", p);
+            fprintf(stderr, "invalid client in -E:%s\n", p);
+            return -1;
+        }
+
+        if (clt_settings.replay_clt_num == MAX_REPLAY_CLTS) {
+            tc_log_info(LOG_WARN, 0, "reach the limit for -E clients");
+            break;
+        }
+
+        mask = 0xffffffff << (32 - bits);
+        r = &clt_settings.replay_clts[clt_settings.replay_clt_num++];
+        r->first = ntohl(ip) & mask;
+        r->last  = r->first | ~mask;
+
+        if (split == NULL) {
+            break;
+        }
+
+        *split = ',';
+        p = split + 1;
+    }
+
+    return 0;
+}
+#endif
+
+
 static int 
 retrieve_clt_tf_ips() 
 {
@@ -807,6 +1282,91 @@ retrieve_clt_tf_ips()
 }
 
 
+#if (!TC_OFFLINE)
+/* -Y ip:port of the replayer and -y [ip:]port agents connect to */
+static int
+retrieve_agent_addrs()
+{
+    uint16_t  port;
+
+    if (clt_settings.raw_agent != NULL) {
+        if (clt_settings.raw_agent_listen != NULL) {
+            tc_log_info(LOG_ERR, 0, "-Y and -y are not for the same tcpcopy");
+            fprintf(stderr, "-Y and -y are not for the same tcpcopy\n");
+            return -1;
+        }
+
+        parse_ip_port_pair(clt_settings.raw_agent, &clt_settings.agent_ip,
+                &port, NULL, NULL);
+        clt_settings.agent_port = ntohs(port);
+        if (clt_settings.agent_ip == 0 || clt_settings.agent_ip == INADDR_NONE
+                || clt_settings.agent_port == 0)
+        {
+            tc_log_info(LOG_ERR, 0, "invalid -Y:%s", clt_settings.raw_agent);
+            fprintf(stderr, "invalid -Y:%s\n", clt_settings.raw_agent);
+            return -1;
+        }
+
+        tc_log_info(LOG_NOTICE, 0, "agent for the replayer:%s%s",
+                clt_settings.raw_agent, 
+                clt_settings.agent_zlib ? ", compressed" : "");
+    }
+
+    if (clt_settings.raw_agent_listen != NULL) {
+        parse_ip_port_pair(clt_settings.raw_agent_listen, 
+                &clt_settings.agent_listen_ip, &port, NULL, NULL);
+        clt_settings.agent_listen_port = ntohs(port);
+        if (clt_settings.agent_listen_ip == INADDR_NONE 
+                || clt_settings.agent_listen_port == 0)
+        {
+            tc_log_info(LOG_ERR, 0, "invalid -y:%s", 
+                    clt_settings.raw_agent_listen);
+            fprintf(stderr, "invalid -y:%s\n", clt_settings.raw_agent_listen);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* file[:megabytes] of the delay line */
+static int
+retrieve_delay_file()
+{
+    long   size;
+    char  *p, *end;
+
+    clt_settings.delay_file = TC_DELAY_FILE;
+    size = TC_DELAY_SIZE;
+
+    if (clt_settings.raw_delay_file != NULL) {
+        clt_settings.delay_file = clt_settings.raw_delay_file;
+        p = strrchr(clt_settings.raw_delay_file, ':');
+        if (p != NULL) {
+            size = strtol(p + 1, &end, 10);
+            if (end == p + 1 || *end != '\0' || size <= 0) {
+                tc_log_info(LOG_ERR, 0, "invalid -X:%s", 
+                        clt_settings.raw_delay_file);
+                fprintf(stderr, "invalid -X:%s\n", clt_settings.raw_delay_file);
+                return -1;
+            }
+            *p = '\0';
+        }
+    }
+
+    if (size < TC_DELAY_MIN_SIZE) {
+        tc_log_info(LOG_WARN, 0, "delay line of %ld MB is too small, use %d",
+                size, TC_DELAY_MIN_SIZE);
+        size = TC_DELAY_MIN_SIZE;
+    }
+    clt_settings.delay_size = (uint64_t) size * 1024 * 1024;
+
+    return 0;
+}
+#endif
+
+
 static int
 read_conf_file()
 {
@@ -881,14 +1441,54 @@ set_details()
     if (clt_settings.s_pool_size == 0) {
         clt_settings.s_pool_size = TC_DEFAULT_UPOOL_SIZE;
     }
+    tc_log_info(LOG_NOTICE, 0, "sess size:%d, hot part:%d", 
+            (int) sizeof(tc_sess_t), (int) TC_SESS_HOT_SIZE);
     tc_log_info(LOG_NOTICE, 0, "min sess pool size:%d", TC_MIN_SESS_POOL_SIZE);
     tc_log_info(LOG_NOTICE, 0, "sess pool size:%d", clt_settings.s_pool_size);
 
     if (clt_settings.s_pool_size < TC_MIN_SESS_POOL_SIZE) {
         tc_log_info(LOG_NOTICE, 0, "sess pool size is too small");
     }
+
+    if (clt_settings.use_arena) {
+        tc_log_info(LOG_NOTICE, 0, "huge page arena, pre-fault:%dM", 
+                clt_settings.arena_prefault);
+    }
+#endif
+
+#if (TC_THREADS)
+    if (clt_settings.workers < 0 || clt_settings.workers > TC_MAX_WORKERS) {
+        tc_log_info(LOG_ERR, 0, "invalid worker number:%d", 
+                clt_settings.workers);
+        return -1;
+    }
+
+    if (clt_settings.workers) {
+        tc_log_info(LOG_NOTICE, 0, "replay workers:%d", clt_settings.workers);
+    }
 #endif
 
+    if (clt_settings.busy_poll < 0) {
+        tc_log_info(LOG_ERR, 0, "invalid busy poll time:%d", 
+                clt_settings.busy_poll);
+        return -1;
+    }
+
+    if (clt_settings.busy_poll) {
+        tc_log_info(LOG_NOTICE, 0, "busy poll:%dus", clt_settings.busy_poll);
+    }
+
+    if (clt_settings.cpu_list != NULL) {
+        clt_settings.cpu_num = tc_cpu_list_parse(clt_settings.cpu_list,
+                clt_settings.cpus, TC_MAX_CPU_LIST);
+        if (clt_settings.cpu_num <= 0) {
+            tc_log_info(LOG_ERR, 0, "invalid cpu list:%s", 
+                    clt_settings.cpu_list);
+            return -1;
+        }
+        tc_log_info(LOG_NOTICE, 0, "cpus:%s", clt_settings.cpu_list);
+    }
+
     if (clt_settings.replica_num > 1) {
         tc_log_info(LOG_NOTICE, 0, "repl num:%d", clt_settings.replica_num);
     }
@@ -902,6 +1502,40 @@ set_details()
         return -1;
     }
 
+#if (!TC_OFFLINE)
+    if (retrieve_agent_addrs() == -1) {
+        return -1;
+    }
+
+    if (clt_settings.agent_port) {
+        /* the replayer does these, doing them here too would do them twice */
+        if (clt_settings.raw_clt_tf_ip != NULL) {
+            tc_log_info(LOG_WARN, 0, "-c is for the replayer, not the agent");
+            clt_settings.raw_clt_tf_ip = NULL;
+        }
+        clt_settings.range_reg = 0;
+        clt_settings.replica_num = 1;
+#if (TC_THREADS)
+        clt_settings.workers = 0;
+#endif
+    }
+
+    if (clt_settings.delay) {
+        if (clt_settings.agent_port) {
+            tc_log_info(LOG_ERR, 0, "-J is for the replayer, not the agent");
+            fprintf(stderr, "-J is for the replayer, not the agent\n");
+            return -1;
+        }
+
+        if (retrieve_delay_file() == -1) {
+            return -1;
+        }
+
+    } else if (clt_settings.raw_delay_file != NULL) {
+        tc_log_info(LOG_WARN, 0, "-X works only with -J");
+    }
+#endif
+
     if (clt_settings.raw_clt_tf_ip != NULL) {
         /* print out raw_clt_tf_ip */
         tc_log_info(LOG_NOTICE, 0, "raw_clt_tf_ip:%s", 
@@ -909,6 +1543,15 @@ set_details()
         retrieve_clt_tf_ips();
     }
 
+    if (clt_settings.range_reg) {
+        if (clt_settings.clt_tf_ip_num == 0) {
+            tc_log_info(LOG_WARN, 0, "-G works only with -c");
+            clt_settings.range_reg = 0;
+        } else {
+            build_clt_ranges();
+        }
+    }
+
     if (clt_settings.percentage > 99) {
         clt_settings.percentage = 0;
     }
@@ -951,22 +1594,68 @@ set_details()
         return -1;
     }
 
-    if (clt_settings.accelerated_times < 1) {
+    if (retrieve_pcap_files() == -1) {
+        return -1;
+    }
+
+    if (clt_settings.accelerated_times <= 0) {
         clt_settings.accelerated_times = 1;
     }
 
-    tc_log_info(LOG_NOTICE, 0, "accelerated %d times,interval:%llu ms",
+    tc_log_info(LOG_NOTICE, 0, "accelerated %.3f times,interval:%llu ms",
             clt_settings.accelerated_times, clt_settings.interval);
 
+    if (clt_settings.max_pps > 0) {
+        tc_log_info(LOG_NOTICE, 0, "at most %llu packets a second",
+                clt_settings.max_pps);
+    }
+
     if (clt_settings.interval > 0) {
         clt_settings.interval = clt_settings.interval * 1000;
     }
+
+    if (clt_settings.loop_sess > 0) {
+        tc_log_info(LOG_NOTICE, 0, "closed loop, sessions in flight:%u",
+                clt_settings.loop_sess);
+        /* capture times mean nothing to sessions started at will */
+        if (clt_settings.default_rtt == 0) {
+            clt_settings.default_rtt = 1;
+        }
+    }
+
+    if (clt_settings.loops != 0) {
+        if (clt_settings.archive_file != NULL) {
+            tc_log_info(LOG_WARN, 0, "-K is ignored when writing an archive");
+            clt_settings.loops = 0;
+        } else if (clt_settings.loops == -1) {
+            tc_log_info(LOG_NOTICE, 0, "replay the pcap file for ever");
+        } else {
+            tc_log_info(LOG_NOTICE, 0, "replay the pcap file %d times",
+                    clt_settings.loops);
+        }
+    }
+
+    if (clt_settings.raw_replay_window != NULL 
+            && retrieve_replay_window() == -1) 
+    {
+        return -1;
+    }
+
+    if (clt_settings.raw_replay_clts != NULL 
+            && retrieve_replay_clts() == -1) 
+    {
+        return -1;
+    }
 #endif
 
 #if (TC_PCAP_SND)
     if (clt_settings.output_if_name != NULL) {
         tc_log_info(LOG_NOTICE, 0, "output device:%s", 
                 clt_settings.output_if_name);
+#if (!TC_OFFLINE)
+    } else if (clt_settings.agent_port) {
+        /* an agent sends nothing itself */
+#endif
     } else {
         tc_log_info(LOG_ERR, 0, "no -o argument");
         fprintf(stderr, "no -o argument\n");
@@ -1007,6 +1696,13 @@ set_details()
         tc_log_info(LOG_NOTICE, 0, "s parameter:%s", 
                 clt_settings.raw_rs_list);
         retrieve_real_servers();
+#if (TC_OFFLINE)
+    } else if (clt_settings.archive_file != NULL) {
+        /* nothing is replayed while an archive is written */
+#else
+    } else if (clt_settings.agent_port) {
+        /* the replayer has the intercepts */
+#endif
     } else {
         tc_log_info(LOG_WARN, 0, "no -s parameter(intercept addresses)");
         fprintf(stderr, "tcpcopy needs -s paramter(intercept addresses)\n");
@@ -1040,6 +1736,80 @@ set_details()
     return 0;
 }
 
+/* pin the capturing thread and place memory before anything is allocated */
+static int
+set_affinity()
+{
+    int   node, cpu_node;
+    char *dev;
+#if (TC_PCAP)
+    int   i;
+#endif
+
+    dev  = NULL;
+    node = -1;
+
+    if (clt_settings.numa_node != NULL) {
+        if (clt_settings.numa_node[0] >= '0' 
+                && clt_settings.numa_node[0] <= '9') 
+        {
+            node = atoi(clt_settings.numa_node);
+        } else {
+            dev  = clt_settings.numa_node;
+            node = tc_dev_node(dev);
+            if (node < 0) {
+                tc_log_info(LOG_WARN, 0, "numa node of %s is unknown", dev);
+            }
+        }
+
+        if (node >= 0) {
+            if (tc_mem_bind_node(node) != TC_OK) {
+                return -1;
+            }
+            tc_log_info(LOG_NOTICE, 0, "memory on node:%d", node);
+        }
+    }
+
+    if (clt_settings.cpu_num) {
+        if (tc_cpu_bind(clt_settings.cpus[0]) != TC_OK) {
+            return -1;
+        }
+
+        cpu_node = tc_cpu_node(clt_settings.cpus[0]);
+        tc_log_info(LOG_NOTICE, 0, "capture on cpu:%d, node:%d", 
+                clt_settings.cpus[0], cpu_node);
+
+        if (node >= 0 && cpu_node >= 0 && cpu_node != node) {
+            tc_log_info(LOG_WARN, 0, "capture cpu %d is off memory node %d",
+                    clt_settings.cpus[0], node);
+        }
+
+        /* interrupts should be served where packets are captured */
+        if (cpu_node >= 0) {
+            node = cpu_node;
+        }
+    }
+
+    if (node < 0) {
+        return 0;
+    }
+
+    if (dev != NULL) {
+        tc_irq_check_node(dev, node);
+    }
+
+#if (TC_PCAP)
+    for (i = 0; i < clt_settings.devices.device_num; i++) {
+        if (dev == NULL || strcmp(dev, clt_settings.devices.device[i].name)) {
+            tc_irq_check_node(clt_settings.devices.device[i].name, node);
+        }
+    }
+#endif
+
+    return 0;
+}
+
+
 /* set default values for TCPCopy client */
 static void
 settings_init()
@@ -1121,6 +1891,22 @@ main(int argc, char **argv)
         return -1;
     }
 
+    if (set_affinity() == -1) {
+        return -1;
+    }
+
+#if (TC_OFFLINE)
+    if (clt_settings.archive_file != NULL) {
+        if (clt_settings.pcap_file_num > 1) {
+            fprintf(stderr, "-w archives one -i file at a time\n");
+            return -1;
+        }
+        ret = tc_archive_build(clt_settings.pcap_files[0].file, 
+                clt_settings.archive_file, clt_settings.archive_zlib);
+        return ret == TC_OK ? 0 : -1;
+    }
+#endif
+
 #if (TC_DIGEST)
     tc_init_digests(); 
     if (!tc_init_sha1()) {
@@ -1140,7 +1926,9 @@ main(int argc, char **argv)
     if (ret == TC_EVENT_ERROR) {
         tc_log_info(LOG_ERR, 0, "event loop init failed");
         is_continue = 0;
-    } 
+    } else {
+        event_loop.busy_poll = clt_settings.busy_poll;
+    }
 
     /*
      * 初始化tcpcopy, 注册loop关注的事件
@@ -0,0 +1,817 @@
+
+#include <xcopy.h>
+#include <tcpcopy.h>
+
+#define TC_AGENT_HDR_SIZE  sizeof(tc_agent_frame_t)
+#define TC_AGENT_REC_SIZE  sizeof(tc_agent_rec_t)
+#define TC_AGENT_BUF_SIZE  (TC_AGENT_HDR_SIZE + TC_AGENT_FRAME_SIZE)
+
+/* the agent, streaming to the replayer */
+typedef struct {
+    int          fd;
+    tc_event_t  *ev;
+    unsigned     connecting:1;
+    unsigned     blocked:1;                 /* waiting for writable */
+    unsigned     zlib:1;
+    uint32_t     used;                      /* bytes of records framed */
+    uint32_t     packets;                   /* records framed */
+    uint32_t     out_head;                  /* bytes queued */
+    uint32_t     out_tail;                  /* bytes written */
+    u_char      *frame;                     /* header and records */
+    u_char      *out;
+#if (TC_HAVE_ZLIB)
+    u_char      *zbuf;
+    uLongf       zsize;
+#endif
+    uint64_t     fwd_cnt;
+    uint64_t     drop_cnt;
+    uint64_t     frame_cnt;
+    uint64_t     raw_bytes;
+    uint64_t     sent_bytes;
+    uint64_t     lost_bytes;                /* queued when it went down */
+} tc_agent_t;
+
+/* a connection of an agent to the replayer, indexed by fd */
+typedef struct {
+    u_char      *pos;                       /* the next frame */
+    u_char      *last;                      /* end of the bytes read */
+    tc_event_t  *ev;
+    uint64_t     frame_cnt;
+    uint64_t     pack_cnt;
+    u_char       start[TC_AGENT_BUF_SIZE];
+} tc_agent_conn_t;
+
+static tc_agent_t            agent;
+static tc_agent_conn_t      *agent_conns[MAX_FD_NUM];
+static tc_agent_handler_pt   agent_handler;
+static int                   agent_listen_fd = -1;
+#if (TC_HAVE_ZLIB)
+static u_char               *agent_zbuf;
+#endif
+
+static int  tc_agent_connect(tc_event_loop_t *event_loop);
+static void tc_agent_close(void);
+static int  tc_agent_write(void);
+static void tc_agent_close_frame(void);
+static void tc_agent_flush(tc_event_loop_t *loop);
+static int  tc_agent_proc_read(tc_event_t *rev);
+static int  tc_agent_proc_writable(tc_event_t *wev);
+static void tc_agent_retry(tc_event_timer_t *evt);
+static void tc_agent_disp(tc_event_timer_t *evt);
+static int  tc_agent_accept(tc_event_t *rev);
+static int  tc_agent_proc_frames(tc_event_t *rev);
+static int  tc_agent_parse_frames(tc_agent_conn_t *c);
+static void tc_agent_close_conn(tc_event_t *rev);
+
+
+int
+tc_agent_init(tc_event_loop_t *event_loop)
+{
+    agent.fd    = -1;
+    agent.zlib  = clt_settings.agent_zlib;
+    agent.frame = tc_alloc(TC_AGENT_BUF_SIZE);
+    agent.out   = tc_alloc(TC_AGENT_OUT_SIZE);
+    if (agent.frame == NULL || agent.out == NULL) {
+        return TC_ERR;
+    }
+
+#if (TC_HAVE_ZLIB)
+    if (agent.zlib) {
+        agent.zsize = compressBound(TC_AGENT_FRAME_SIZE);
+        agent.zbuf  = tc_alloc(agent.zsize);
+        if (agent.zbuf == NULL) {
+            return TC_ERR;
+        }
+    }
+#endif
+
+    event_loop->flush = tc_agent_flush;
+
+    tc_event_add_timer(event_loop->pool, RETRY_MIN_INTERVAL, event_loop,
+            tc_agent_retry);
+    tc_event_add_timer(event_loop->pool, OUTPUT_INTERVAL, NULL, tc_agent_disp);
+
+    /* the replayer may come up later, so it is only tried here */
+    tc_agent_connect(event_loop);
+
+    return TC_OK;
+}
+
+
+static int
+tc_agent_connect(tc_event_loop_t *event_loop)
+{
+    int  fd, ret, events;
+
+    if ((fd = tc_socket_init()) == TC_INVALID_SOCK) {
+        return TC_ERR;
+    }
+
+    if (fd > MAX_FD_VALUE) {
+        tc_log_info(LOG_ERR, 0, "fd:%d is too large for the agent", fd);
+        tc_socket_close(fd);
+        return TC_ERR;
+    }
+
+    if (tc_socket_set_nodelay(fd) == TC_ERR
+            || tc_socket_set_nonblocking(fd) == TC_ERR)
+    {
+        tc_socket_close(fd);
+        return TC_ERR;
+    }
+
+    tc_socket_set_keepalive(fd);
+
+    ret = tc_socket_connect(fd, clt_settings.agent_ip,
+            clt_settings.agent_port);
+    if (ret == TC_ERR) {
+        return TC_ERR;
+    }
+
+    agent.ev = tc_event_create(event_loop->pool, fd, tc_agent_proc_read,
+            tc_agent_proc_writable);
+    if (agent.ev == NULL) {
+        tc_socket_close(fd);
+        return TC_ERR;
+    }
+
+    agent.fd = fd;
+    agent.out_head = 0;
+    agent.out_tail = 0;
+    agent.blocked  = 0;
+    agent.connecting = 0;
+    clt_settings.ev[fd] = agent.ev;
+
+    events = TC_EVENT_READ;
+    if (ret == TC_AGAIN) {
+        /* frames are queued until it is connected */
+        agent.connecting = 1;
+        agent.blocked = 1;
+        events |= TC_EVENT_WRITE;
+    }
+
+    if (tc_event_add(event_loop, agent.ev, events) == TC_EVENT_ERROR) {
+        tc_log_info(LOG_ERR, 0, "add socket(%d) to event loop failed.", fd);
+        tc_agent_close();
+        return TC_ERR;
+    }
+
+    return TC_OK;
+}
+
+
+/* what was queued is lost with the connection, it is tried again later */
+static void
+tc_agent_close(void)
+{
+    tc_log_info(LOG_WARN, 0, "connection to the replayer is down, fd:%d",
+            agent.fd);
+
+    agent.lost_bytes += agent.out_head - agent.out_tail;
+
+    /* it may be waiting in the active list, so it goes away later */
+    tc_event_del(agent.ev->loop, agent.ev, agent.ev->reg_evs);
+    tc_event_destroy(agent.ev, 1);
+    clt_settings.ev[agent.fd] = NULL;
+    tc_socket_close(agent.fd);
+
+    agent.fd = -1;
+    agent.ev = NULL;
+    agent.out_head = 0;
+    agent.out_tail = 0;
+    agent.blocked  = 0;
+    agent.connecting = 0;
+}
+
+
+static void
+tc_agent_retry(tc_event_timer_t *evt)
+{
+    if (agent.fd == -1) {
+        tc_agent_connect(evt->data);
+    }
+
+    tc_event_update_timer(evt, RETRY_MIN_INTERVAL);
+}
+
+
+static void
+tc_agent_output_stat(void)
+{
+    tc_log_info(LOG_NOTICE, 0,
+            "agent captured:%llu,forwarded:%llu,dropped:%llu,frames:%llu",
+            tc_stat.captured_cnt, agent.fwd_cnt, agent.drop_cnt,
+            agent.frame_cnt);
+    tc_log_info(LOG_NOTICE, 0, "agent bytes raw:%llu,sent:%llu,lost:%llu",
+            agent.raw_bytes, agent.sent_bytes, agent.lost_bytes);
+}
+
+
+static void
+tc_agent_disp(tc_event_timer_t *evt)
+{
+    tc_agent_output_stat();
+    tc_event_update_timer(evt, OUTPUT_INTERVAL);
+}
+
+
+/*
+ * frames the packet if it is to be replayed, without the ip options and
+ * whatever the link layer padded it with
+ */
+int
+tc_agent_forward(unsigned char *packet, int len)
+{
+    int              plen, clen, size_ip;
+    u_char          *p;
+    tc_iph_t        *ip;
+    tc_agent_rec_t  *rec;
+
+    ip = (tc_iph_t *) packet;
+    if (!tc_check_ingress_pack_needed(ip)) {
+        return TC_OK;
+    }
+
+    size_ip = ip->ihl << 2;
+    plen = tc_min(ntohs(ip->tot_len), len);
+    clen = plen - size_ip + IPH_MIN_LEN;
+
+    if (plen <= size_ip
+            || TC_AGENT_REC_SIZE + tc_align(clen, 4) > TC_AGENT_FRAME_SIZE)
+    {
+        agent.drop_cnt++;
+        return TC_OK;
+    }
+
+    if (agent.used + TC_AGENT_REC_SIZE + tc_align(clen, 4)
+            > TC_AGENT_FRAME_SIZE)
+    {
+        tc_agent_close_frame();
+    }
+
+    rec = (tc_agent_rec_t *) (agent.frame + TC_AGENT_HDR_SIZE + agent.used);
+    rec->len = htons((uint16_t) clen);
+    rec->reserved = 0;
+
+    p = (u_char *) (rec + 1);
+    memcpy(p, packet, IPH_MIN_LEN);
+    memcpy(p + IPH_MIN_LEN, packet + size_ip, plen - size_ip);
+
+    /* the checksum is worked out again when it is replayed */
+    ip = (tc_iph_t *) p;
+    ip->ihl = IPH_MIN_LEN >> 2;
+    ip->tot_len = htons((uint16_t) clen);
+
+    agent.used += TC_AGENT_REC_SIZE + tc_align(clen, 4);
+    agent.packets++;
+
+    return TC_OK;
+}
+
+
+static void
+tc_agent_put(u_char *p, uint32_t len)
+{
+    uint32_t  pos, n;
+
+    pos = agent.out_head & (TC_AGENT_OUT_SIZE - 1);
+    n = TC_AGENT_OUT_SIZE - pos;
+    if (n >= len) {
+        memcpy(agent.out + pos, p, len);
+    } else {
+        memcpy(agent.out + pos, p, n);
+        memcpy(agent.out, p + n, len - n);
+    }
+
+    agent.out_head += len;
+}
+
+
+/* queues the records framed so far as one frame */
+static void
+tc_agent_close_frame(void)
+{
+    u_char            *body;
+    uint16_t           flags;
+    uint32_t           len, total;
+    tc_agent_frame_t  *hdr;
+    static u_char      pad[4];
+#if (TC_HAVE_ZLIB)
+    uLongf             zlen;
+#endif
+
+    if (agent.packets == 0) {
+        return;
+    }
+
+    hdr  = (tc_agent_frame_t *) agent.frame;
+    body = agent.frame + TC_AGENT_HDR_SIZE;
+    len  = agent.used;
+    flags = 0;
+
+#if (TC_HAVE_ZLIB)
+    if (agent.zlib) {
+        zlen = agent.zsize;
+        if (compress2(agent.zbuf, &zlen, body, agent.used, Z_BEST_SPEED)
+                == Z_OK && zlen < agent.used)
+        {
+            body = agent.zbuf;
+            len  = (uint32_t) zlen;
+            flags = TC_AGENT_ZLIB;
+        }
+    }
+#endif
+
+    hdr->magic   = htonl(TC_AGENT_MAGIC);
+    hdr->flags   = htons(flags);
+    hdr->packets = htons((uint16_t) agent.packets);
+    hdr->raw_len = htonl(agent.used);
+    hdr->len     = htonl(len);
+
+    /* frames are padded, so that the records stay aligned at the other end */
+    total = TC_AGENT_HDR_SIZE + tc_align(len, 4);
+
+    if (agent.fd != -1
+            && TC_AGENT_OUT_SIZE - (agent.out_head - agent.out_tail) < total
+            && !agent.blocked)
+    {
+        tc_agent_write();
+    }
+
+    if (agent.fd == -1
+            || TC_AGENT_OUT_SIZE - (agent.out_head - agent.out_tail) < total)
+    {
+        agent.drop_cnt += agent.packets;
+
+    } else {
+        tc_agent_put(agent.frame, TC_AGENT_HDR_SIZE);
+        tc_agent_put(body, len);
+        tc_agent_put(pad, tc_align(len, 4) - len);
+
+        agent.fwd_cnt   += agent.packets;
+        agent.frame_cnt++;
+        agent.raw_bytes += TC_AGENT_HDR_SIZE + agent.used;
+        agent.sent_bytes += total;
+    }
+
+    agent.used = 0;
+    agent.packets = 0;
+}
+
+
+/* writes out the queued frames, closes the connection if it failed */
+static int
+tc_agent_write(void)
+{
+    int           cnt;
+    ssize_t       n;
+    uint32_t      pos, used;
+    struct iovec  iov[2];
+
+    used = agent.out_head - agent.out_tail;
+    if (used == 0 || agent.connecting) {
+        return TC_OK;
+    }
+
+    pos = agent.out_tail & (TC_AGENT_OUT_SIZE - 1);
+    iov[0].iov_base = agent.out + pos;
+    iov[0].iov_len  = tc_min(used, TC_AGENT_OUT_SIZE - pos);
+    iov[1].iov_base = agent.out;
+    iov[1].iov_len  = used - iov[0].iov_len;
+    cnt = iov[1].iov_len ? 2 : 1;
+
+    do {
+        n = writev(agent.fd, iov, cnt);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            tc_log_info(LOG_ERR, errno, "writev fd:%d", agent.fd);
+            tc_agent_close();
+            return TC_ERR;
+        }
+        n = 0;
+    }
+
+    agent.out_tail += n;
+
+    if (agent.out_head != agent.out_tail) {
+        if (!agent.blocked) {
+            if (tc_event_add(agent.ev->loop, agent.ev, TC_EVENT_WRITE)
+                    == TC_EVENT_ERROR)
+            {
+                tc_agent_close();
+                return TC_ERR;
+            }
+            agent.blocked = 1;
+        }
+
+    } else if (agent.blocked) {
+        tc_event_del(agent.ev->loop, agent.ev, TC_EVENT_WRITE);
+        agent.blocked = 0;
+    }
+
+    return TC_OK;
+}
+
+
+/* the loop calls it at the end of every round */
+static void
+tc_agent_flush(tc_event_loop_t *loop)
+{
+    tc_agent_close_frame();
+
+    /* blocked, it is flushed when it becomes writable */
+    if (agent.fd != -1 && !agent.blocked) {
+        tc_agent_write();
+    }
+}
+
+
+static int
+tc_agent_proc_writable(tc_event_t *wev)
+{
+    int        err;
+    socklen_t  len;
+
+    if (wev != agent.ev) {
+        return TC_OK;
+    }
+
+    if (agent.connecting) {
+        err = 0;
+        len = (socklen_t) sizeof(err);
+        if (getsockopt(wev->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+            err = errno;
+        }
+
+        if (err) {
+            tc_log_info(LOG_ERR, err, "connect to the replayer failed, fd:%d",
+                    wev->fd);
+            tc_agent_close();
+            return TC_ERR;
+        }
+
+        agent.connecting = 0;
+        tc_log_info(LOG_NOTICE, 0, "connected to the replayer, fd:%d",
+                wev->fd);
+    }
+
+    return tc_agent_write();
+}
+
+
+/* the replayer says nothing, so the socket is readable when it goes down */
+static int
+tc_agent_proc_read(tc_event_t *rev)
+{
+    int   ret;
+    char  buf[256];
+
+    if (rev != agent.ev) {
+        return TC_OK;
+    }
+
+    do {
+        ret = tc_socket_recv(rev->fd, buf, sizeof(buf));
+        if (ret == TC_ERR) {
+            tc_agent_close();
+            return TC_ERR;
+        }
+    } while (ret > 0);
+
+    return TC_OK;
+}
+
+
+/* takes the agents on [ip:]port and feeds their packets to handler */
+int
+tc_agent_listen(tc_event_loop_t *event_loop, tc_agent_handler_pt handler)
+{
+    int          fd;
+    tc_event_t  *ev;
+
+    agent_handler = handler;
+
+#if (TC_HAVE_ZLIB)
+    agent_zbuf = tc_alloc(TC_AGENT_FRAME_SIZE);
+    if (agent_zbuf == NULL) {
+        return TC_ERR;
+    }
+#endif
+
+    if ((fd = tc_socket_init()) == TC_INVALID_SOCK) {
+        return TC_ERR;
+    }
+
+    if (tc_socket_listen(fd, clt_settings.agent_listen_ip,
+                clt_settings.agent_listen_port) == TC_ERR)
+    {
+        return TC_ERR;
+    }
+
+    if (tc_socket_set_nonblocking(fd) == TC_ERR) {
+        tc_socket_close(fd);
+        return TC_ERR;
+    }
+
+    ev = tc_event_create(event_loop->pool, fd, tc_agent_accept, NULL);
+    if (ev == NULL) {
+        tc_socket_close(fd);
+        return TC_ERR;
+    }
+
+    if (tc_event_add(event_loop, ev, TC_EVENT_READ) == TC_EVENT_ERROR) {
+        tc_log_info(LOG_ERR, 0, "add socket(%d) to event loop failed.", fd);
+        tc_socket_close(fd);
+        return TC_ERR;
+    }
+
+    agent_listen_fd = fd;
+    tc_log_info(LOG_NOTICE, 0, "take agents on port:%u",
+            clt_settings.agent_listen_port);
+
+    return TC_OK;
+}
+
+
+static int
+tc_agent_accept(tc_event_t *rev)
+{
+    int                 fd;
+    socklen_t           len;
+    tc_event_t         *ev;
+    tc_agent_conn_t    *c;
+    struct sockaddr_in  addr;
+
+    for ( ;; ) {
+        len = (socklen_t) sizeof(addr);
+        fd = accept(rev->fd, (struct sockaddr *) &addr, &len);
+        if (fd == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                tc_log_info(LOG_ERR, errno, "accept agent");
+            }
+            break;
+        }
+
+        if (fd > MAX_FD_VALUE) {
+            tc_log_info(LOG_WARN, 0, "fd:%d is too large for an agent", fd);
+            tc_socket_close(fd);
+            continue;
+        }
+
+        if (tc_socket_set_nonblocking(fd) == TC_ERR) {
+            tc_socket_close(fd);
+            continue;
+        }
+        tc_socket_set_keepalive(fd);
+
+        if (agent_conns[fd] == NULL) {
+            agent_conns[fd] = tc_alloc(sizeof(tc_agent_conn_t));
+            if (agent_conns[fd] == NULL) {
+                tc_socket_close(fd);
+                continue;
+            }
+        }
+
+        ev = tc_event_create(rev->loop->pool, fd, tc_agent_proc_frames, NULL);
+        if (ev == NULL) {
+            tc_socket_close(fd);
+            continue;
+        }
+
+        c = agent_conns[fd];
+        c->pos  = c->start;
+        c->last = c->start;
+        c->ev   = ev;
+        c->frame_cnt = 0;
+        c->pack_cnt  = 0;
+        clt_settings.ev[fd] = ev;
+
+        if (tc_event_add(rev->loop, ev, TC_EVENT_READ) == TC_EVENT_ERROR) {
+            tc_log_info(LOG_ERR, 0, "add socket(%d) to event loop failed.",
+                    fd);
+            c->ev = NULL;
+            tc_socket_close(fd);
+            continue;
+        }
+
+        tc_log_info(LOG_NOTICE, 0, "agent %s:%u connected, fd:%d",
+                inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), fd);
+    }
+
+    return TC_OK;
+}
+
+
+static int
+tc_agent_proc_frames(tc_event_t *rev)
+{
+    int               n, ret, budget, avail;
+    size_t            room;
+    tc_agent_conn_t  *c;
+
+    c = agent_conns[rev->fd];
+    if (c == NULL || c->ev != rev) {
+        /* it went away in this round */
+        return TC_OK;
+    }
+
+    budget = tc_event_budget(rev);
+    n = 0;
+
+    do {
+        /* only a partial frame is left, move it to the start */
+        if (c->pos != c->start) {
+            memmove(c->start, c->pos, c->last - c->pos);
+            c->last = c->start + (c->last - c->pos);
+            c->pos  = c->start;
+        }
+
+        room = c->start + TC_AGENT_BUF_SIZE - c->last;
+        ret  = tc_socket_recv(rev->fd, (char *) c->last, room);
+        if (ret == TC_ERR) {
+            tc_agent_close_conn(rev);
+            return TC_ERR;
+        }
+        c->last += ret;
+
+        ret = tc_agent_parse_frames(c);
+        if (ret == TC_ERR) {
+            tc_agent_close_conn(rev);
+            return TC_ERR;
+        }
+        n += ret;
+
+        /* a full buffer means there may be more on the socket */
+    } while ((size_t) (c->last - c->start) == TC_AGENT_BUF_SIZE
+            && n < budget);
+
+    if (n >= budget && ioctl(rev->fd, FIONREAD, &avail) == 0) {
+        tc_event_backlog(rev, avail);
+    }
+
+    tc_event_consumed(rev, n);
+
+#if (TC_THREADS)
+    tc_workers_kick();
+#endif
+
+    return TC_OK;
+}
+
+
+/* replays every complete frame in place, returns the packets in them */
+static int
+tc_agent_parse_frames(tc_agent_conn_t *c)
+{
+    int                n;
+    u_char            *p, *end;
+    uint16_t           flags, rlen;
+    uint32_t           len, raw_len, total;
+    tc_agent_rec_t    *rec;
+    tc_agent_frame_t  *hdr;
+#if (TC_HAVE_ZLIB)
+    uLongf             zlen;
+#endif
+
+    n = 0;
+
+    while ((size_t) (c->last - c->pos) >= TC_AGENT_HDR_SIZE) {
+        hdr = (tc_agent_frame_t *) c->pos;
+        flags   = ntohs(hdr->flags);
+        len     = ntohl(hdr->len);
+        raw_len = ntohl(hdr->raw_len);
+
+        if (ntohl(hdr->magic) != TC_AGENT_MAGIC || len > TC_AGENT_FRAME_SIZE
+                || raw_len > TC_AGENT_FRAME_SIZE)
+        {
+            tc_log_info(LOG_WARN, 0, "malformed frame from agent:%d",
+                    c->ev->fd);
+            return TC_ERR;
+        }
+
+        total = TC_AGENT_HDR_SIZE + tc_align(len, 4);
+        if ((size_t) (c->last - c->pos) < total) {
+            break;
+        }
+
+        p = c->pos + TC_AGENT_HDR_SIZE;
+        if (flags & TC_AGENT_ZLIB) {
+#if (TC_HAVE_ZLIB)
+            zlen = TC_AGENT_FRAME_SIZE;
+            if (uncompress(agent_zbuf, &zlen, p, len) != Z_OK
+                    || zlen != raw_len)
+            {
+                tc_log_info(LOG_WARN, 0, "corrupt frame from agent:%d",
+                        c->ev->fd);
+                return TC_ERR;
+            }
+            p = agent_zbuf;
+#else
+            tc_log_info(LOG_ERR, 0, "no zlib for the frames of agent:%d",
+                    c->ev->fd);
+            return TC_ERR;
+#endif
+        } else if (raw_len != len) {
+            tc_log_info(LOG_WARN, 0, "malformed frame from agent:%d",
+                    c->ev->fd);
+            return TC_ERR;
+        }
+
+        end = p + raw_len;
+        while (p < end) {
+            rec  = (tc_agent_rec_t *) p;
+            rlen = ntohs(rec->len);
+            if (end - p < (long) TC_AGENT_REC_SIZE
+                    || end - p < (long) (TC_AGENT_REC_SIZE + rlen)
+                    || rlen < IPH_MIN_LEN)
+            {
+                tc_log_info(LOG_WARN, 0, "malformed record from agent:%d",
+                        c->ev->fd);
+                return TC_ERR;
+            }
+
+            agent_handler(p + TC_AGENT_REC_SIZE, rlen);
+            p += TC_AGENT_REC_SIZE + tc_align(rlen, 4);
+            n++;
+        }
+
+        c->pos += total;
+        c->frame_cnt++;
+    }
+
+    c->pack_cnt += n;
+
+    return n;
+}
+
+
+static void
+tc_agent_close_conn(tc_event_t *rev)
+{
+    tc_agent_conn_t  *c;
+
+    c = agent_conns[rev->fd];
+    tc_log_info(LOG_NOTICE, 0, "agent gone, fd:%d,frames:%llu,packets:%llu",
+            rev->fd, c->frame_cnt, c->pack_cnt);
+
+    c->ev = NULL;
+    tc_event_del(rev->loop, rev, rev->reg_evs);
+    tc_event_destroy(rev, 1);
+    clt_settings.ev[rev->fd] = NULL;
+    tc_socket_close(rev->fd);
+}
+
+
+void
+tc_agent_release(void)
+{
+    int  i;
+
+    if (agent.frame != NULL) {
+        tc_agent_output_stat();
+        if (agent.fd != -1) {
+            tc_socket_close(agent.fd);
+            agent.fd = -1;
+        }
+        tc_free(agent.frame);
+        tc_free(agent.out);
+        agent.frame = NULL;
+        agent.out = NULL;
+#if (TC_HAVE_ZLIB)
+        if (agent.zbuf != NULL) {
+            tc_free(agent.zbuf);
+            agent.zbuf = NULL;
+        }
+#endif
+    }
+
+    for (i = 0; i < MAX_FD_NUM; i++) {
+        if (agent_conns[i] != NULL) {
+            if (agent_conns[i]->ev != NULL) {
+                tc_log_info(LOG_NOTICE, 0,
+                        "agent fd:%d,frames:%llu,packets:%llu", i,
+                        agent_conns[i]->frame_cnt, agent_conns[i]->pack_cnt);
+                tc_socket_close(i);
+            }
+            tc_free(agent_conns[i]);
+            agent_conns[i] = NULL;
+        }
+    }
+
+    if (agent_listen_fd != -1) {
+        tc_socket_close(agent_listen_fd);
+        agent_listen_fd = -1;
+    }
+
+#if (TC_HAVE_ZLIB)
+    if (agent_zbuf != NULL) {
+        tc_free(agent_zbuf);
+        agent_zbuf = NULL;
+    }
+#endif
+}
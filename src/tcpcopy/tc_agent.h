@@ -0,0 +1,49 @@
+#ifndef  TC_AGENT_INCLUDED
+#define  TC_AGENT_INCLUDED
+
+#include <xcopy.h>
+#include <tcpcopy.h>
+
+/*
+ * Capture agent and remote replayer.
+ *
+ * An agent (-Y) only captures: the client packets tc_check_ingress_pack_
+ * needed selects are cut to their ip and tcp headers and payload and
+ * streamed to a replayer, which feeds them to its own replay instead of
+ * capturing.  The packets captured in a loop round go out as one frame,
+ * compressed if that was asked for:
+ *
+ *   frame header | record ... record
+ *
+ * A record is its header and the ip packet padded to 4 bytes, so that
+ * the packets stay aligned.  Numbers are in network byte order.  Frames
+ * that find the agent disconnected or its buffer full are dropped.
+ */
+
+#define TC_AGENT_MAGIC         0x74636167      /* "tcag" */
+#define TC_AGENT_FRAME_SIZE    65536           /* of the records */
+#define TC_AGENT_OUT_SIZE      (16 * 1024 * 1024)   /* a power of two */
+
+#define TC_AGENT_ZLIB          0x01
+
+typedef struct {
+    uint32_t          magic;
+    uint16_t          flags;
+    uint16_t          packets;
+    uint32_t          raw_len;        /* of the records */
+    uint32_t          len;            /* of the records as sent */
+} tc_agent_frame_t;
+
+typedef struct {
+    uint16_t          len;            /* of the ip packet */
+    uint16_t          reserved;
+} tc_agent_rec_t;
+
+typedef int (*tc_agent_handler_pt)(unsigned char *ip, int len);
+
+int  tc_agent_init(tc_event_loop_t *event_loop);
+int  tc_agent_forward(unsigned char *packet, int len);
+int  tc_agent_listen(tc_event_loop_t *event_loop, tc_agent_handler_pt handler);
+void tc_agent_release(void);
+
+#endif /* TC_AGENT_INCLUDED */
@@ -0,0 +1,796 @@
+
+#include <xcopy.h>
+#include <tcpcopy.h>
+
+#define TC_ARCHIVE_PKT_MAX     65535           /* the longest ip packet */
+#define TC_ARCHIVE_REC_MAX     (sizeof(tc_archive_rec_t) + 65536)
+#define TC_ARCHIVE_HASH_SIZE   (1024 * 1024)
+
+#define tc_archive_rec_size(len)                                             \
+    tc_align(sizeof(tc_archive_rec_t) + (len), 8)
+
+/* where a block record went before the records were grouped */
+typedef struct {
+    uint32_t             session;
+    uint32_t             seq;
+    uint32_t             offset;
+    uint32_t             len;
+} tc_archive_ent_t;
+
+/* what the builder keeps per client address */
+typedef struct {
+    uint32_t             session;
+    uint32_t             syn_seq;
+    unsigned             syn:1;
+} tc_archive_key_t;
+
+typedef struct {
+    FILE                *fp;
+    char                *file;
+    tc_pool_t           *pool;
+    hash_table          *keys;
+    tc_array_t          *blocks;
+    tc_array_t          *sessions;
+    bool                 compress;
+
+    /* the block being filled, records in capture order */
+    u_char              *buf;
+    uint32_t             used;
+    tc_archive_ent_t    *ents;
+    uint32_t             ent_num;
+    uint64_t             first_us;
+    uint64_t             last_us;
+
+    u_char              *out;         /* the records grouped by session */
+    tc_archive_run_t    *runs;
+    u_char              *zbuf;
+    size_t               zbuf_size;
+
+    uint64_t             offset;
+    uint64_t             packets;
+    uint64_t             kept;
+} tc_archive_builder_t;
+
+struct tc_archive_s {
+    u_char              *start;
+    size_t               size;
+    tc_archive_block_t  *blocks;
+    tc_archive_sess_t   *sessions;
+    uint32_t             block_num;
+    uint32_t             session_num;
+
+    u_char              *selected;    /* a bit per session */
+    uint32_t             block;       /* the next block to load */
+    uint32_t             first_block;
+    uint32_t             last_block;
+
+    /* the selected records of the block loaded, in capture order */
+    tc_archive_rec_t   **recs;
+    uint32_t             rec_num;
+    uint32_t             rec_next;
+    u_char              *zbuf;
+    size_t               zbuf_size;
+};
+
+
+static int
+tc_archive_cmp_ent(const void *a, const void *b)
+{
+    const tc_archive_ent_t *x = a, *y = b;
+
+    if (x->session != y->session) {
+        return x->session < y->session ? -1 : 1;
+    }
+
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+
+static int
+tc_archive_cmp_rec(const void *a, const void *b)
+{
+    const tc_archive_rec_t *x = *(tc_archive_rec_t **) a,
+                           *y = *(tc_archive_rec_t **) b;
+
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+
+static int
+tc_archive_write(tc_archive_builder_t *b, void *data, size_t len)
+{
+    if (len && fwrite(data, len, 1, b->fp) != 1) {
+        tc_log_info(LOG_ERR, errno, "write %s failed", b->file);
+        return TC_ERR;
+    }
+
+    b->offset += len;
+
+    return TC_OK;
+}
+
+
+/* groups the records of the block by session and writes it out */
+static int
+tc_archive_flush(tc_archive_builder_t *b)
+{
+    u_char                  *data, pad[8];
+    uint32_t                 i, off, stored;
+    tc_archive_run_t        *run;
+    tc_archive_ent_t        *ent;
+    tc_archive_block_t      *blk;
+    tc_archive_block_hdr_t   hdr;
+#if (TC_HAVE_ZLIB)
+    uLongf                   zlen;
+#endif
+
+    if (b->ent_num == 0) {
+        return TC_OK;
+    }
+
+    qsort(b->ents, b->ent_num, sizeof(tc_archive_ent_t), tc_archive_cmp_ent);
+
+    run = NULL;
+    off = 0;
+    tc_memzero(&hdr, sizeof(hdr));
+
+    for (i = 0; i < b->ent_num; i++) {
+        ent = &b->ents[i];
+        if (run == NULL || run->session != ent->session) {
+            run = &b->runs[hdr.run_num++];
+            run->session = ent->session;
+            run->packets = 0;
+            run->offset  = off;
+            run->len     = 0;
+        }
+
+        memcpy(b->out + off, b->buf + ent->offset, ent->len);
+        run->packets++;
+        run->len += ent->len;
+        off += ent->len;
+    }
+
+    data   = b->out;
+    stored = off;
+
+#if (TC_HAVE_ZLIB)
+    if (b->compress) {
+        zlen = b->zbuf_size;
+        if (compress2(b->zbuf, &zlen, b->out, off, Z_BEST_SPEED) == Z_OK
+                && zlen < off)
+        {
+            data   = b->zbuf;
+            stored = zlen;
+            hdr.flags |= TC_ARCHIVE_ZLIB;
+        }
+    }
+#endif
+
+    hdr.raw_len    = off;
+    hdr.stored_len = stored;
+
+    blk = tc_array_push(b->blocks);
+    if (blk == NULL) {
+        return TC_ERR;
+    }
+    blk->offset   = b->offset;
+    blk->first_us = b->first_us;
+    blk->last_us  = b->last_us;
+    blk->packets  = b->ent_num;
+    blk->reserved = 0;
+
+    /* records stay 8 byte aligned in the mapping */
+    tc_memzero(pad, sizeof(pad));
+
+    if (tc_archive_write(b, &hdr, sizeof(hdr)) != TC_OK
+            || tc_archive_write(b, b->runs,
+                hdr.run_num * sizeof(tc_archive_run_t)) != TC_OK
+            || tc_archive_write(b, data, stored) != TC_OK
+            || tc_archive_write(b, pad, tc_align(stored, 8) - stored) != TC_OK)
+    {
+        return TC_ERR;
+    }
+
+    b->used    = 0;
+    b->ent_num = 0;
+
+    return TC_OK;
+}
+
+
+/* the session of a client packet, a new one if it opens the connection */
+static int
+tc_archive_session(tc_archive_builder_t *b, tc_iph_t *ip, tc_tcph_t *tcp,
+        uint64_t us)
+{
+    bool                open;
+    uint64_t            key;
+    hash_node          *hn;
+    tc_archive_key_t   *k;
+    tc_archive_sess_t  *sess;
+
+    key = get_key(ip->saddr, tcp->source);
+    hn  = hash_find_node(b->keys, key);
+    k   = hn ? hn->data : NULL;
+
+#if (TC_UDP)
+    open = (k == NULL);
+#else
+    /* a syn with a new isn reuses the address for another connection */
+    open = (k == NULL) || (tcp->syn && !tcp->ack
+            && (!k->syn || k->syn_seq != ntohl(tcp->seq)));
+#endif
+
+    if (open) {
+        if (k == NULL) {
+            k = tc_palloc(b->pool, sizeof(tc_archive_key_t));
+            if (k == NULL || !hash_add(b->keys, b->pool, key, k)) {
+                return -1;
+            }
+        }
+
+        sess = tc_array_push(b->sessions);
+        if (sess == NULL) {
+            return -1;
+        }
+        tc_memzero(sess, sizeof(tc_archive_sess_t));
+        sess->clt_ip   = ip->saddr;
+        sess->srv_ip   = ip->daddr;
+        sess->clt_port = tcp->source;
+        sess->srv_port = tcp->dest;
+        sess->first_us = us;
+        sess->first_block = b->blocks->nelts;
+
+        k->session = b->sessions->nelts - 1;
+        k->syn = 0;
+#if (!TC_UDP)
+        if (tcp->syn && !tcp->ack) {
+            k->syn = 1;
+            k->syn_seq = ntohl(tcp->seq);
+        }
+#endif
+    }
+
+    sess = (tc_archive_sess_t *) b->sessions->elts + k->session;
+    sess->packets++;
+    sess->last_us    = us;
+    sess->last_block = b->blocks->nelts;
+
+    return k->session;
+}
+
+
+static int
+tc_archive_add(tc_archive_builder_t *b, tc_pcap_pkt_t *pkt)
+{
+    int                 session;
+    uint16_t            size_ip, size_l4;
+    uint32_t            len;
+    uint64_t            us;
+    tc_iph_t           *ip;
+    tc_tcph_t          *tcp;
+    tc_archive_rec_t   *rec;
+    tc_archive_ent_t   *ent;
+
+    ip = (tc_iph_t *) pkt->ip;
+    size_ip = ip->ihl << 2;
+
+#if (TC_UDP)
+    size_l4 = sizeof(tc_udpt_t);
+    if (ip->protocol != IPPROTO_UDP) {
+#else
+    size_l4 = TCPH_MIN_LEN;
+    if (ip->protocol != IPPROTO_TCP) {
+#endif
+        return TC_OK;
+    }
+
+    if (size_ip < IPH_MIN_LEN || pkt->len < (uint32_t) size_ip + size_l4) {
+        return TC_OK;
+    }
+
+    /* a record must fit in what is left after a block is nearly full */
+    if (pkt->len > TC_ARCHIVE_PKT_MAX) {
+        tc_log_info(LOG_WARN, 0, "packet of %u bytes,drop", pkt->len);
+        return TC_OK;
+    }
+
+    /* the ports are at the same place for udp */
+    tcp = (tc_tcph_t *) ((char *) ip + size_ip);
+    if (TC_CLT != check_pack_src(&(clt_settings.transfer), ip->daddr,
+                tcp->dest, CHECK_DEST))
+    {
+        return TC_OK;
+    }
+
+    us = (uint64_t) pkt->ts.tv_sec * 1000000 + pkt->ts.tv_usec;
+
+    session = tc_archive_session(b, ip, tcp, us);
+    if (session < 0) {
+        return TC_ERR;
+    }
+
+    len = tc_archive_rec_size(pkt->len);
+    rec = (tc_archive_rec_t *) (b->buf + b->used);
+    rec->us  = us;
+    rec->seq = b->ent_num;
+    rec->len = pkt->len;
+    memcpy(rec + 1, pkt->ip, pkt->len);
+    tc_memzero((u_char *) (rec + 1) + pkt->len,
+            len - sizeof(tc_archive_rec_t) - pkt->len);
+
+    ent = &b->ents[b->ent_num++];
+    ent->session = session;
+    ent->seq     = rec->seq;
+    ent->offset  = b->used;
+    ent->len     = len;
+
+    if (b->used == 0) {
+        b->first_us = us;
+    }
+    b->last_us = us;
+    b->used   += len;
+    b->kept++;
+
+    if (b->used >= TC_ARCHIVE_BLOCK_SIZE) {
+        return tc_archive_flush(b);
+    }
+
+    return TC_OK;
+}
+
+
+/* writes the client packets of the capture in into the archive out */
+int
+tc_archive_build(char *in, char *out, bool compress)
+{
+    int                    ret;
+    size_t                 n;
+    tc_pcap_pkt_t         *pkt;
+    tc_archive_hdr_t       hdr;
+    tc_pcap_reader_t      *r;
+    tc_archive_footer_t    footer;
+    tc_pcap_file_t         f;
+    tc_archive_builder_t   b;
+    struct timespec        nap = {0, 100000};
+
+    f.file   = in;
+    f.speed  = 1;
+    f.weight = 1;
+    f.slot   = 0;
+
+    r = tc_pcap_reader_open(&f, 1);
+    if (r == NULL) {
+        tc_log_info(LOG_ERR, 0, "%s is not a capture to archive", in);
+        fprintf(stderr, "%s is not a capture to archive\n", in);
+        return TC_ERR;
+    }
+
+    tc_memzero(&b, sizeof(b));
+    b.file     = out;
+    b.compress = compress;
+
+    /* every record of a block fits whatever the last packet is */
+    n = TC_ARCHIVE_BLOCK_SIZE + TC_ARCHIVE_REC_MAX;
+    b.pool     = tc_create_pool(TC_DEFAULT_POOL_SIZE, 0, 0);
+    b.buf      = tc_alloc(n);
+    b.out      = tc_alloc(n);
+    b.ents     = tc_alloc(n / sizeof(tc_archive_rec_t)
+                          * sizeof(tc_archive_ent_t));
+    b.runs     = tc_alloc(n / sizeof(tc_archive_rec_t)
+                          * sizeof(tc_archive_run_t));
+#if (TC_HAVE_ZLIB)
+    b.zbuf_size = compressBound(n);
+    b.zbuf     = tc_alloc(b.zbuf_size);
+#endif
+
+    ret = TC_ERR;
+
+    if (b.pool == NULL || b.buf == NULL || b.out == NULL || b.ents == NULL
+            || b.runs == NULL || (compress && b.zbuf == NULL))
+    {
+        goto done;
+    }
+
+    b.keys     = hash_create(b.pool, TC_ARCHIVE_HASH_SIZE);
+    b.blocks   = tc_array_create(b.pool, 1024, sizeof(tc_archive_block_t));
+    b.sessions = tc_array_create(b.pool, 65536, sizeof(tc_archive_sess_t));
+    if (b.keys == NULL || b.blocks == NULL || b.sessions == NULL) {
+        goto done;
+    }
+
+    b.fp = fopen(out, "w");
+    if (b.fp == NULL) {
+        tc_log_info(LOG_ERR, errno, "open %s failed", out);
+        fprintf(stderr, "open %s failed\n", out);
+        goto done;
+    }
+
+    tc_memzero(&hdr, sizeof(hdr));
+    hdr.magic   = TC_ARCHIVE_MAGIC;
+    hdr.version = TC_ARCHIVE_VERSION;
+    if (tc_archive_write(&b, &hdr, sizeof(hdr)) != TC_OK) {
+        goto done;
+    }
+
+    for ( ;; ) {
+        pkt = tc_pcap_reader_peek(r);
+        if (pkt == NULL) {
+            if (tc_pcap_reader_over(r)) {
+                break;
+            }
+            nanosleep(&nap, NULL);
+            continue;
+        }
+
+        b.packets++;
+        if (tc_archive_add(&b, pkt) != TC_OK) {
+            goto done;
+        }
+        tc_pcap_reader_consume(r);
+    }
+
+    if (tc_archive_flush(&b) != TC_OK) {
+        goto done;
+    }
+
+    tc_memzero(&footer, sizeof(footer));
+    footer.magic        = TC_ARCHIVE_MAGIC;
+    footer.block_num    = b.blocks->nelts;
+    footer.session_num  = b.sessions->nelts;
+    footer.blocks_off   = b.offset;
+    footer.sessions_off = b.offset
+                          + b.blocks->nelts * sizeof(tc_archive_block_t);
+
+    if (tc_archive_write(&b, b.blocks->elts,
+                b.blocks->nelts * sizeof(tc_archive_block_t)) != TC_OK
+            || tc_archive_write(&b, b.sessions->elts,
+                b.sessions->nelts * sizeof(tc_archive_sess_t)) != TC_OK
+            || tc_archive_write(&b, &footer, sizeof(footer)) != TC_OK)
+    {
+        goto done;
+    }
+
+    if (fclose(b.fp) != 0) {
+        b.fp = NULL;
+        tc_log_info(LOG_ERR, errno, "close %s failed", out);
+        goto done;
+    }
+    b.fp = NULL;
+
+    tc_log_info(LOG_NOTICE, 0, "archive %s: %llu of %llu packets, "
+            "%u sessions, %u blocks, %llu bytes", out, b.kept, b.packets,
+            footer.session_num, footer.block_num, b.offset);
+    ret = TC_OK;
+
+done:
+
+    if (ret != TC_OK) {
+        tc_log_info(LOG_ERR, 0, "archive %s is not written", out);
+        fprintf(stderr, "archive %s is not written\n", out);
+    }
+
+    if (b.fp != NULL) {
+        fclose(b.fp);
+    }
+
+    if (ret != TC_OK) {
+        unlink(out);
+    }
+
+    tc_pcap_reader_close(r);
+
+    if (b.pool != NULL) {
+        tc_destroy_pool(b.pool);
+    }
+    tc_free(b.buf);
+    tc_free(b.out);
+    tc_free(b.ents);
+    tc_free(b.runs);
+    tc_free(b.zbuf);
+
+    return ret;
+}
+
+
+static bool
+tc_archive_clt_selected(tc_archive_sess_t *sess)
+{
+    int       i;
+    uint32_t  ip;
+
+    if (clt_settings.replay_clt_num == 0) {
+        return true;
+    }
+
+    ip = ntohl(sess->clt_ip);
+    for (i = 0; i < clt_settings.replay_clt_num; i++) {
+        if (ip >= clt_settings.replay_clts[i].first
+                && ip <= clt_settings.replay_clts[i].last)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/* marks the sessions -T and -E ask for and the blocks holding them */
+static void
+tc_archive_select(tc_archive_t *a)
+{
+    uint32_t            lo, hi, mid, i, num;
+    uint64_t            from, to;
+    tc_archive_sess_t  *sess;
+
+    a->block       = a->block_num;
+    a->first_block = a->block_num;
+    a->last_block  = 0;
+
+    if (a->session_num == 0) {
+        return;
+    }
+
+    from = a->blocks[0].first_us + clt_settings.replay_from;
+    to   = clt_settings.replay_to ?
+           a->blocks[0].first_us + clt_settings.replay_to : (uint64_t) -1;
+
+    /* sessions are numbered in capture order, so by their start */
+    lo = 0;
+    hi = a->session_num;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (a->sessions[mid].first_us < from) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    num = 0;
+    for (i = lo; i < a->session_num; i++) {
+        sess = &a->sessions[i];
+        if (sess->first_us >= to) {
+            break;
+        }
+
+        if (!tc_archive_clt_selected(sess)) {
+            continue;
+        }
+
+        a->selected[i >> 3] |= 1 << (i & 7);
+        a->block      = tc_min(a->block, sess->first_block);
+        a->last_block = tc_max(a->last_block, sess->last_block);
+        num++;
+    }
+
+    a->first_block = a->block;
+
+    tc_log_info(LOG_NOTICE, 0, "archive sessions:%u, replayed:%u, "
+            "blocks:%u, read from %u", a->session_num, num, a->block_num,
+            a->block);
+}
+
+
+/* returns NULL if the mapping is not an archive */
+tc_archive_t *
+tc_archive_open(u_char *map, size_t size)
+{
+    uint32_t              i, max;
+    tc_archive_t         *a;
+    tc_archive_hdr_t      hdr;
+    tc_archive_footer_t   footer;
+
+    if (size < sizeof(hdr) + sizeof(footer)) {
+        return NULL;
+    }
+
+    memcpy(&hdr, map, sizeof(hdr));
+    memcpy(&footer, map + size - sizeof(footer), sizeof(footer));
+
+    if (hdr.magic != TC_ARCHIVE_MAGIC || footer.magic != TC_ARCHIVE_MAGIC) {
+        tc_log_info(LOG_ERR, 0, "the archive is cut off or of another host");
+        return NULL;
+    }
+
+    if (hdr.version != TC_ARCHIVE_VERSION) {
+        tc_log_info(LOG_ERR, 0, "archive version %u is unknown", hdr.version);
+        return NULL;
+    }
+
+    if ((footer.blocks_off & 7) || footer.blocks_off > size
+            || footer.sessions_off != footer.blocks_off
+               + (uint64_t) footer.block_num * sizeof(tc_archive_block_t)
+            || footer.sessions_off
+               + (uint64_t) footer.session_num * sizeof(tc_archive_sess_t)
+               != size - sizeof(footer))
+    {
+        tc_log_info(LOG_ERR, 0, "the archive index is broken");
+        return NULL;
+    }
+
+    a = tc_alloc(sizeof(tc_archive_t));
+    if (a == NULL) {
+        return NULL;
+    }
+    tc_memzero(a, sizeof(tc_archive_t));
+
+    a->start       = map;
+    a->size        = size;
+    a->blocks      = (tc_archive_block_t *) (map + footer.blocks_off);
+    a->sessions    = (tc_archive_sess_t *) (map + footer.sessions_off);
+    a->block_num   = footer.block_num;
+    a->session_num = footer.session_num;
+
+    max = 0;
+    for (i = 0; i < a->block_num; i++) {
+        max = tc_max(max, a->blocks[i].packets);
+    }
+
+    a->selected = tc_alloc(a->session_num / 8 + 1);
+    a->recs     = tc_alloc((max + 1) * sizeof(tc_archive_rec_t *));
+    if (a->selected == NULL || a->recs == NULL) {
+        tc_archive_close(a);
+        return NULL;
+    }
+    tc_memzero(a->selected, a->session_num / 8 + 1);
+
+    tc_archive_select(a);
+
+    return a;
+}
+
+
+void
+tc_archive_close(tc_archive_t *a)
+{
+    tc_free(a->selected);
+    tc_free(a->recs);
+    tc_free(a->zbuf);
+    tc_free(a);
+}
+
+
+/* takes the records of the sessions replayed out of block i */
+static int
+tc_archive_load(tc_archive_t *a, uint32_t i)
+{
+    u_char                  *p, *data, *last;
+    uint32_t                 r, n, max;
+    tc_archive_run_t        *runs;
+    tc_archive_rec_t        *rec;
+    tc_archive_block_t      *blk;
+    tc_archive_block_hdr_t  *hdr;
+#if (TC_HAVE_ZLIB)
+    uLongf                   zlen;
+#endif
+
+    a->rec_num  = 0;
+    a->rec_next = 0;
+
+    blk = &a->blocks[i];
+    if (blk->offset + sizeof(tc_archive_block_hdr_t) > a->size) {
+        return TC_ERR;
+    }
+
+    hdr  = (tc_archive_block_hdr_t *) (a->start + blk->offset);
+    runs = (tc_archive_run_t *) (hdr + 1);
+    data = (u_char *) (runs + hdr->run_num);
+    if (data + hdr->stored_len > a->start + a->size) {
+        return TC_ERR;
+    }
+
+    for (r = 0; r < hdr->run_num; r++) {
+        n = runs[r].session;
+        if (n < a->session_num && (a->selected[n >> 3] & (1 << (n & 7)))) {
+            break;
+        }
+    }
+
+    /* none of its sessions is replayed, it is not even decompressed */
+    if (r == hdr->run_num) {
+        return TC_OK;
+    }
+
+    if (hdr->flags & TC_ARCHIVE_ZLIB) {
+#if (TC_HAVE_ZLIB)
+        if (a->zbuf_size < hdr->raw_len) {
+            tc_free(a->zbuf);
+            a->zbuf_size = hdr->raw_len;
+            a->zbuf = tc_alloc(a->zbuf_size);
+            if (a->zbuf == NULL) {
+                a->zbuf_size = 0;
+                return TC_ERR;
+            }
+        }
+
+        zlen = hdr->raw_len;
+        if (uncompress(a->zbuf, &zlen, data, hdr->stored_len) != Z_OK
+                || zlen != hdr->raw_len)
+        {
+            return TC_ERR;
+        }
+        data = a->zbuf;
+#else
+        tc_log_info(LOG_ERR, 0, "the archive is compressed, zlib is missing");
+        return TC_ERR;
+#endif
+
+    } else if (hdr->raw_len != hdr->stored_len) {
+        return TC_ERR;
+    }
+
+    max = blk->packets;
+
+    for ( /* void */ ; r < hdr->run_num; r++) {
+        n = runs[r].session;
+        if (n >= a->session_num || !(a->selected[n >> 3] & (1 << (n & 7)))) {
+            continue;
+        }
+
+        if ((uint64_t) runs[r].offset + runs[r].len > hdr->raw_len) {
+            return TC_ERR;
+        }
+
+        p    = data + runs[r].offset;
+        last = p + runs[r].len;
+        while (p < last) {
+            rec = (tc_archive_rec_t *) p;
+            if (a->rec_num == max || last - p < (long) sizeof(*rec)
+                    || rec->len > (size_t) (last - p) - sizeof(*rec))
+            {
+                return TC_ERR;
+            }
+
+            a->recs[a->rec_num++] = rec;
+            p += tc_archive_rec_size(rec->len);
+        }
+    }
+
+    /* the sessions are interleaved again as they were captured */
+    qsort(a->recs, a->rec_num, sizeof(tc_archive_rec_t *),
+            tc_archive_cmp_rec);
+
+    return TC_OK;
+}
+
+
+/* the next packet replayed, returns 0 at the end or -1 if broken */
+int
+tc_archive_next(tc_archive_t *a, u_char **ip, uint32_t *len,
+        struct timeval *ts)
+{
+    tc_archive_rec_t  *rec;
+
+    while (a->rec_next == a->rec_num) {
+        if (a->block > a->last_block || a->block >= a->block_num) {
+            return 0;
+        }
+
+        if (tc_archive_load(a, a->block) != TC_OK) {
+            tc_log_info(LOG_ERR, 0, "archive block %u is broken", a->block);
+            return -1;
+        }
+        a->block++;
+    }
+
+    rec = a->recs[a->rec_next++];
+
+    *ip  = (u_char *) (rec + 1);
+    *len = rec->len;
+    ts->tv_sec  = rec->us / 1000000;
+    ts->tv_usec = rec->us % 1000000;
+
+    return 1;
+}
+
+
+/* the same sessions are read once more */
+void
+tc_archive_rewind(tc_archive_t *a)
+{
+    a->block    = a->first_block;
+    a->rec_num  = 0;
+    a->rec_next = 0;
+}
@@ -0,0 +1,95 @@
+#ifndef  TC_ARCHIVE_INCLUDED
+#define  TC_ARCHIVE_INCLUDED
+
+#include <xcopy.h>
+#include <tcpcopy.h>
+
+/*
+ * Indexed replay archive.
+ *
+ * An archive keeps only the client packets the transfer map selects.
+ * They are cut into blocks in capture order and, inside a block, grouped
+ * by session, so that the packets of sessions not replayed are skipped
+ * by their offsets without being decoded or even decompressed.  The
+ * session table says when every session starts and which blocks hold
+ * it; it is sorted by start time and serves as the time index.
+ *
+ *   header | block ... block | block table | session table | footer
+ *
+ * A block is its header, one run per session in it, and then the packet
+ * records of the runs, compressed as a whole if that was asked for.
+ * Numbers are in host byte order.
+ */
+
+#define TC_ARCHIVE_MAGIC       0x72616374      /* "tcar" */
+#define TC_ARCHIVE_VERSION     1
+#define TC_ARCHIVE_BLOCK_SIZE  (1024 * 1024)
+
+#define TC_ARCHIVE_ZLIB        0x01
+
+typedef struct {
+    uint32_t          magic;
+    uint32_t          version;
+    uint64_t          reserved;
+} tc_archive_hdr_t;
+
+typedef struct {
+    uint64_t          blocks_off;
+    uint64_t          sessions_off;
+    uint32_t          block_num;
+    uint32_t          session_num;
+    uint32_t          reserved;
+    uint32_t          magic;
+} tc_archive_footer_t;
+
+typedef struct {
+    uint64_t          offset;
+    uint64_t          first_us;
+    uint64_t          last_us;
+    uint32_t          packets;
+    uint32_t          reserved;
+} tc_archive_block_t;
+
+typedef struct {
+    uint32_t          run_num;
+    uint32_t          flags;
+    uint32_t          raw_len;        /* of the records */
+    uint32_t          stored_len;     /* of the records as written */
+} tc_archive_block_hdr_t;
+
+typedef struct {
+    uint32_t          session;
+    uint32_t          packets;
+    uint32_t          offset;         /* into the records */
+    uint32_t          len;
+} tc_archive_run_t;
+
+typedef struct {
+    uint32_t          clt_ip;         /* as captured, network order */
+    uint32_t          srv_ip;
+    uint16_t          clt_port;
+    uint16_t          srv_port;
+    uint32_t          packets;
+    uint64_t          first_us;
+    uint64_t          last_us;
+    uint32_t          first_block;
+    uint32_t          last_block;
+} tc_archive_sess_t;
+
+/* a packet record, followed by the ip packet and padded to 8 bytes */
+typedef struct {
+    uint64_t          us;
+    uint32_t          seq;            /* capture order within the block */
+    uint32_t          len;
+} tc_archive_rec_t;
+
+typedef struct tc_archive_s tc_archive_t;
+
+int  tc_archive_build(char *in, char *out, bool compress);
+tc_archive_t *tc_archive_open(u_char *map, size_t size);
+void tc_archive_close(tc_archive_t *a);
+int  tc_archive_next(tc_archive_t *a, u_char **ip, uint32_t *len,
+        struct timeval *ts);
+void tc_archive_rewind(tc_archive_t *a);
+
+#endif /* TC_ARCHIVE_INCLUDED */
@@ -0,0 +1,235 @@
+
+#include <xcopy.h>
+#include <tcpcopy.h>
+
+#define TC_DELAY_REC_SIZE  sizeof(tc_delay_rec_t)
+
+typedef struct {
+    u_char              *base;
+    uint64_t             size;
+    uint64_t             head;          /* bytes appended */
+    uint64_t             tail;          /* bytes replayed */
+    uint64_t             rd_chunk;      /* the chunk replayed from */
+    tc_event_timer_t    *evt;
+    tc_delay_handler_pt  handler;
+    uint64_t             append_cnt;
+    uint64_t             replay_cnt;
+    uint64_t             drop_cnt;
+    uint64_t             max_late;      /* us a packet was replayed late */
+} tc_delay_line_t;
+
+static tc_delay_line_t  line;
+
+static void tc_delay_replay(tc_event_timer_t *evt);
+static void tc_delay_disp(tc_event_timer_t *evt);
+
+
+static uint64_t
+tc_delay_now(void)
+{
+    struct timespec  ts;
+
+    /* the delay does not move with the wall clock */
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/* gives back the pages of a chunk, the file keeps what was written */
+static void
+tc_delay_drop_chunk(uint64_t chunk)
+{
+    uint64_t  off;
+
+    off = chunk * TC_DELAY_CHUNK;
+    madvise(line.base + off, tc_min(TC_DELAY_CHUNK, line.size - off),
+            MADV_DONTNEED);
+}
+
+
+int
+tc_delay_init(tc_event_loop_t *event_loop, tc_delay_handler_pt handler)
+{
+    int    fd, err;
+    char  *file;
+
+    file = clt_settings.delay_file;
+    line.size = clt_settings.delay_size;
+    line.handler = handler;
+
+    fd = open(file, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        tc_log_info(LOG_ERR, errno, "open %s failed", file);
+        return TC_ERR;
+    }
+
+    /* the blocks are there before the first packet comes */
+    err = posix_fallocate(fd, 0, (off_t) line.size);
+    if (err != 0) {
+        tc_log_info(LOG_ERR, err, "allocate %llu bytes for %s failed",
+                line.size, file);
+        close(fd);
+        return TC_ERR;
+    }
+
+    line.base = mmap(NULL, line.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, 0);
+    close(fd);
+    if (line.base == MAP_FAILED) {
+        tc_log_info(LOG_ERR, errno, "mmap %s failed", file);
+        line.base = NULL;
+        return TC_ERR;
+    }
+    madvise(line.base, line.size, MADV_SEQUENTIAL);
+
+    /* nothing is due before the delay is over */
+    line.evt = tc_event_add_timer(event_loop->pool,
+            tc_max(clt_settings.delay / 1000, 1), NULL, tc_delay_replay);
+    if (line.evt == NULL) {
+        return TC_ERR;
+    }
+    tc_event_add_timer(event_loop->pool, OUTPUT_INTERVAL, NULL, tc_delay_disp);
+
+    tc_log_info(LOG_NOTICE, 0, "delay line:%s, %llu bytes, delay:%llu ms",
+            file, line.size, clt_settings.delay / 1000);
+
+    return TC_OK;
+}
+
+
+/* keeps the packet until its delay is over, without the link padding */
+int
+tc_delay_append(unsigned char *packet, int len)
+{
+    uint32_t         plen;
+    uint64_t         off, need, skip;
+    tc_delay_rec_t  *rec;
+
+    plen = tc_min(ntohs(((tc_iph_t *) packet)->tot_len), (uint32_t) len);
+    need = TC_DELAY_REC_SIZE + tc_align(plen, 8);
+
+    off  = line.head % line.size;
+    skip = 0;
+    if (line.size - off < need) {
+        /* records do not wrap, the rest of the ring is skipped */
+        skip = line.size - off;
+    }
+
+    if (line.head + skip + need - line.tail > line.size) {
+        line.drop_cnt++;
+        return TC_OK;
+    }
+
+    if (skip) {
+        if (skip >= TC_DELAY_REC_SIZE) {
+            rec = (tc_delay_rec_t *) (line.base + off);
+            rec->len = TC_DELAY_WRAP;
+        }
+        line.head += skip;
+        off = 0;
+    }
+
+    rec = (tc_delay_rec_t *) (line.base + off);
+    rec->us  = tc_delay_now();
+    rec->len = plen;
+    rec->reserved = 0;
+    memcpy(rec + 1, packet, plen);
+
+    line.head += need;
+    line.append_cnt++;
+
+    return TC_OK;
+}
+
+
+static void
+tc_delay_replay(tc_event_timer_t *evt)
+{
+    int              n;
+    uint64_t         now, off, due, chunk, wait;
+    tc_delay_rec_t  *rec;
+
+    now  = tc_delay_now();
+    /* empty, nothing appended from now on is due before the delay is over */
+    wait = clt_settings.delay;
+
+    for (n = 0; line.tail != line.head; ) {
+        off = line.tail % line.size;
+        rec = (tc_delay_rec_t *) (line.base + off);
+
+        if (line.size - off < TC_DELAY_REC_SIZE || rec->len == TC_DELAY_WRAP) {
+            line.tail += line.size - off;
+            continue;
+        }
+
+        due = rec->us + clt_settings.delay;
+        if (due > now) {
+            wait = due - now;
+            break;
+        }
+
+        if (n == TC_DELAY_BUDGET) {
+            /* the rest is replayed after the other events of the loop */
+            wait = 0;
+            break;
+        }
+
+        if (now - due > line.max_late) {
+            line.max_late = now - due;
+        }
+
+        line.handler((unsigned char *) (rec + 1), rec->len);
+        line.tail += TC_DELAY_REC_SIZE + tc_align(rec->len, 8);
+        line.replay_cnt++;
+        n++;
+
+        chunk = (line.tail % line.size) / TC_DELAY_CHUNK;
+        if (chunk != line.rd_chunk) {
+            tc_delay_drop_chunk(line.rd_chunk);
+            line.rd_chunk = chunk;
+            /* the next one has likely been written out, read it ahead */
+            off = ((chunk + 1) * TC_DELAY_CHUNK) % line.size;
+            madvise(line.base + off, tc_min(TC_DELAY_CHUNK, line.size - off),
+                    MADV_WILLNEED);
+        }
+    }
+
+#if (TC_THREADS)
+    if (n > 0) {
+        tc_workers_kick();
+    }
+#endif
+
+    tc_event_update_timer(evt, tc_max(wait / 1000, 1));
+}
+
+
+static void
+tc_delay_output_stat(void)
+{
+    tc_log_info(LOG_NOTICE, 0,
+            "delay line appended:%llu,replayed:%llu,dropped:%llu",
+            line.append_cnt, line.replay_cnt, line.drop_cnt);
+    tc_log_info(LOG_NOTICE, 0, "delay line bytes held:%llu,max late:%llu us",
+            line.head - line.tail, line.max_late);
+}
+
+
+static void
+tc_delay_disp(tc_event_timer_t *evt)
+{
+    tc_delay_output_stat();
+    tc_event_update_timer(evt, OUTPUT_INTERVAL);
+}
+
+
+void
+tc_delay_release(void)
+{
+    if (line.base != NULL) {
+        tc_delay_output_stat();
+        munmap(line.base, line.size);
+        line.base = NULL;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef  TC_DELAY_INCLUDED
+#define  TC_DELAY_INCLUDED
+
+#include <xcopy.h>
+#include <tcpcopy.h>
+
+/*
+ * Delay line.
+ *
+ * With -J the packets selected for replay are not replayed as they are
+ * captured.  Instead they are appended with their capture time to a ring
+ * in a preallocated file mapped in memory, and a cursor replays them
+ * once they are older than the delay.  The file holds them, so memory
+ * use does not grow with the delay: the pages replayed are given back a
+ * chunk at a time and those the cursor comes to next are read ahead.
+ * Packets finding the ring full are dropped.
+ */
+
+#define TC_DELAY_FILE          "/var/tmp/tcpcopy.delay"
+#define TC_DELAY_SIZE          1024            /* megabytes */
+#define TC_DELAY_MIN_SIZE      64              /* megabytes */
+#define TC_DELAY_CHUNK         (16 * 1024 * 1024)
+#define TC_DELAY_BUDGET        4096            /* packets replayed a round */
+
+#define TC_DELAY_WRAP          0xffffffff      /* the rest of the ring is
+                                                  skipped */
+
+/* a packet record, followed by the ip packet and padded to 8 bytes */
+typedef struct {
+    uint64_t          us;             /* when it was captured, monotonic */
+    uint32_t          len;            /* of the ip packet or TC_DELAY_WRAP */
+    uint32_t          reserved;
+} tc_delay_rec_t;
+
+typedef int (*tc_delay_handler_pt)(unsigned char *ip, int len);
+
+int  tc_delay_init(tc_event_loop_t *event_loop, tc_delay_handler_pt handler);
+int  tc_delay_append(unsigned char *packet, int len);
+void tc_delay_release(void);
+
+#endif /* TC_DELAY_INCLUDED */
@@ -80,8 +80,16 @@ tcp_copy_release_resources(void)
 #endif 
     tc_log_info(LOG_WARN, 0, "sig %d received", tc_over); 
 
+#if (TC_THREADS)
+    tc_workers_stop();
+#endif
+
     tc_output_stat();
 
+#if (TC_THREADS)
+    tc_workers_release();
+#endif
+
     tc_dest_sess_table();
 
 #if (TC_PLUGIN)
@@ -93,6 +101,12 @@ tcp_copy_release_resources(void)
     tc_event_loop_finish(&event_loop);
     tc_log_info(LOG_NOTICE, 0, "tc_event_loop_finish over");
 
+    tc_message_release();
+#if (!TC_OFFLINE)
+    tc_agent_release();
+    tc_delay_release();
+#endif
+
 #if (TC_DIGEST)
     tc_destroy_sha1();
     tc_destroy_digests();
@@ -108,6 +122,13 @@ tcp_copy_release_resources(void)
 #endif
 
 #if (TC_OFFLINE)
+    tc_offline_release();
+
+    if (clt_settings.pcap_reader != NULL) {
+        tc_pcap_reader_close(clt_settings.pcap_reader);
+        clt_settings.pcap_reader = NULL;
+    }
+
     if (clt_settings.pcap != NULL) {
         pcap_close(clt_settings.pcap);
         clt_settings.pcap = NULL;
@@ -138,78 +159,193 @@ tcp_copy_over(const int sig)
 }
 
 
-static bool send_version(int fd) {
+static void send_version(int fd) {
     msg_clt_t    msg;
 
     tc_memzero(&msg, sizeof(msg_clt_t));
     msg.type = htons(INTERNAL_VERSION);
+    /* intercept may answer with compact records from now on */
+#if (TC_PAYLOAD)
+    msg.clt_ip = htonl(TC_MSG_CAP_COMPACT | TC_MSG_CAP_AFFINE 
+            | TC_MSG_CAP_PAYLOAD);
+#else
+    msg.clt_ip = htonl(TC_MSG_CAP_COMPACT | TC_MSG_CAP_AFFINE);
+#endif
 
-    if (tc_socket_snd(fd, (char *) &msg, MSG_CLT_SIZE) == TC_ERR) {
+    if (tc_message_send(fd, &msg, MSG_CLT_SIZE) != TC_OK) {
         tc_log_info(LOG_ERR, 0, "send version error:%d", fd);
-        return false;
+    }
+}
+
+
+/* the next try of a server is put off twice as long, give or take half */
+static void
+server_backoff(conns_t *conns)
+{
+    if (conns->backoff == 0) {
+        conns->backoff = RETRY_MIN_INTERVAL;
+    } else {
+        conns->backoff = tc_min(conns->backoff << 1, RETRY_INTERVAL);
+    }
+
+    conns->next_try = tc_milliscond_time() + conns->backoff / 2 
+        + random() % conns->backoff;
+}
+
+
+/* registers the -c clients of port slice j with the intercept of fd */
+static void send_client_ranges(int fd, int j) {
+    int           i;
+    msg_clt_t     msg;
+    clt_range_t  *r;
+
+    tc_memzero(&msg, sizeof(msg_clt_t));
+    msg.type = htons(CLIENT_RANGE_ADD);
+    msg.clt_port = htons((uint16_t) 
+            tc_port_slice_first(j, clt_settings.par_conns));
+    msg.target_port = htons((uint16_t) 
+            (tc_port_slice_first(j + 1, clt_settings.par_conns) - 1));
+
+    for (i = 0; i < clt_settings.clt_range_num; i++) {
+        r = &clt_settings.clt_ranges[i];
+        msg.clt_ip = htonl(r->first);
+        msg.target_ip = htonl(r->last);
+
+        if (tc_message_send(fd, &msg, MSG_CLT_SIZE) != TC_OK) {
+            tc_log_info(LOG_ERR, 0, "send client ranges error:%d", fd);
+            return;
+        }
+    }
+}
+
+
+/*
+ * a slice whose connection is closed goes through the next open one, as
+ * sess_conn_fd does with its sessions; slice j and the closed ones that
+ * fall back on it are registered with the connection now carrying them
+ */
+void
+tc_register_client_slices(conns_t *conns, int j)
+{
+    int  i, k, fd;
+
+    if (!clt_settings.range_reg || conns->num == 0) {
+        return;
     }
 
-    return true;
+    fd = -1;
+    for (i = 0; i < conns->num; i++) {
+        fd = conns->fds[(j + i) % conns->num];
+        if (fd > 0) {
+            break;
+        }
+    }
+
+    if (fd <= 0) {
+        return;
+    }
+
+    for (i = 0; i < conns->num; i++) {
+        k = (j - i + conns->num) % conns->num;
+        if (i > 0 && conns->fds[k] > 0) {
+            break;
+        }
+        send_client_ranges(fd, k);
+    }
 }
 
 
+/* 
+ * opens the missing connections of every server due for a try, a
+ * connection completes in the loop and messages wait for it meanwhile
+ */
 static int
 connect_to_server(tc_event_loop_t *ev_lp)
 {
     int              i, j, fd;
+    bool             opened[MAX_CONN_NUM];
     uint32_t         target_ip;
     conns_t         *conns;
     uint16_t         target_port;
 
-    for (i = 0; i < clt_settings.real_servers.num; i++) {
+    for (i = 0; i < real_servers->num; i++) {
 
-        conns = &(clt_settings.real_servers.conns[i]);
+        conns = &(real_servers->conns[i]);
         target_ip = conns->ip;
         target_port = conns->port;
         if (target_port == 0) {
             target_port = clt_settings.srv_port;
         }
 
-        if (conns->active != 0) {
+        if (conns->active && conns->remained_num == clt_settings.par_conns) {
             continue;
         }
 
-        for (j = 0; j < conns->num; j++) {
-             fd = conns->fds[j];
-             if (fd > 0) {
-                 tc_log_info(LOG_NOTICE, 0, "it close socket:%d", fd);
-                 tc_socket_close(fd);
-                 tc_event_del(clt_settings.ev[fd]->loop, 
-                         clt_settings.ev[fd], TC_EVENT_READ);
-                 tc_event_destroy(clt_settings.ev[fd], 0);
-                 conns->fds[j] = -1;
-             }
+        if (conns->next_try > tc_milliscond_time()) {
+            continue;
+        }
+
+        if (!conns->active) {
+            /* ones left by a server given up on */
+            for (j = 0; j < conns->num; j++) {
+                fd = conns->fds[j];
+                if (fd > 0) {
+                    tc_log_info(LOG_NOTICE, 0, "it close socket:%d", fd);
+                    tc_message_shm_close(fd);
+                    tc_socket_close(fd);
+                    tc_event_del(clt_settings.ev[fd]->loop, 
+                            clt_settings.ev[fd], clt_settings.ev[fd]->reg_evs);
+                    tc_event_destroy(clt_settings.ev[fd], 0);
+                    conns->fds[j] = -1;
+                }
+            }
+            conns->remained_num = 0;
         }
 
-        conns->num = 0;
-        conns->remained_num = 0;
+        server_backoff(conns);
 
         for (j = 0; j < clt_settings.par_conns; j++) {
+            opened[j] = false;
+            if (j < conns->num && conns->fds[j] > 0) {
+                continue;
+            }
+
             /*
              * 连接服务器并注册读事件
             */
             fd = tc_message_init(ev_lp, target_ip, target_port);
             if (fd == TC_INVALID_SOCK) {
-                return TC_ERR;
+                conns->fds[j] = -1;
+                continue;
             }
 
-            if (!send_version(fd)) {
-                return TC_ERR;
+            /* queued, it goes out once connected */
+            send_version(fd);
+
+            if (conns->shm_path[0] != '\0' 
+                    && tc_message_shm_init(ev_lp, fd, conns->shm_path) != TC_OK)
+            {
+                tc_log_info(LOG_WARN, 0, "responses of fd:%d come over tcp",
+                        fd);
             }
 
-            if (j == 0) {
-                clt_settings.real_servers.active_num++;
+            if (!conns->active) {
+                real_servers->active_num++;
                 conns->active = 1;
             }
 
             conns->fds[j] = fd;
-            conns->num++;
             conns->remained_num++;
+            opened[j] = true;
+        }
+
+        conns->num = clt_settings.par_conns;
+
+        /* once all are there, so that each slice is sent only once */
+        for (j = 0; j < conns->num; j++) {
+            if (opened[j]) {
+                tc_register_client_slices(conns, j);
+            }
         }
     }
 
@@ -220,24 +356,17 @@ connect_to_server(tc_event_loop_t *ev_lp)
 static void 
 restore_work(tc_event_timer_t *evt) 
 {
-    connect_to_server(&event_loop);
-    tc_event_update_timer(evt, RETRY_INTERVAL);    
-    clt_settings.tries++;
+    connect_to_server(evt->data);
+    tc_event_update_timer(evt, RETRY_MIN_INTERVAL);    
 }
 
 
+/* sessions and intercept connections of the calling thread */
 int
-tcp_copy_init(tc_event_loop_t *ev_lp)
+tcp_copy_replay_init(tc_event_loop_t *ev_lp)
 {
-    /*
-     * 注册超时事件
-    */
-    tc_event_add_timer(ev_lp->pool, 60000, NULL, check_resource_usage);
-    tc_event_add_timer(ev_lp->pool, OUTPUT_INTERVAL, NULL, tc_interval_disp);
-
-    if (clt_settings.lonely) {
-        tc_event_add_timer(ev_lp->pool, RETRY_INTERVAL, NULL, restore_work);
-    }
+    /* servers down are retried, each with its own backoff */
+    tc_event_add_timer(ev_lp->pool, RETRY_MIN_INTERVAL, ev_lp, restore_work);
 
     /*
      * 初始化seesion hash
@@ -253,8 +382,48 @@ tcp_copy_init(tc_event_loop_t *ev_lp)
         return TC_ERR;
     }
 
+    if (real_servers->active_num == 0 && !clt_settings.lonely) {
+        tc_log_info(LOG_ERR, 0, "no intercept could be connected");
+        return TC_ERR;
+    }
+
+    return TC_OK;
+}
+
+
+int
+tcp_copy_init(tc_event_loop_t *ev_lp)
+{
+    /*
+     * 注册超时事件
+    */
+    tc_event_add_timer(ev_lp->pool, 60000, NULL, check_resource_usage);
+    tc_event_add_timer(ev_lp->pool, OUTPUT_INTERVAL, NULL, tc_interval_disp);
+
+    real_servers = &clt_settings.real_servers;
+
+#if (!TC_OFFLINE)
+    if (clt_settings.agent_port) {
+        /* an agent only captures, the replayer it streams to replays */
+        if (tc_agent_init(ev_lp) == TC_ERR) {
+            return TC_ERR;
+        }
+    } else
+#endif
+#if (TC_THREADS)
+    if (clt_settings.workers) {
+        /* the workers replay, this thread only captures */
+        if (tc_workers_init() == TC_ERR) {
+            return TC_ERR;
+        }
+    } else
+#endif
+    if (tcp_copy_replay_init(ev_lp) == TC_ERR) {
+        return TC_ERR;
+    }
+
 #if (TC_OFFLINE)
-    if (tc_offline_init(ev_lp, clt_settings.pcap_file) == TC_ERR) {
+    if (tc_offline_init(ev_lp, clt_settings.pcap_files[0].file) == TC_ERR) {
         return TC_ERR;
     }
 #else
@@ -5,8 +5,10 @@
 #include <tcpcopy.h>
 
 int  tcp_copy_init(tc_event_loop_t *event_loop);
+int  tcp_copy_replay_init(tc_event_loop_t *event_loop);
 void tcp_copy_over(const int sig);
 void tcp_copy_release_resources(void);
+void tc_register_client_slices(conns_t *conns, int j);
 
 #endif   /* ----- #ifndef TC_MANAGER_INCLUDED ----- */
 
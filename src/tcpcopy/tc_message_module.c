@@ -2,50 +2,157 @@
 #include <xcopy.h>
 #include <tcpcopy.h>
 
+/*
+ * Responses are read in bulk and parsed in place.  Messages to intercept
+ * are queued and written out together once per loop round; what the
+ * socket does not take waits for it to become writable, and the queue
+ * grows meanwhile, e.g. for the bursts of a connect.  A connection to
+ * a co-located intercept may get its responses through a shared ring
+ * instead, which has a tc_msg_conn_t of its own indexed by its eventfd.
+ */
+#define TC_MSG_BUF_SIZE  65536
+#define TC_MSG_OUT_SIZE  16384              /* a power of two */
+#define TC_MSG_OUT_MAX   (4 * 1024 * 1024)  /* the queue grows up to it */
+
+typedef struct {
+    u_char      *pos;                       /* first byte not parsed yet */
+    u_char      *last;                      /* end of the bytes read */
+    tc_event_t  *ev;
+    uint32_t     out_head;                  /* bytes queued */
+    uint32_t     out_tail;                  /* bytes written */
+    unsigned     blocked:1;                 /* waiting for writable */
+    unsigned     connecting:1;
+    int          peer;                      /* the ring or its connection */
+    tc_msg_shm_t *shm;
+
+    /* four tuple, seq and ack of the last compact record */
+    uint32_t     cm_saddr;
+    uint32_t     cm_daddr;
+    uint32_t     cm_seq;
+    uint32_t     cm_ack;
+    uint16_t     cm_source;
+    uint16_t     cm_dest;
+    u_char       start[TC_MSG_BUF_SIZE];
+
+    /* kept when the slot is reused */
+    u_char      *out;
+    uint32_t     out_size;                  /* a power of two */
+} tc_msg_conn_t;
+
+/* indexed by fd, a slot is reused by the connections getting its fd */
+static tc_msg_conn_t  *msg_conns[MAX_FD_NUM];
+
+/* messages were queued in this round */
+static tc_thread_local int  msg_queued;
+
 static int tc_proc_server_msg(tc_event_t *rev);
+static int tc_proc_server_writable(tc_event_t *wev);
+static int tc_parse_server_msgs(tc_msg_conn_t *b);
+static int tc_proc_compact_msg(tc_msg_conn_t *c, u_char *p, u_char *end);
+static int tc_flush_server_conn(tc_msg_conn_t *c);
+static int tc_grow_server_out(tc_msg_conn_t *c, size_t len);
+static void tc_close_server_conn(tc_event_t *rev);
+static void tc_server_connected(int fd);
+#if (TC_HAVE_EVENTFD)
+static int tc_proc_shm_msg(tc_event_t *rev);
+#endif
+
+#if (TC_THREADS)
+/* responses of sessions owned by other workers are passed on */
+#define tc_outgress(msg)                                                     \
+    (tc_worker_pass_resp(msg) || tc_proc_outgress(msg))
+#else
+#define tc_outgress(msg)  tc_proc_outgress(msg)
+#endif
 
 int
 tc_message_init(tc_event_loop_t *event_loop, uint32_t ip, uint16_t port)
 {
-    int            fd;
+    int            fd, ret, events;
     tc_event_t    *ev;
-    socklen_t      len;
-    struct timeval timeout = {3,0}; 
 
     if ((fd = tc_socket_init()) == TC_INVALID_SOCK) {
         return TC_INVALID_SOCK;
     }
 
-    if (tc_socket_connect(fd, ip, port) == TC_ERR) {
-        return TC_INVALID_SOCK;
-    }
-
     if (tc_socket_set_nodelay(fd) == TC_ERR) {
         return TC_INVALID_SOCK;
     }
 
+    /* connecting does not hold up the loop */
     if (tc_socket_set_nonblocking(fd) == TC_ERR) {
         return TC_INVALID_SOCK;
     }
 
-    len = (socklen_t) sizeof(struct timeval);
-    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, len);
+    if (clt_settings.busy_poll) {
+        tc_socket_set_busy_poll(fd, clt_settings.busy_poll);
+    }
+
+    tc_socket_set_keepalive(fd);
+
+    ret = tc_socket_connect(fd, ip, port);
+    if (ret == TC_ERR) {
+        return TC_INVALID_SOCK;
+    }
 
     /*
      * 创建事件
      * 抓取测试机返回的包头
     */
-    ev = tc_event_create(event_loop->pool, fd, tc_proc_server_msg, NULL);
+    ev = tc_event_create(event_loop->pool, fd, tc_proc_server_msg, 
+            tc_proc_server_writable);
     if (ev == NULL) {
         return TC_INVALID_SOCK;
     }
 
+    if (msg_conns[fd] == NULL) {
+        msg_conns[fd] = tc_alloc(sizeof(tc_msg_conn_t));
+        if (msg_conns[fd] == NULL) {
+            return TC_INVALID_SOCK;
+        }
+        msg_conns[fd]->out = NULL;
+    }
+    if (msg_conns[fd]->out == NULL) {
+        msg_conns[fd]->out = tc_alloc(TC_MSG_OUT_SIZE);
+        if (msg_conns[fd]->out == NULL) {
+            return TC_INVALID_SOCK;
+        }
+        msg_conns[fd]->out_size = TC_MSG_OUT_SIZE;
+    }
+    msg_conns[fd]->pos  = msg_conns[fd]->start;
+    msg_conns[fd]->last = msg_conns[fd]->start;
+    msg_conns[fd]->ev   = ev;
+    msg_conns[fd]->out_head = 0;
+    msg_conns[fd]->out_tail = 0;
+    msg_conns[fd]->blocked  = 0;
+    msg_conns[fd]->connecting = 0;
+    msg_conns[fd]->peer     = -1;
+    msg_conns[fd]->shm      = NULL;
+    msg_conns[fd]->cm_saddr = 0;
+    msg_conns[fd]->cm_daddr = 0;
+    msg_conns[fd]->cm_seq   = 0;
+    msg_conns[fd]->cm_ack   = 0;
+    msg_conns[fd]->cm_source = 0;
+    msg_conns[fd]->cm_dest   = 0;
+
+    event_loop->flush = tc_message_flush;
+
+    /* responses release session windows, so they go before capture */
+    ev->prio = TC_EVENT_PRIO_HIGH;
     clt_settings.ev[fd] = ev;
 
+    events = TC_EVENT_READ;
+    if (ret == TC_AGAIN) {
+        /* messages are queued until it is connected */
+        msg_conns[fd]->connecting = 1;
+        msg_conns[fd]->blocked = 1;
+        events |= TC_EVENT_WRITE;
+    }
+
     /*
      * 把事件添加到event_loop
     */
-    if (tc_event_add(event_loop, ev, TC_EVENT_READ) == TC_EVENT_ERROR) {
+    if (tc_event_add(event_loop, ev, events) == TC_EVENT_ERROR) {
         return TC_INVALID_SOCK;
     }
 
@@ -56,69 +163,843 @@ tc_message_init(tc_event_loop_t *event_loop, uint32_t ip, uint16_t port)
 static int
 tc_proc_server_msg(tc_event_t *rev)
 {
-    int            i, j;
-    conns_t       *conns;
-#if (!TC_COMBINED)
-    int            len;
-    msg_server_t   msg;
-#else
-    int            num, k;
-    unsigned char *p, resp[COMB_LENGTH + sizeof(uint16_t)];
+    int            n, ret, budget, avail;
+    size_t         room;
+    tc_msg_conn_t *b;
+
+    b = msg_conns[rev->fd];
+    budget = tc_event_budget(rev);
+    n = 0;
+
+    do {
+        /* only a partial message is left, move it to the start */
+        if (b->pos != b->start) {
+            memmove(b->start, b->pos, b->last - b->pos);
+            b->last = b->start + (b->last - b->pos);
+            b->pos  = b->start;
+        }
+
+        room = b->start + TC_MSG_BUF_SIZE - b->last;
+        ret  = tc_socket_recv(rev->fd, (char *) b->last, room);
+        if (ret == TC_ERR) {
+            tc_close_server_conn(rev);
+            return TC_ERR;
+        }
+        b->last += ret;
+
+        ret = tc_parse_server_msgs(b);
+        if (ret == TC_ERR) {
+            tc_close_server_conn(rev);
+            return TC_ERR;
+        }
+        n += ret;
+
+        /* a full buffer means there may be more on the socket */
+    } while ((size_t) (b->last - b->start) == TC_MSG_BUF_SIZE && n < budget);
+
+    if (n >= budget && ioctl(rev->fd, FIONREAD, &avail) == 0) {
+        /* epoll is level triggered, so the rest is read in the next round */
+        tc_event_backlog(rev, avail);
+    }
+
+    tc_event_consumed(rev, n);
+
+#if (TC_THREADS)
+    tc_workers_kick();
 #endif
 
+    return TC_OK;
+}
 
-#if (!TC_COMBINED)
-    len = MSG_SERVER_SIZE;
-    if (tc_socket_rcv(rev->fd, (char *) &msg, len) != TC_ERR)
+
+/* handles every complete message in place, returns their number */
+static int
+tc_parse_server_msgs(tc_msg_conn_t *b)
+{
+    int            n;
+#if (TC_COMBINED)
+    int            num, k, ret;
+    size_t         len;
+    uint16_t       hdr;
+    unsigned char *p, *end;
 #else
-    if (tc_socket_cmb_rcv(rev->fd, &num, (char *) resp) != TC_ERR)
+    int            ret;
 #endif
-    {
+
+    n = 0;
+
 #if (!TC_COMBINED)
-        tc_proc_outgress((unsigned char *) &msg);
+    while (b->pos < b->last) {
+        if (tc_cmsg_is_compact(b->pos)) {
+            ret = tc_proc_compact_msg(b, b->pos, b->last);
+            if (ret <= 0) {
+                if (ret < 0) {
+                    tc_log_info(LOG_WARN, 0, "malformed compact message");
+                    return TC_ERR;
+                }
+                break;
+            }
+            b->pos += ret;
+            n++;
+            continue;
+        }
+
+        if ((size_t) (b->last - b->pos) < MSG_SERVER_SIZE) {
+            break;
+        }
+
+        tc_outgress(b->pos);
+        b->pos += MSG_SERVER_SIZE;
+        n++;
+    }
 #else
+    while ((size_t) (b->last - b->pos) >= sizeof(uint16_t)) {
+        memcpy(&hdr, b->pos, sizeof(uint16_t));
+        hdr = ntohs(hdr);
+
+        if (hdr & TC_CMSG_BATCH) {
+            len = sizeof(uint16_t) + (hdr & ~TC_CMSG_BATCH);
+            if ((size_t) (b->last - b->pos) < len) {
+                break;
+            }
+
+            p   = b->pos + sizeof(uint16_t);
+            end = b->pos + len;
+            while (p < end) {
+                /* records never straddle batches */
+                ret = tc_proc_compact_msg(b, p, end);
+                if (ret <= 0) {
+                    tc_log_info(LOG_WARN, 0, "malformed compact batch");
+                    return TC_ERR;
+                }
+                p += ret;
+            }
+
+            b->pos += len;
+            n++;
+            continue;
+        }
+
+        num = (int) hdr;
+        if (num > COMB_MAX_NUM) {
+            tc_log_info(LOG_WARN, 0, "num:%d > threshold", num);
+            return TC_ERR;
+        }
+
+        len = sizeof(uint16_t) + num * MSG_SERVER_SIZE;
+        if ((size_t) (b->last - b->pos) < len) {
+            break;
+        }
+
         tc_log_debug1(LOG_DEBUG, 0, "resp packets:%d", num);
-        p = resp + sizeof(uint16_t);
+        p = b->pos + sizeof(uint16_t);
         for (k = 0; k < num; k++) {
-            tc_proc_outgress(p);
+            tc_outgress(p);
             p = p + MSG_SERVER_SIZE;
         }
+
+        b->pos += len;
+        n++;
+    }
 #endif
-        return TC_OK;
+
+    return n;
+}
+
+
+#define tc_cmsg_get(v)                                                       \
+    if ((n = tc_cmsg_varint(p, end, &v)) <= 0) {                             \
+        return n;                                                            \
+    }                                                                        \
+    p += n
+
+#define tc_cmsg_unzigzag(v)  ((v >> 1) ^ (~(v & 1) + 1))
+
+
+/*
+ * rebuilds the packet of a compact record and handles it, returns the
+ * length of the record, 0 if it is not complete or -1 if it is malformed
+ */
+static int
+tc_proc_compact_msg(tc_msg_conn_t *c, u_char *p, u_char *end)
+{
+    int            n, opt_len, need;
+    u_char        *start, *opt, tag, flags, doff, wscale;
+    uint16_t       source, dest;
+    uint32_t       saddr, daddr, seq, ack, window, len, tsval, tsecr, plen;
+    tc_iph_t      *ip;
+    tc_tcph_t     *tcp;
+    unsigned char  pack[MSG_SERVER_SIZE];
+
+    start = p;
+
+    if (end - p < 3) {
+        return 0;
+    }
+
+    tag   = p[0];
+    flags = p[1];
+    doff  = p[2];
+    p += 3;
+
+    if (doff < (TCPH_MIN_LEN >> 2) || doff > 15) {
+        return -1;
+    }
+
+    if (tag & TC_CMSG_SAME) {
+        saddr  = c->cm_saddr;
+        daddr  = c->cm_daddr;
+        source = c->cm_source;
+        dest   = c->cm_dest;
+        tc_cmsg_get(seq);
+        tc_cmsg_get(ack);
+        seq = c->cm_seq + tc_cmsg_unzigzag(seq);
+        ack = c->cm_ack + tc_cmsg_unzigzag(ack);
 
     } else {
+        if (end - p < 12) {
+            return 0;
+        }
+        memcpy(&saddr, p, sizeof(uint32_t));
+        memcpy(&daddr, p + 4, sizeof(uint32_t));
+        memcpy(&source, p + 8, sizeof(uint16_t));
+        memcpy(&dest, p + 10, sizeof(uint16_t));
+        p += 12;
+        tc_cmsg_get(seq);
+        tc_cmsg_get(ack);
+    }
+
+    tc_cmsg_get(window);
+    tc_cmsg_get(len);
+
+    tsval = 0;
+    tsecr = 0;
+    if (tag & TC_CMSG_TS) {
+        tc_cmsg_get(tsval);
+        tc_cmsg_get(tsecr);
+    }
+
+    wscale = 0;
+    if (tag & TC_CMSG_WS) {
+        if (p >= end) {
+            return 0;
+        }
+        wscale = *p++;
+    }
+
+    plen = 0;
+    if (tag & TC_CMSG_PAYLOAD) {
+        tc_cmsg_get(plen);
+        if ((uint32_t) (end - p) < plen) {
+            return 0;
+        }
+    }
+
+    /* the options kept have to fit into a msg_server_t */
+    opt_len = tc_min((doff << 2) - (int) TCPH_MIN_LEN, MAX_OPTION_LEN);
+    need = (tag & TC_CMSG_TS ? 12 : 0) + (tag & TC_CMSG_WS ? 4 : 0);
+    if (need > opt_len) {
+        return -1;
+    }
+
+    tc_memzero(pack, MSG_SERVER_SIZE);
+    ip  = (tc_iph_t *) pack;
+    tcp = (tc_tcph_t *) (pack + IPH_MIN_LEN);
+    opt = pack + IPH_MIN_LEN + TCPH_MIN_LEN;
+
+    ip->version  = 4;
+    ip->ihl      = IPH_MIN_LEN >> 2;
+    ip->protocol = IPPROTO_TCP;
+    ip->tot_len  = htons(IPH_MIN_LEN + TCPH_MIN_LEN + opt_len + len);
+    ip->saddr    = saddr;
+    ip->daddr    = daddr;
+
+    tcp->source  = source;
+    tcp->dest    = dest;
+    tcp->seq     = htonl(seq);
+    tcp->ack_seq = htonl(ack);
+    tcp->window  = htons((uint16_t) window);
+    tcp->doff    = (TCPH_MIN_LEN + opt_len) >> 2;
+    tcp->fin     = (flags & 0x01) != 0;
+    tcp->syn     = (flags & 0x02) != 0;
+    tcp->rst     = (flags & 0x04) != 0;
+    tcp->psh     = (flags & 0x08) != 0;
+    tcp->ack     = (flags & 0x10) != 0;
+    tcp->urg     = (flags & 0x20) != 0;
+
+    memset(opt, TCPOPT_NOP, opt_len);
+    if (tag & TC_CMSG_TS) {
+        opt[2] = TCPOPT_TIMESTAMP;
+        opt[3] = 10;
+        tsval = htonl(tsval);
+        tsecr = htonl(tsecr);
+        memcpy(opt + 4, &tsval, sizeof(uint32_t));
+        memcpy(opt + 8, &tsecr, sizeof(uint32_t));
+        opt += 12;
+    }
+
+    if (tag & TC_CMSG_WS) {
+        opt[1] = TCPOPT_WSCALE;
+        opt[2] = 3;
+        opt[3] = wscale;
+    }
+
+    if (plen) {
+        /* as much of the payload as a msg_server_t holds */
+        n = MSG_SERVER_SIZE - (IPH_MIN_LEN + TCPH_MIN_LEN + opt_len);
+        memcpy(pack + IPH_MIN_LEN + TCPH_MIN_LEN + opt_len, p, 
+                tc_min((int) plen, n));
+        p += plen;
+    }
+
+    c->cm_saddr  = saddr;
+    c->cm_daddr  = daddr;
+    c->cm_source = source;
+    c->cm_dest   = dest;
+    c->cm_seq    = seq;
+    c->cm_ack    = ack;
+
+    tc_outgress(pack);
+
+    return p - start;
+}
+
+
+static void
+tc_close_server_conn(tc_event_t *rev)
+{
+    int       i, j;
+    conns_t  *conns;
 
-        tc_log_info(LOG_ERR, 0, "Recv socket(%d)error", rev->fd);
-        for (i = 0; i < clt_settings.real_servers.num; i++) {
-
-            conns = &(clt_settings.real_servers.conns[i]);
-            for (j = 0; j < conns->num; j++) {
-                if (conns->fds[j] == rev->fd) {
-                    if (conns->fds[j] > 0) {
-                        tc_socket_close(conns->fds[j]);
-                        tc_log_info(LOG_NOTICE, 0, "close sock:%d", 
-                                conns->fds[j]);
-                        tc_event_del(rev->loop, rev, TC_EVENT_READ);
-                        conns->fds[j] = -1;
-                        conns->remained_num--;
-                    }
-                    if (conns->remained_num == 0 && conns[i].active) {
-                        conns[i].active = 0;
-                        clt_settings.real_servers.active_num--;
-                    }
-
-                    break;
+    tc_log_info(LOG_ERR, 0, "socket(%d) error", rev->fd);
+
+    tc_message_shm_close(rev->fd);
+
+    /* what was queued is lost with the connection */
+    msg_conns[rev->fd]->out_tail = msg_conns[rev->fd]->out_head;
+    msg_conns[rev->fd]->blocked = 0;
+    msg_conns[rev->fd]->connecting = 0;
+    for (i = 0; i < real_servers->num; i++) {
+
+        conns = &(real_servers->conns[i]);
+        for (j = 0; j < conns->num; j++) {
+            if (conns->fds[j] == rev->fd) {
+                if (conns->fds[j] > 0) {
+                    tc_socket_close(conns->fds[j]);
+                    tc_log_info(LOG_NOTICE, 0, "close sock:%d", 
+                            conns->fds[j]);
+                    tc_event_del(rev->loop, rev, rev->reg_evs);
+                    conns->fds[j] = -1;
+                    conns->remained_num--;
                 }
+                if (conns->remained_num == 0 && conns->active) {
+                    conns->active = 0;
+                    real_servers->active_num--;
+                } else if (conns->active) {
+                    /* its client slices move on with its sessions */
+                    tc_register_client_slices(conns, j);
+                }
+
+                break;
             }
         }
+    }
+
+    if (real_servers->active_num == 0) {
+        if (!clt_settings.lonely) {
+            tc_log_info(LOG_WARN, 0, "active num is zero");
+            tc_over = SIGRTMAX;
+        }
+    } 
+}
+
 
-        if (clt_settings.real_servers.active_num == 0) {
-            if (!clt_settings.lonely) {
-                tc_log_info(LOG_WARN, 0, "active num is zero");
-                tc_over = SIGRTMAX;
+/* the intercept on the other end is reachable, so it is retried early */
+static void
+tc_server_connected(int fd)
+{
+    int       i, j;
+    conns_t  *conns;
+
+    for (i = 0; i < real_servers->num; i++) {
+        conns = &(real_servers->conns[i]);
+        for (j = 0; j < conns->num; j++) {
+            if (conns->fds[j] == fd) {
+                conns->backoff = 0;
+                return;
             }
-        } 
+        }
+    }
+}
+
+
+#if (TC_HAVE_EVENTFD)
+
+/* asks a co-located intercept to write the responses of fd into a ring */
+int
+tc_message_shm_init(tc_event_loop_t *event_loop, int fd, char *path)
+{
+    int                 mfd, efd, fds[2];
+    char                name[] = "/dev/shm/tcpcopy.XXXXXX";
+    size_t              size;
+    socklen_t           len;
+    tc_event_t         *ev;
+    tc_msg_shm_t       *shm;
+    tc_msg_conn_t      *c;
+    struct sockaddr_in  addr;
+    tc_msg_shm_hello_t  hello;
+
+    size = sizeof(tc_msg_shm_t) + TC_MSG_SHM_SIZE;
+
+    len = (socklen_t) sizeof(addr);
+    if (getsockname(fd, (struct sockaddr *) &addr, &len) == -1) {
+        tc_log_info(LOG_ERR, errno, "getsockname fd:%d", fd);
+        return TC_ERR;
+    }
+
+    /* only the descriptor names the ring */
+    mfd = mkstemp(name);
+    if (mfd == -1) {
+        tc_log_info(LOG_ERR, errno, "mkstemp %s failed", name);
+        return TC_ERR;
+    }
+    unlink(name);
+
+    shm = MAP_FAILED;
+    if (ftruncate(mfd, size) == 0) {
+        shm = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, mfd, 0);
+    }
+
+    if (shm == MAP_FAILED) {
+        tc_log_info(LOG_ERR, errno, "map response ring failed");
+        close(mfd);
+        return TC_ERR;
+    }
+
+    shm->magic = TC_MSG_SHM_MAGIC;
+    shm->size  = TC_MSG_SHM_SIZE;
+
+    efd = eventfd(0, EFD_NONBLOCK);
+    if (efd == -1 || efd > MAX_FD_VALUE) {
+        tc_log_info(LOG_ERR, errno, "eventfd failed");
+        goto failed;
+    }
+
+    hello.magic    = htonl(TC_MSG_SHM_MAGIC);
+    hello.size     = htonl((uint32_t) size);
+    hello.port     = addr.sin_port;
+    hello.reserved = 0;
+
+    fds[0] = mfd;
+    fds[1] = efd;
+    if (tc_socket_send_fds(path, &hello, sizeof(hello), fds, 2) == TC_ERR) {
+        goto failed;
+    }
+
+    /* the mapping stays after the descriptor is closed */
+    close(mfd);
+    mfd = -1;
+
+    ev = tc_event_create(event_loop->pool, efd, tc_proc_shm_msg, NULL);
+    if (ev == NULL) {
+        goto failed;
+    }
+
+    if (msg_conns[efd] == NULL) {
+        msg_conns[efd] = tc_alloc(sizeof(tc_msg_conn_t));
+        if (msg_conns[efd] == NULL) {
+            goto failed;
+        }
+        msg_conns[efd]->out = NULL;
+    }
+
+    c = msg_conns[efd];
+    tc_memzero(c, offsetof(tc_msg_conn_t, start));
+    c->pos  = c->start;
+    c->last = c->start;
+    c->ev   = ev;
+    c->peer = fd;
+    c->shm  = shm;
+    msg_conns[fd]->peer = efd;
+
+    ev->prio = TC_EVENT_PRIO_HIGH;
+    clt_settings.ev[efd] = ev;
+
+    if (tc_event_add(event_loop, ev, TC_EVENT_READ) == TC_EVENT_ERROR) {
+        tc_message_shm_close(fd);
+        return TC_ERR;
+    }
+
+    tc_log_info(LOG_NOTICE, 0, "responses of fd:%d come through %s", 
+            fd, path);
+
+    return TC_OK;
+
+failed:
+
+    if (efd != -1) {
+        close(efd);
+    }
+    if (mfd != -1) {
+        close(mfd);
+    }
+    munmap(shm, size);
+
+    return TC_ERR;
+}
+
+
+static int
+tc_proc_shm_msg(tc_event_t *rev)
+{
+    int             n, ret, budget;
+    size_t          room, len;
+    uint64_t        head, tail, pos, cnt;
+    tc_msg_shm_t   *shm;
+    tc_msg_conn_t  *b;
+
+    b = msg_conns[rev->fd];
+    if (b->ev != rev || b->shm == NULL) {
+        /* the ring went away with its connection in this round */
         return TC_OK;
     }
+
+    shm = b->shm;
+    budget = tc_event_budget(rev);
+    n = 0;
+
+    /* reset before draining, so that later kicks are not lost */
+    if (read(rev->fd, &cnt, sizeof(cnt)) == -1 && errno != EAGAIN) {
+        tc_log_info(LOG_ERR, errno, "read eventfd:%d", rev->fd);
+    }
+
+    tail = shm->tail;
+
+    for ( ;; ) {
+        head = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE);
+        if (head == tail || n >= budget) {
+            break;
+        }
+
+        if (head - tail > TC_MSG_SHM_SIZE) {
+            tc_log_info(LOG_WARN, 0, "broken response ring:%d", rev->fd);
+            tc_close_server_conn(msg_conns[b->peer]->ev);
+            return TC_ERR;
+        }
+
+        if (b->pos != b->start) {
+            memmove(b->start, b->pos, b->last - b->pos);
+            b->last = b->start + (b->last - b->pos);
+            b->pos  = b->start;
+        }
+
+        pos  = tail & (TC_MSG_SHM_SIZE - 1);
+        room = b->start + TC_MSG_BUF_SIZE - b->last;
+        len  = tc_min(head - tail, TC_MSG_SHM_SIZE - pos);
+        len  = tc_min(len, room);
+
+        memcpy(b->last, (u_char *) (shm + 1) + pos, len);
+        b->last += len;
+        tail += len;
+        __atomic_store_n(&shm->tail, tail, __ATOMIC_RELEASE);
+
+        ret = tc_parse_server_msgs(b);
+        if (ret == TC_ERR 
+                || (ret == 0 && b->last == b->start + TC_MSG_BUF_SIZE))
+        {
+            tc_close_server_conn(msg_conns[b->peer]->ev);
+            return TC_ERR;
+        }
+        n += ret;
+    }
+
+    if (head != tail) {
+        /* kick ourselves, the rest is done in the next round */
+        cnt = 1;
+        if (write(rev->fd, &cnt, sizeof(cnt)) == -1) {
+            tc_log_info(LOG_ERR, errno, "write eventfd:%d", rev->fd);
+        }
+        tc_event_backlog(rev, (int) tc_min(head - tail, INT_MAX));
+    }
+
+    tc_event_consumed(rev, n);
+
+#if (TC_THREADS)
+    tc_workers_kick();
+#endif
+
+    return TC_OK;
+}
+
+
+/* releases the response ring of the connection on fd if it has one */
+void
+tc_message_shm_close(int fd)
+{
+    int             efd;
+    tc_msg_conn_t  *c;
+
+    if (msg_conns[fd] == NULL || msg_conns[fd]->peer == -1) {
+        return;
+    }
+
+    efd = msg_conns[fd]->peer;
+    c = msg_conns[efd];
+
+    /* it may be waiting in the active list, so it goes away later */
+    tc_event_del(c->ev->loop, c->ev, c->ev->reg_evs);
+    tc_event_destroy(c->ev, 1);
+    clt_settings.ev[efd] = NULL;
+    close(efd);
+    munmap(c->shm, sizeof(tc_msg_shm_t) + TC_MSG_SHM_SIZE);
+
+    c->shm  = NULL;
+    c->peer = -1;
+    msg_conns[fd]->peer = -1;
+}
+
+#else
+
+int
+tc_message_shm_init(tc_event_loop_t *event_loop, int fd, char *path)
+{
+    tc_log_info(LOG_WARN, 0, "no eventfd, responses of fd:%d come over tcp",
+            fd);
+    return TC_ERR;
+}
+
+
+void
+tc_message_shm_close(int fd)
+{
 }
 
+#endif
+
+
+/*
+ * queues a message to intercept, it is sent when the round ends; returns
+ * TC_AGAIN if the message was dropped because the queue is at its limit
+ * and TC_ERR only if the connection failed
+ */
+int
+tc_message_send(int fd, void *msg, size_t len)
+{
+    uint32_t        pos, n;
+    tc_msg_conn_t  *c;
+
+    c = msg_conns[fd];
+
+    if (c->out_size - (c->out_head - c->out_tail) < len) {
+        if (tc_flush_server_conn(c) == TC_ERR) {
+            return TC_ERR;
+        }
+
+        if (c->out_size - (c->out_head - c->out_tail) < len
+                && tc_grow_server_out(c, len) != TC_OK)
+        {
+            tc_log_info(LOG_WARN, 0, "fd:%d, intercept is too slow", fd);
+            return TC_AGAIN;
+        }
+    }
+
+    pos = c->out_head & (c->out_size - 1);
+    n = c->out_size - pos;
+    if (n >= len) {
+        memcpy(c->out + pos, msg, len);
+    } else {
+        memcpy(c->out + pos, msg, n);
+        memcpy(c->out, (u_char *) msg + n, len - n);
+    }
+
+    c->out_head += len;
+    msg_queued = 1;
+
+    return TC_OK;
+}
+
+
+/* doubles the queue until len more bytes fit, up to TC_MSG_OUT_MAX */
+static int
+tc_grow_server_out(tc_msg_conn_t *c, size_t len)
+{
+    u_char    *out;
+    uint32_t   size, used, pos, n;
+
+    used = c->out_head - c->out_tail;
+
+    for (size = c->out_size; size - used < len; size <<= 1) {
+        if (size >= TC_MSG_OUT_MAX) {
+            return TC_ERR;
+        }
+    }
+
+    out = tc_alloc(size);
+    if (out == NULL) {
+        return TC_ERR;
+    }
+
+    /* the queued bytes start the new queue */
+    pos = c->out_tail & (c->out_size - 1);
+    n = tc_min(used, c->out_size - pos);
+    memcpy(out, c->out + pos, n);
+    memcpy(out + n, c->out, used - n);
+
+    tc_free(c->out);
+    c->out      = out;
+    c->out_size = size;
+    c->out_tail = 0;
+    c->out_head = used;
+
+    tc_log_info(LOG_NOTICE, 0, "fd:%d, message queue grows to %u", 
+            c->ev->fd, size);
+
+    return TC_OK;
+}
+
+
+/* writes out the queued bytes, returns TC_ERR if the socket failed */
+static int
+tc_flush_server_conn(tc_msg_conn_t *c)
+{
+    int           cnt;
+    ssize_t       n;
+    uint32_t      pos, used;
+    struct iovec  iov[2];
+
+    used = c->out_head - c->out_tail;
+    if (used == 0 || c->connecting) {
+        return TC_OK;
+    }
+
+    pos = c->out_tail & (c->out_size - 1);
+    iov[0].iov_base = c->out + pos;
+    iov[0].iov_len  = tc_min(used, c->out_size - pos);
+    iov[1].iov_base = c->out;
+    iov[1].iov_len  = used - iov[0].iov_len;
+    cnt = iov[1].iov_len ? 2 : 1;
+
+    do {
+        n = writev(c->ev->fd, iov, cnt);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            tc_log_info(LOG_ERR, errno, "writev fd:%d", c->ev->fd);
+            return TC_ERR;
+        }
+        n = 0;
+    }
+
+    c->out_tail += n;
+
+    if (c->out_head != c->out_tail) {
+        if (!c->blocked) {
+            if (tc_event_add(c->ev->loop, c->ev, TC_EVENT_WRITE) 
+                    == TC_EVENT_ERROR)
+            {
+                return TC_ERR;
+            }
+            c->blocked = 1;
+        }
+
+    } else if (c->blocked) {
+        tc_event_del(c->ev->loop, c->ev, TC_EVENT_WRITE);
+        c->blocked = 0;
+    }
+
+    return TC_OK;
+}
+
+
+static int
+tc_proc_server_writable(tc_event_t *wev)
+{
+    int             err;
+    socklen_t       len;
+    tc_msg_conn_t  *c;
+
+    c = msg_conns[wev->fd];
+
+    if (c->connecting) {
+        err = 0;
+        len = (socklen_t) sizeof(err);
+        if (getsockopt(wev->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+            err = errno;
+        }
+
+        if (err) {
+            tc_log_info(LOG_ERR, err, "connect to intercept failed, fd:%d",
+                    wev->fd);
+            tc_close_server_conn(wev);
+            return TC_ERR;
+        }
+
+        c->connecting = 0;
+        tc_log_info(LOG_NOTICE, 0, "connected to intercept, fd:%d", wev->fd);
+        tc_server_connected(wev->fd);
+    }
+
+    if (tc_flush_server_conn(c) == TC_ERR) {
+        tc_close_server_conn(wev);
+        return TC_ERR;
+    }
+
+    return TC_OK;
+}
+
+
+/* the loop calls it at the end of every round */
+void
+tc_message_flush(tc_event_loop_t *loop)
+{
+    int             i, j, fd;
+    conns_t        *conns;
+    tc_msg_conn_t  *c;
+
+    if (!msg_queued) {
+        return;
+    }
+    msg_queued = 0;
+
+    for (i = 0; i < real_servers->num; i++) {
+        conns = &(real_servers->conns[i]);
+        for (j = 0; j < conns->num; j++) {
+            fd = conns->fds[j];
+            if (fd <= 0) {
+                continue;
+            }
+
+            /* blocked ones are flushed when they become writable */
+            c = msg_conns[fd];
+            if (c->blocked || c->out_head == c->out_tail) {
+                continue;
+            }
+
+            if (tc_flush_server_conn(c) == TC_ERR) {
+                tc_close_server_conn(c->ev);
+            }
+        }
+    }
+}
+
+
+void
+tc_message_release(void)
+{
+    int i;
+
+    for (i = 0; i < MAX_FD_NUM; i++) {
+        if (msg_conns[i] != NULL) {
+            if (msg_conns[i]->shm != NULL) {
+                munmap(msg_conns[i]->shm, 
+                        sizeof(tc_msg_shm_t) + TC_MSG_SHM_SIZE);
+            }
+            if (msg_conns[i]->out != NULL) {
+                tc_free(msg_conns[i]->out);
+            }
+            tc_free(msg_conns[i]);
+            msg_conns[i] = NULL;
+        }
+    }
+}
@@ -5,5 +5,10 @@
 #include <tcpcopy.h>
 
 int tc_message_init(tc_event_loop_t *event_loop, uint32_t ip, uint16_t port);
+int tc_message_shm_init(tc_event_loop_t *event_loop, int fd, char *path);
+void tc_message_shm_close(int fd);
+int tc_message_send(int fd, void *msg, size_t len);
+void tc_message_flush(tc_event_loop_t *loop);
+void tc_message_release(void);
 
 #endif
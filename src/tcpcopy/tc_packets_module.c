@@ -12,7 +12,48 @@ static struct timeval first_pack_time, last_v_pack_time,
 static void proc_offline_pack(tc_event_timer_t *);
 static bool check_read_stop();
 static void send_packets_from_pcap(int);
+static void send_packets_from_reader(void);
 static uint64_t timeval_diff(struct timeval *, struct timeval *);
+
+/* a pass or copy of a pcap file shifts the client ports by this */
+#define TC_PASS_PORT_STEP  2053
+
+static uint32_t       pass_cur;
+static uint64_t       pass_packs, pass_valid;
+static time_t         pass_start, pass_last;
+
+static void tc_offline_dispose(tc_pcap_pkt_t *, int *);
+
+/* 
+ * the closed loop replay reads on while this many sessions wait for a
+ * slot at most, so that the sessions in flight get their later packets
+ */
+#define TC_LOOP_PARKED   4096
+#define TC_LOOP_WAIT     1000000           /* ns */
+
+static long           loop_start, loop_end;      /* ms */
+
+static bool tc_offline_loop_full(void);
+
+#if (TC_HAVE_TIMERFD)
+/* 
+ * every packet is sent at its own time: the timer wakes the loop a bit
+ * before and the rest is spun away
+ */
+#define TC_PACE_SPIN     50000             /* ns */
+#define TC_PACE_BATCH    1024
+#define TC_PACE_BUCKETS  32
+
+static int            pace_fd = -1;
+static bool           pace_started, pace_pending;
+static uint64_t       pace_base, pace_first_us, pace_last_us, pace_skipped,
+                      pace_due, pace_pps_due;
+static uint64_t       pace_cnt, pace_sum, pace_max, 
+                      pace_hist[TC_PACE_BUCKETS];
+
+static int tc_offline_pace_init(tc_event_loop_t *);
+static int proc_offline_pace(tc_event_t *);
+#endif
 #endif
 
 #if (TC_PCAP)
@@ -22,6 +63,20 @@ static int proc_pcap_pack(tc_event_t *);
 static int proc_raw_pack(tc_event_t *);
 #endif
 static int dispose_packet(unsigned char *, int, int *);
+static int replay_packet(unsigned char *, int, bool *);
+#if (!TC_OFFLINE)
+static int agent_retrieve(unsigned char *, int);
+static int delay_retrieve(unsigned char *, int);
+#endif
+
+#if (TC_THREADS)
+/* with replay workers packets go to the worker owning the session */
+#define tc_ingress(ip, tcp, orig)                                            \
+    (clt_settings.workers ? tc_worker_dispatch(ip, tcp, orig)                \
+                          : tc_proc_ingress(ip, tcp))
+#else
+#define tc_ingress(ip, tcp, orig)  tc_proc_ingress(ip, tcp)
+#endif
 
 
 #if (TC_PCAP)
@@ -40,6 +95,10 @@ device_set(tc_event_loop_t *event_loop, device_t *device)
 
     pcap_map[fd] = device->pcap;
 
+    if (clt_settings.busy_poll) {
+        tc_socket_set_busy_poll(fd, clt_settings.busy_poll);
+    }
+
     ev = tc_event_create(event_loop->pool, fd, proc_pcap_pack, NULL);
     if (ev == NULL) {
         return TC_ERR;
@@ -55,10 +114,37 @@ device_set(tc_event_loop_t *event_loop, device_t *device)
 #endif
 
 
+int
+tc_packets_output_init(void)
+{
+#if (!TC_PCAP_SND)
+    int  fd;
+
+    /*
+     * 该raw socket 用来发送请求给测试机
+    */
+    /* init the raw socket to send packets */
+    if ((fd = tc_raw_socket_out_init()) == TC_INVALID_SOCK) {
+        return TC_ERR;
+    } else {
+        tc_raw_socket_out = fd;
+    }
+#else
+    if (tc_pcap_snd_init(clt_settings.output_if_name, clt_settings.mtu) !=
+            TC_OK) 
+    {
+        return TC_ERR;
+    }
+#endif
+
+    return TC_OK;
+}
+
+
 int
 tc_packets_init(tc_event_loop_t *event_loop)
 {
-#if (!TC_PCAP_SND || !TC_PCAP)
+#if (!TC_PCAP)
     int         fd;
 #endif
 #if (TC_PCAP)
@@ -71,22 +157,29 @@ tc_packets_init(tc_event_loop_t *event_loop)
     tc_event_t *ev;
 #endif
 
-#if (!TC_PCAP_SND)
-    /*
-     * 该raw socket 用来发送请求给测试机
-    */
-    /* init the raw socket to send packets */
-    if ((fd = tc_raw_socket_out_init()) == TC_INVALID_SOCK) {
+#if (TC_THREADS)
+    /* replay workers send on their own sockets */
+    if (!clt_settings.workers)
+#endif
+#if (!TC_OFFLINE)
+    /* an agent sends nothing itself */
+    if (!clt_settings.agent_port)
+#endif
+    if (tc_packets_output_init() != TC_OK) {
         return TC_ERR;
-    } else {
-        tc_raw_socket_out = fd;
     }
-#else
-    if (tc_pcap_snd_init(clt_settings.output_if_name, clt_settings.mtu) !=
-            TC_OK) 
+
+#if (!TC_OFFLINE)
+    if (clt_settings.delay 
+            && tc_delay_init(event_loop, delay_retrieve) != TC_OK) 
     {
         return TC_ERR;
     }
+
+    if (clt_settings.agent_listen_port) {
+        /* the packets come from the agents */
+        return tc_agent_listen(event_loop, agent_retrieve);
+    }
 #endif
 
 #if (TC_PCAP)
@@ -145,6 +238,10 @@ tc_packets_init(tc_event_loop_t *event_loop)
     }
     tc_socket_set_nonblocking(fd);
 
+    if (clt_settings.busy_poll) {
+        tc_socket_set_busy_poll(fd, clt_settings.busy_poll);
+    }
+
     ev = tc_event_create(event_loop->pool, fd, proc_raw_pack, NULL);
     if (ev == NULL) {
         return TC_ERR;
@@ -208,10 +305,18 @@ pcap_retrieve(unsigned char *args, const struct pcap_pkthdr *pkt_hdr,
 static int
 proc_pcap_pack(tc_event_t *rev)
 {
+    int     n;
     pcap_t *pcap;
 
     pcap = pcap_map[rev->fd];
-    pcap_dispatch(pcap, 10, (pcap_handler) pcap_retrieve, (u_char *) pcap);
+    n = pcap_dispatch(pcap, tc_event_budget(rev), 
+            (pcap_handler) pcap_retrieve, (u_char *) pcap);
+    if (n > 0) {
+        tc_event_consumed(rev, n);
+    }
+#if (TC_THREADS)
+    tc_workers_kick();
+#endif
 
     return TC_OK;
 }
@@ -223,18 +328,23 @@ static unsigned char pack_buffer1[IP_RCV_BUF_SIZE];
 static int 
 proc_raw_pack(tc_event_t *rev)
 {
-    int            recv_len;
+    int            n, budget, recv_len, queued;
     unsigned char *packet;
 
     packet = pack_buffer1;
+    budget = tc_event_budget(rev);
 
-    for ( ;; ) {
+    /* 
+     * stop after budget packets, the socket is still readable then and
+     * the rest is read in the next round after responses and timers
+     */
+    for (n = 0; n < budget; n++) {
 
         recv_len = recvfrom(rev->fd, packet, IP_RCV_BUF_SIZE, 0, NULL, NULL);
 
         if (recv_len == -1) {
             if (errno == EAGAIN) {
-                return TC_OK;
+                break;
             }
 
             tc_log_info(LOG_ERR, errno, "recvfrom");
@@ -254,11 +364,61 @@ proc_raw_pack(tc_event_t *rev)
         }
     }
 
+    tc_event_consumed(rev, n);
+
+    if (n == budget) {
+        /* what is left waits in the socket, where it may overflow */
+        queued = tc_socket_rcv_queued(rev->fd);
+        if (queued >= 0) {
+            tc_event_backlog(rev, queued);
+        }
+    }
+#if (TC_THREADS)
+    tc_workers_kick();
+#endif
+
     return TC_OK;
 }
 #endif
 
 
+#if (!TC_OFFLINE)
+/* packets the agents captured and selected are replayed as if captured */
+static int
+agent_retrieve(unsigned char *packet, int len)
+{
+    return dispose_packet(packet, len, NULL);
+}
+
+
+/* packets of the delay line were selected when they were captured */
+static int
+delay_retrieve(unsigned char *packet, int len)
+{
+    bool       packet_valid;
+#if (!TC_UDP)
+    tc_iph_t  *ip;
+    tc_tcph_t *tcp;
+
+    ip  = (tc_iph_t *) packet;
+    tcp = (tc_tcph_t *) (packet + (ip->ihl << 2));
+
+    /* but pure acks only against the sessions of now */
+#if (TC_THREADS)
+    if (!clt_settings.workers)
+#endif
+    if (!tcp->syn && ntohs(ip->tot_len) == (ip->ihl << 2) + (tcp->doff << 2)
+            && !tc_check_ingress_ack_needed(ip, tcp))
+    {
+        return TC_OK;
+    }
+#endif
+
+    return replay_packet(packet, len, &packet_valid);
+}
+#endif
+
+
 #if (TC_UDP)
 static void
 replicate_packs(tc_iph_t *ip, tc_udpt_t *udp_header, int replica_num)
@@ -288,39 +448,63 @@ replicate_packs(tc_iph_t *ip, tc_udpt_t *udp_header, int replica_num)
 }
 
 
+/* replays a packet tc_check_ingress_pack_needed has let through */
 static int
-dispose_packet(unsigned char *packet, int ip_rcv_len, int *p_valid_flag)
+replay_packet(unsigned char *packet, int ip_rcv_len, bool *packet_valid)
 {
     int        replica_num;
-    bool       packet_valid;
     uint16_t   size_ip, online_port;
     uint32_t   online_ip;
     tc_iph_t  *ip;
     tc_udpt_t *udp_header;
 
-    if (p_valid_flag) {
-        packet_valid = false;
+    replica_num = clt_settings.replica_num;
+    ip          = (tc_iph_t *) packet;
+
+    size_ip     = ip->ihl << 2;
+    udp_header  = (tc_udpt_t *) ((char *) ip + size_ip);
+
+    online_ip   = ip->daddr;
+    online_port = udp_header->dest;
+
+    *packet_valid = tc_proc_ingress(ip, udp_header);
+    
+    ip->daddr = online_ip;
+    udp_header->dest = online_port;
+    if (replica_num > 1) {
+        replicate_packs(ip, udp_header, replica_num);
     }
 
-    ip = (tc_iph_t *) packet;
-    if (tc_check_ingress_pack_needed(ip)) {
+    return TC_OK;
+}
 
-        replica_num = clt_settings.replica_num;
-        ip   = (tc_iph_t *) packet;
 
-        size_ip     = ip->ihl << 2;
-        udp_header  = (tc_udpt_t *) ((char *) ip + size_ip);
+static int
+dispose_packet(unsigned char *packet, int ip_rcv_len, int *p_valid_flag)
+{
+    bool       packet_valid;
 
-        online_ip   = ip->daddr;
-        online_port = udp_header->dest;
+    /* it is told even if the packet goes no further */
+    if (p_valid_flag) {
+        *p_valid_flag = 0;
+    }
 
-        packet_valid = tc_proc_ingress(ip, udp_header);
-        
-        ip->daddr = online_ip;
-        udp_header->dest = online_port;
-        if (replica_num > 1) {
-            replicate_packs(ip, udp_header, replica_num);
+#if (!TC_OFFLINE)
+    if (clt_settings.agent_port) {
+        return tc_agent_forward(packet, ip_rcv_len);
+    }
+#endif
+
+    packet_valid = false;
+
+    if (tc_check_ingress_pack_needed((tc_iph_t *) packet)) {
+#if (!TC_OFFLINE)
+        if (clt_settings.delay) {
+            /* it is replayed once its delay is over */
+            return tc_delay_append(packet, ip_rcv_len);
         }
+#endif
+        replay_packet(packet, ip_rcv_len, &packet_valid);
     } 
 
     if (p_valid_flag) {
@@ -351,103 +535,131 @@ replicate_packs(tc_iph_t *ip, tc_tcph_t *tcp, int replica_num)
             tf_key = get_ip_key((ip->saddr << 1) + addition);
             ip->saddr = get_tf_ip(tf_key);
         }
-        tc_proc_ingress(ip, tcp);
+        tc_ingress(ip, tcp, false);
     }
 }
 
 
 static unsigned char pack_buffer2[IP_RCV_BUF_SIZE];
 
+/* replays a packet tc_check_ingress_pack_needed has let through */
 static int
-dispose_packet(unsigned char *packet, int ip_rcv_len, int *p_valid_flag)
+replay_packet(unsigned char *packet, int ip_rcv_len, bool *packet_valid)
 {
     int        replica_num, i, last, packet_num, max_payload,
                index, payload_len;
     char      *p;
-    bool       packet_valid;
     uint16_t   id, size_ip, size_tcp, tot_len, cont_len, 
                pack_len, head_len;
     uint32_t   seq;
     tc_iph_t  *ip;
     tc_tcph_t *tcp;
 
-    if (p_valid_flag) {
-        packet_valid = false;
-    }
-
-    /*
-     * 只处理关心的数据包
-    */
-    ip   = (tc_iph_t *) packet;
-    if (tc_check_ingress_pack_needed(ip)) {
+    ip          = (tc_iph_t *) packet;
+    replica_num = clt_settings.replica_num;
+    size_ip     = ip->ihl << 2;
+    tcp  = (tc_tcph_t *) ((char *) ip + size_ip);
 
-        replica_num = clt_settings.replica_num;
-        size_ip     = ip->ihl << 2;
-        tcp  = (tc_tcph_t *) ((char *) ip + size_ip);
-
-        if (ip_rcv_len <= clt_settings.mtu) {
+    if (ip_rcv_len <= clt_settings.mtu) {
+        /*
+         * 抓取的请求长度 <= MTU
+        */
+        *packet_valid = tc_ingress(ip, tcp, true);
+        if (replica_num > 1) {
             /*
-             * 抓取的请求长度 <= MTU
+             * 复制到其他测试机
             */
-            packet_valid = tc_proc_ingress(ip, tcp);
+            replicate_packs(ip, tcp, replica_num);
+        }
+
+    } else {
+
+        /*
+         * 分片处理
+        */
+        tot_len     = ntohs(ip -> tot_len);
+        if (tot_len != ip_rcv_len) {
+            tc_log_info(LOG_WARN, 0, "packet len:%u, recv len:%u",
+                        tot_len, ip_rcv_len);
+            return TC_ERR;
+        }
+
+        size_tcp    = tcp->doff << 2;
+        cont_len    = tot_len - size_tcp - size_ip;
+        head_len    = size_ip + size_tcp;
+        max_payload = clt_settings.mtu - head_len;
+        packet_num  = (cont_len + max_payload - 1) / max_payload;
+        seq         = ntohl(tcp->seq);
+        last        = packet_num - 1;
+        id          = ip->id;
+
+#if (TC_DEBUG)
+        tc_log_trace(LOG_NOTICE, 0, TC_CLT, ip, tcp);
+#endif
+        tc_log_debug1(LOG_DEBUG, 0, "recv:%d, more than MTU", ip_rcv_len);
+        index = head_len;
+
+        pack_len = 0;
+        for (i = 0 ; i < packet_num; i++) {
+            tcp->seq = htonl(seq);
+            if (i != last) {
+                pack_len  = clt_settings.mtu;
+            } else {
+                pack_len += (cont_len - packet_num * max_payload);
+            }
+            payload_len = pack_len - head_len;
+            ip->tot_len = htons(pack_len);
+            ip->id = id++;
+            p = (char *) pack_buffer2;
+            /* copy header here */
+            memcpy(p, (char *) packet, head_len);
+            /* copy payload here */
+            memcpy(p + head_len, (char *) (packet + index), payload_len);
+            index = index + payload_len;
+            *packet_valid = tc_ingress((tc_iph_t *) p, 
+                    (tc_tcph_t *) (p + size_ip), true);
             if (replica_num > 1) {
-                /*
-                 * 复制到其他测试机
-                */
-                replicate_packs(ip, tcp, replica_num);
+                replicate_packs((tc_iph_t *) p, (tc_tcph_t *) (p + size_ip), replica_num);
             }
 
-        } else {
+            seq = seq + payload_len;
+        }
+    }
 
-            /*
-             * 分片处理
-            */
-            tot_len     = ntohs(ip -> tot_len);
-            if (tot_len != ip_rcv_len) {
-                tc_log_info(LOG_WARN, 0, "packet len:%u, recv len:%u",
-                            tot_len, ip_rcv_len);
-                return TC_ERR;
-            }
+    return TC_OK;
+}
 
-            size_tcp    = tcp->doff << 2;
-            cont_len    = tot_len - size_tcp - size_ip;
-            head_len    = size_ip + size_tcp;
-            max_payload = clt_settings.mtu - head_len;
-            packet_num  = (cont_len + max_payload - 1) / max_payload;
-            seq         = ntohl(tcp->seq);
-            last        = packet_num - 1;
-            id          = ip->id;
 
-#if (TC_DEBUG)
-            tc_log_trace(LOG_NOTICE, 0, TC_CLT, ip, tcp);
+static int
+dispose_packet(unsigned char *packet, int ip_rcv_len, int *p_valid_flag)
+{
+    bool       packet_valid;
+
+    /* it is told even if the packet goes no further */
+    if (p_valid_flag) {
+        *p_valid_flag = 0;
+    }
+
+#if (!TC_OFFLINE)
+    if (clt_settings.agent_port) {
+        return tc_agent_forward(packet, ip_rcv_len);
+    }
 #endif
-            tc_log_debug1(LOG_DEBUG, 0, "recv:%d, more than MTU", ip_rcv_len);
-            index = head_len;
 
-            pack_len = 0;
-            for (i = 0 ; i < packet_num; i++) {
-                tcp->seq = htonl(seq);
-                if (i != last) {
-                    pack_len  = clt_settings.mtu;
-                } else {
-                    pack_len += (cont_len - packet_num * max_payload);
-                }
-                payload_len = pack_len - head_len;
-                ip->tot_len = htons(pack_len);
-                ip->id = id++;
-                p = (char *) pack_buffer2;
-                /* copy header here */
-                memcpy(p, (char *) packet, head_len);
-                /* copy payload here */
-                memcpy(p + head_len, (char *) (packet + index), payload_len);
-                index = index + payload_len;
-                packet_valid = tc_proc_ingress((tc_iph_t *) p, (tc_tcph_t *) (p + size_ip));
-                if (replica_num > 1) {
-                    replicate_packs((tc_iph_t *) p, (tc_tcph_t *) (p + size_ip), replica_num);
-                }
+    packet_valid = false;
 
-                seq = seq + payload_len;
-            }
+    /*
+     * 只处理关心的数据包
+    */
+    if (tc_check_ingress_pack_needed((tc_iph_t *) packet)) {
+#if (!TC_OFFLINE)
+        if (clt_settings.delay) {
+            /* it is replayed once its delay is over */
+            return tc_delay_append(packet, ip_rcv_len);
+        }
+#endif
+        if (replay_packet(packet, ip_rcv_len, &packet_valid) == TC_ERR) {
+            return TC_ERR;
         }
     }
 
@@ -464,36 +676,64 @@ dispose_packet(unsigned char *packet, int ip_rcv_len, int *p_valid_flag)
 int
 tc_offline_init(tc_event_loop_t *event_loop, char *pcap_file)
 {
-#if (!TC_PCAP_SND)
-    int  fd;
-#endif
     char ebuf[PCAP_ERRBUF_SIZE];
 
-#if (!TC_PCAP_SND)
-    /* init the raw socket to send */
-    if ((fd = tc_raw_socket_out_init()) == TC_INVALID_SOCK) {
+#if (TC_THREADS)
+    /* replay workers send on their own sockets */
+    if (!clt_settings.workers)
+#endif
+    if (tc_packets_output_init() != TC_OK) {
         return TC_ERR;
-    } else {
-        tc_raw_socket_out = fd;
     }
-#else
-    tc_pcap_snd_init(clt_settings.output_if_name, clt_settings.mtu);
-#endif
 
     if (pcap_file == NULL) {
         return TC_ERR;
     }
 
-    if ((clt_settings.pcap = pcap_open_offline(pcap_file, ebuf)) == NULL) {
+    /* libpcap is left for the formats the read-ahead reader lacks */
+    clt_settings.pcap_reader = tc_pcap_reader_open(clt_settings.pcap_files,
+            clt_settings.pcap_file_num);
+
+    if (clt_settings.pcap_reader == NULL && clt_settings.pcap_file_num > 1) {
+        fprintf(stderr, "only files the reader knows could be mixed\n");
+        return TC_ERR;
+    }
+
+    if (clt_settings.pcap_reader == NULL &&
+        (clt_settings.pcap = pcap_open_offline(pcap_file, ebuf)) == NULL)
+    {
         tc_log_info(LOG_ERR, 0, "open %s" , ebuf);
         fprintf(stderr, "open %s\n", ebuf);
         return TC_ERR;
     }
 
+    if (clt_settings.pcap_reader == NULL && clt_settings.loops != 0) {
+        tc_log_info(LOG_WARN, 0, "-K needs a file the reader knows, "
+                "%s is replayed once", pcap_file);
+    }
+
     gettimeofday(&base_time, NULL);
+    loop_start = tc_milliscond_time();
     tc_log_info(LOG_NOTICE, 0, "open pcap success:%s", pcap_file);
-    tc_log_info(LOG_NOTICE, 0, "send the first packets here");
-    send_packets_from_pcap(1);
+
+#if (TC_HAVE_TIMERFD)
+    /* libpcap can not peek at the next packet, it is paced by the timer */
+    if (clt_settings.pcap_reader != NULL) {
+        tc_offline_pace_init(event_loop);
+    }
+
+    if (pace_fd == -1)
+#endif
+    {
+        tc_log_info(LOG_WARN, 0, "packets are sent in batches, not paced "
+                "on their own%s", clt_settings.max_pps > 0 ?
+                ", -Q is ignored" : "");
+        tc_log_info(LOG_NOTICE, 0, "send the first packets here");
+        send_packets_from_pcap(1);
+#if (TC_THREADS)
+        tc_workers_kick();
+#endif
+    }
 
     /* register a timer for offline */
     tc_event_add_timer(event_loop->pool, OFFLINE_ACTIVATE_INTERVAL, 
@@ -509,9 +749,29 @@ proc_offline_pack(tc_event_timer_t *evt)
     int diff;  
 
     if (!read_pcap_over) {
+#if (TC_HAVE_TIMERFD)
+        if (pace_fd != -1) {
+            tc_event_update_timer(evt, OFFLINE_ACTIVATE_INTERVAL);
+            return;
+        }
+#endif
         send_packets_from_pcap(0);
+#if (TC_THREADS)
+        tc_workers_kick();
+#endif
     } else {
         diff = tc_time() - read_pcap_over_time;
+
+        /* the closed loop replay is over with its last session */
+        if (clt_settings.loop_sess > 0 && diff > 0
+                && __atomic_load_n(&tc_loop_live, __ATOMIC_RELAXED) == 0
+                && __atomic_load_n(&tc_loop_parked, __ATOMIC_RELAXED) == 0)
+        {
+            loop_end = tc_milliscond_time();
+            tc_over = SIGRTMAX;
+            tc_log_info(LOG_NOTICE, 0, "closed loop replay is complete");
+        }
+
         if (diff > OFFLINE_TAIL_TIMEOUT) {
             tc_over = SIGRTMAX;
             tc_log_info(LOG_NOTICE, 0, "offline replay is complete");
@@ -539,16 +799,31 @@ timeval_diff(struct timeval *start, struct timeval *cur)
 }
 
 
+static bool
+tc_offline_loop_full(void)
+{
+    uint32_t parked;
+
+    parked = __atomic_load_n(&tc_loop_parked, __ATOMIC_RELAXED);
+
+    return parked >= tc_max(clt_settings.loop_sess * 8, TC_LOOP_PARKED);
+}
+
+
 static bool
 check_read_stop()
 {
     uint64_t diff, history_diff, cur_diff;
 
+    if (clt_settings.loop_sess > 0) {
+        return tc_offline_loop_full();
+    }
+
     history_diff = timeval_diff(&first_pack_time, &last_pack_time);
     cur_diff     = timeval_diff(&base_time, &cur_time);
 
-    if (clt_settings.accelerated_times > 1) {
-        cur_diff = cur_diff * clt_settings.accelerated_times;
+    if (clt_settings.accelerated_times != 1) {
+        cur_diff = (uint64_t) (cur_diff * clt_settings.accelerated_times);
     }
 
     if (clt_settings.interval > 0) {
@@ -582,6 +857,11 @@ send_packets_from_pcap(int first)
     unsigned char      *pkt_data, *ip_data;
     struct pcap_pkthdr  pkt_hdr;  
 
+    if (clt_settings.pcap_reader != NULL) {
+        send_packets_from_reader();
+        return;
+    }
+
     pcap = clt_settings.pcap;
 
     if (pcap == NULL) {
@@ -642,5 +922,424 @@ send_packets_from_pcap(int first)
         }
     }
 }
+
+
+static void
+tc_offline_pass_stat(void)
+{
+    tc_log_info(LOG_NOTICE, 0, "pass %u: packets:%llu, replayed:%llu, "
+            "%ld seconds", pass_cur + 1, pass_packs, pass_valid,
+            (long) (pass_last - pass_start));
+}
+
+
+/*
+ * the sessions of a later pass, or of another copy of a weighted file,
+ * are new ones to the target: every slot moves the client ports on, and
+ * so the client ip -c picks
+ */
+static void
+tc_offline_rotate(unsigned char *packet, uint32_t len, uint32_t slot)
+{
+    uint16_t   size_ip, addition, *ports;
+    tc_iph_t  *ip;
+
+    if (slot == 0) {
+        return;
+    }
+
+    ip = (tc_iph_t *) packet;
+    size_ip = ip->ihl << 2;
+    if (len < (uint32_t) size_ip + 4) {
+        return;
+    }
+
+    /* the source and destination ports of tcp and udp alike */
+    ports = (uint16_t *) (packet + size_ip);
+    if (check_pack_src(&(clt_settings.transfer), ip->daddr, ports[1], 
+                CHECK_DEST) != TC_CLT) 
+    {
+        return;
+    }
+
+    addition = ((uint64_t) slot * TC_PASS_PORT_STEP) % 60000;
+    ports[0] = htons(get_appropriate_port(ntohs(ports[0]), addition));
+
+    if (clt_settings.clt_tf_ip_num > 0 && ip->saddr != LOCALHOST) {
+        ip->saddr = (ip->saddr << 1) + addition;
+    }
+}
+
+
+static unsigned char pack_buffer3[IP_RCV_BUF_SIZE];
+
+static void
+tc_offline_dispose(tc_pcap_pkt_t *pkt, int *p_valid_flag)
+{
+    int              i, valid;
+    uint32_t         slot;
+    tc_pcap_file_t  *f;
+
+    /* files mixed may be in different passes, the latest one is told */
+    if (pkt->pass > pass_cur) {
+        tc_offline_pass_stat();
+        pass_cur   = pkt->pass;
+        pass_packs = 0;
+        pass_valid = 0;
+    }
+
+    if (pass_packs == 0) {
+        pass_start = tc_time();
+    }
+
+    f    = &clt_settings.pcap_files[pkt->src];
+    slot = pkt->pass * clt_settings.pcap_slots + f->slot;
+
+    /* copies start from the packet as read, dispose_packet changes it */
+    for (i = 1; i < f->weight && pkt->len <= IP_RCV_BUF_SIZE; i++) {
+        memcpy(pack_buffer3, pkt->ip, pkt->len);
+        tc_offline_rotate(pack_buffer3, pkt->len, slot + i);
+        dispose_packet(pack_buffer3, pkt->len, &valid);
+        pass_valid += valid;
+    }
+
+    tc_offline_rotate(pkt->ip, pkt->len, slot);
+    dispose_packet(pkt->ip, pkt->len, p_valid_flag);
+
+    pass_packs++;
+    pass_valid += *p_valid_flag;
+    pass_last   = tc_time();
+}
+
+
+/* 
+ * packets come off the ring of the read-ahead thread, which has dropped
+ * the broken ones already; an empty ring only means it is behind for now
+ */
+static void 
+send_packets_from_reader()
+{
+    int                 p_valid_flag = 0;
+    bool                stop;
+    tc_pcap_pkt_t      *pkt;
+    tc_pcap_reader_t   *r;
+    static bool         first = true;
+
+    r = clt_settings.pcap_reader;
+
+    gettimeofday(&cur_time, NULL);
+
+    stop = check_read_stop();
+
+    while (!stop) {
+
+        pkt = tc_pcap_reader_peek(r);
+        if (pkt == NULL) {
+            if (tc_pcap_reader_over(r)) {
+                tc_log_info(LOG_NOTICE, 0, "stop, no more packets to read");
+                read_pcap_over = true;
+                read_pcap_over_time = tc_time();
+            }
+            break;
+        }
+
+        last_pack_time = pkt->ts;
+        clt_settings.pcap_time = last_pack_time.tv_sec * 1000 +
+            last_pack_time.tv_usec / 1000; 
+
+        tc_offline_dispose(pkt, &p_valid_flag);
+        if (p_valid_flag) {
+
+            if (!first) {
+                adj_v_pack_df = timeval_diff(&last_v_pack_time,
+                        &last_pack_time);
+            } else {
+                first_pack_time = pkt->ts;
+                first = false;
+            }
+
+            /* set last valid packet time in pcap file */
+            last_v_pack_time = last_pack_time;
+
+            stop = check_read_stop();
+        }
+
+        tc_pcap_reader_consume(r);
+    }
+}
+
+
+#if (TC_HAVE_TIMERFD)
+static inline uint64_t
+tc_pace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void
+tc_pace_arm(uint64_t at)
+{
+    struct itimerspec its;
+
+    tc_memzero(&its, sizeof(its));
+    its.it_value.tv_sec  = at / 1000000000;
+    its.it_value.tv_nsec = at % 1000000000;
+
+    if (timerfd_settime(pace_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+        tc_log_info(LOG_ERR, errno, "timerfd_settime failed");
+    }
+}
+
+
+/* tells if the packet goes to a target, only those count against -Q */
+static bool
+tc_pace_counted(tc_pcap_pkt_t *pkt)
+{
+    uint16_t    size_ip;
+    tc_iph_t   *ip;
+    tc_tcph_t  *tcp;
+
+    ip = (tc_iph_t *) pkt->ip;
+    size_ip = ip->ihl << 2;
+
+#if (TC_UDP)
+    if (ip->protocol != IPPROTO_UDP) {
+#else
+    if (ip->protocol != IPPROTO_TCP) {
+#endif
+        return false;
+    }
+
+    if (size_ip < IPH_MIN_LEN || pkt->len < (uint32_t) size_ip + 4) {
+        return false;
+    }
+
+    /* the ports are at the same place for udp */
+    tcp = (tc_tcph_t *) ((char *) ip + size_ip);
+
+    return TC_CLT == check_pack_src(&(clt_settings.transfer), ip->daddr,
+            tcp->dest, CHECK_DEST);
+}
+
+
+/* when the packet is sent, on the clock of the replay */
+static uint64_t
+tc_pace_due(tc_pcap_pkt_t *pkt, uint64_t now)
+{
+    uint64_t  us, gap, due, min;
+
+    us = (uint64_t) pkt->ts.tv_sec * 1000000 + pkt->ts.tv_usec;
+
+    if (!pace_started) {
+        pace_started  = true;
+        pace_base     = now;
+        pace_first_us = us;
+        pace_last_us  = us;
+    }
+
+    /* gaps over -I are not waited for */
+    if (us > pace_last_us) {
+        gap = us - pace_last_us;
+        if (clt_settings.interval > 0 && gap > clt_settings.interval) {
+            pace_skipped += gap;
+        }
+        pace_last_us = us;
+    }
+
+    us  = us - tc_min(us, pace_first_us + pace_skipped);
+    due = pace_base + (uint64_t) (us * 1000 / clt_settings.accelerated_times);
+
+    /* the packets the filter drops later are not held back */
+    if (clt_settings.max_pps > 0 && tc_pace_counted(pkt)) {
+        if (pace_pps_due > 0) {
+            min = pace_pps_due + 1000000000 / clt_settings.max_pps;
+            if (due < min) {
+                due = min;
+            }
+        }
+        pace_pps_due = due;
+    }
+
+    return due;
+}
+
+
+static void
+tc_pace_record(uint64_t late)
+{
+    int       i;
+    uint64_t  us;
+
+    us = late / 1000;
+    i  = us ? 64 - __builtin_clzll(us) : 0;
+
+    pace_hist[tc_min(i, TC_PACE_BUCKETS - 1)]++;
+    pace_cnt++;
+    pace_sum += us;
+    pace_max  = tc_max(pace_max, us);
+}
+
+
+static int
+tc_offline_pace_init(tc_event_loop_t *event_loop)
+{
+    tc_event_t *ev;
+
+    pace_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (pace_fd == -1) {
+        tc_log_info(LOG_WARN, errno, "timerfd_create failed");
+        return TC_ERR;
+    }
+
+    ev = tc_event_create(event_loop->pool, pace_fd, proc_offline_pace, NULL);
+    if (ev == NULL 
+            || tc_event_add(event_loop, ev, TC_EVENT_READ) == TC_EVENT_ERROR) 
+    {
+        close(pace_fd);
+        pace_fd = -1;
+        return TC_ERR;
+    }
+
+    tc_log_info(LOG_NOTICE, 0, "every packet is paced on its own");
+    tc_pace_arm(tc_pace_now());
+
+    return TC_OK;
+}
+
+
+static int
+proc_offline_pace(tc_event_t *rev)
+{
+    int                 n, p_valid_flag = 0;
+    uint64_t            exp, now;
+    tc_pcap_pkt_t      *pkt;
+    tc_pcap_reader_t   *r;
+
+    if (read(rev->fd, &exp, sizeof(exp)) == -1 && errno != EAGAIN) {
+        tc_log_info(LOG_ERR, errno, "read timerfd:%d", rev->fd);
+    }
+
+    r   = clt_settings.pcap_reader;
+    now = tc_pace_now();
+
+    for (n = 0; n < TC_PACE_BATCH; n++) {
+
+        pkt = tc_pcap_reader_peek(r);
+        if (pkt == NULL) {
+            if (tc_pcap_reader_over(r)) {
+                tc_log_info(LOG_NOTICE, 0, "stop, no more packets to read");
+                read_pcap_over = true;
+                read_pcap_over_time = tc_time();
+            } else {
+                /* the read-ahead thread is behind */
+                tc_pace_arm(now + TC_PACE_SPIN);
+            }
+            goto done;
+        }
+
+        if (clt_settings.loop_sess > 0) {
+            /* no times, it is only to wait for the sessions read before */
+            if (tc_offline_loop_full()) {
+                tc_pace_arm(now + TC_LOOP_WAIT);
+                goto done;
+            }
+            goto dispose;
+        }
+
+        if (!pace_pending) {
+            pace_pending = true;
+            pace_due = tc_pace_due(pkt, now);
+        }
+
+        if (pace_due > now) {
+            if (pace_due - now > TC_PACE_SPIN) {
+                tc_pace_arm(pace_due - TC_PACE_SPIN);
+                goto done;
+            }
+
+            do {
+                now = tc_pace_now();
+            } while (now < pace_due);
+        }
+
+        tc_pace_record(now - pace_due);
+
+    dispose:
+
+        clt_settings.pcap_time = pkt->ts.tv_sec * 1000 + 
+            pkt->ts.tv_usec / 1000;
+        tc_offline_dispose(pkt, &p_valid_flag);
+
+        tc_pcap_reader_consume(r);
+        pace_pending = false;
+        now = tc_pace_now();
+    }
+
+    /* a burst is due, the other events are served in between */
+    tc_pace_arm(now);
+
+done:
+
+#if (TC_THREADS)
+    tc_workers_kick();
+#endif
+
+    return TC_OK;
+}
+#endif
+
+
+void
+tc_offline_release(void)
+{
+    long      ms;
+#if (TC_HAVE_TIMERFD)
+    int       i;
+    uint64_t  cnt;
+#endif
+
+    if (clt_settings.loops != 0 && pass_packs > 0) {
+        tc_offline_pass_stat();
+    }
+
+    if (clt_settings.loop_sess > 0) {
+        ms = (loop_end ? loop_end : tc_milliscond_time()) - loop_start;
+        tc_log_info(LOG_NOTICE, 0, "closed loop: sessions:%llu in %.3fs, "
+                "%.1f a second", tc_loop_done, ms / 1000.0, 
+                ms > 0 ? tc_loop_done * 1000.0 / ms : 0.0);
+    }
+
+#if (TC_HAVE_TIMERFD)
+    if (pace_fd == -1) {
+        return;
+    }
+
+    close(pace_fd);
+    pace_fd = -1;
+
+    if (pace_cnt == 0) {
+        return;
+    }
+
+    tc_log_info(LOG_NOTICE, 0, "pacing: packets:%llu, late avg:%lluus, "
+            "max:%lluus", pace_cnt, pace_sum / pace_cnt, pace_max);
+
+    for (i = 0, cnt = 0; i < TC_PACE_BUCKETS; i++) {
+        if (pace_hist[i] == 0) {
+            continue;
+        }
+
+        /* the share of packets sent within the bound so far */
+        cnt += pace_hist[i];
+        tc_log_info(LOG_NOTICE, 0, "pacing: late <%lluus:%llu (%.2f%%)",
+                (uint64_t) 1 << i, pace_hist[i], 100.0 * cnt / pace_cnt);
+    }
+#endif
+}
 #endif /* TC_OFFLINE */
 
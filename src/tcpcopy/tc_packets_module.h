@@ -4,9 +4,11 @@
 #include <xcopy.h>
 #include <tcpcopy.h>
 
+int tc_packets_output_init(void);
 int tc_packets_init(tc_event_loop_t *event_loop);
 #if (TC_OFFLINE)
 int tc_offline_init(tc_event_loop_t *event_loop, char *pcap_file);
+void tc_offline_release(void);
 #endif
 
 #endif /* TC_PACKETS_MODULE_INCLUDED */
@@ -0,0 +1,676 @@
+
+#include <xcopy.h>
+#include <tcpcopy.h>
+
+#define TC_PCAP_MAGIC          0xa1b2c3d4
+#define TC_PCAP_MAGIC_NSEC     0xa1b23c4d
+#define TC_PCAP_HDR_LEN        24
+#define TC_PCAP_REC_HDR_LEN    16
+
+#define TC_PCAPNG_SHB          0x0a0d0d0a
+#define TC_PCAPNG_BOM          0x1a2b3c4d
+#define TC_PCAPNG_IDB          1
+#define TC_PCAPNG_SPB          3
+#define TC_PCAPNG_EPB          6
+#define TC_PCAPNG_TSRESOL      9
+
+typedef struct {
+    int               linktype;
+    uint32_t          snaplen;        /* 0 if not limited */
+    uint64_t          units;          /* timestamp units per second */
+} tc_pcap_if_t;
+
+/* one -i file, read ahead by a thread of its own */
+typedef struct {
+    tc_ring_t         ring;
+    tc_archive_t     *archive;
+    char             *file;
+    uint32_t          index;          /* into the -i files */
+    double            speed;
+    unsigned          normalize:1;    /* times start at 0, see -i */
+
+    /* the mapping, only the read-ahead thread walks it */
+    u_char           *start;
+    u_char           *end;
+    u_char           *pos;
+    u_char           *first;          /* the first record */
+    u_char           *dropped;        /* pages before are let go */
+    unsigned          swapped:1;
+    unsigned          ng:1;
+    unsigned          nsec:1;
+    int               if_num;
+    tc_pcap_if_t      ifs[TC_PCAP_MAX_IFS];
+    struct timeval    last_ts;
+    uint64_t          records;
+    uint64_t          drops;
+
+    /* passes over the file, see -K */
+    uint32_t          pass;
+    uint64_t          first_us;       /* of the first pass */
+    uint64_t          last_us;
+    uint64_t          shift;          /* added to the times of this pass */
+
+    pthread_t         thread;
+    int               over;           /* all records are on the ring */
+    int               quit;
+} tc_pcap_source_t;
+
+struct tc_pcap_reader_s {
+    int               num;
+    tc_pcap_source_t *cur;            /* the one peeked at last */
+    tc_pcap_source_t *srcs[MAX_PCAP_FILES];
+};
+
+
+static uint32_t
+tc_pcap_u32(tc_pcap_source_t *s, u_char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(uint32_t));
+
+    return s->swapped ? __builtin_bswap32(v) : v;
+}
+
+
+static uint16_t
+tc_pcap_u16(tc_pcap_source_t *s, u_char *p)
+{
+    uint16_t v;
+
+    memcpy(&v, p, sizeof(uint16_t));
+
+    return s->swapped ? __builtin_bswap16(v) : v;
+}
+
+
+static void
+tc_pcap_set_ts(struct timeval *tv, uint64_t ts, uint64_t units)
+{
+    tv->tv_sec  = ts / units;
+    tv->tv_usec = (long) ((double) (ts % units) * 1000000 / units);
+}
+
+
+static void
+tc_pcapng_add_if(tc_pcap_source_t *s, u_char *body, u_char *last)
+{
+    int            i;
+    u_char        *p;
+    uint16_t       code, len;
+    tc_pcap_if_t  *ifp;
+
+    if (s->if_num == TC_PCAP_MAX_IFS) {
+        tc_log_info(LOG_WARN, 0, "too many interfaces in pcapng");
+        return;
+    }
+
+    ifp = &s->ifs[s->if_num++];
+    ifp->linktype = tc_pcap_u16(s, body);
+    ifp->snaplen  = tc_pcap_u32(s, body + 4);
+    ifp->units = 1000000;
+
+    for (p = body + 8; p + 4 <= last; p += 4 + tc_align(len, 4)) {
+        code = tc_pcap_u16(s, p);
+        len  = tc_pcap_u16(s, p + 2);
+        if (code == 0 || p + 4 + len > last) {
+            break;
+        }
+
+        if (code == TC_PCAPNG_TSRESOL && len == 1) {
+            if (p[4] & 0x80) {
+                ifp->units = (uint64_t) 1 << tc_min((p[4] & 0x7f), 63);
+            } else {
+                ifp->units = 1;
+                for (i = 0; i < tc_min(p[4], 19); i++) {
+                    ifp->units *= 10;
+                }
+            }
+        }
+    }
+}
+
+
+/* finds the next packet record, returns 0 at the end or -1 if malformed */
+static int
+tc_pcapng_next(tc_pcap_source_t *s, u_char **data, uint32_t *caplen,
+        uint32_t *len, struct timeval *ts, int *linktype)
+{
+    u_char    *p, *body, *last;
+    uint32_t   type, blen, bom, ifid;
+    uint64_t   t;
+
+    for ( ;; ) {
+        p = s->pos;
+        if (s->end - p < 12) {
+            return 0;
+        }
+
+        type = tc_pcap_u32(s, p);
+        if (type == TC_PCAPNG_SHB) {
+            /* a new section may come in the other byte order */
+            memcpy(&bom, p + 8, sizeof(uint32_t));
+            if (bom == TC_PCAPNG_BOM) {
+                s->swapped = 0;
+            } else if (__builtin_bswap32(bom) == TC_PCAPNG_BOM) {
+                s->swapped = 1;
+            } else {
+                return -1;
+            }
+            s->if_num = 0;
+        }
+
+        blen = tc_pcap_u32(s, p + 4);
+        if (blen < 12 || (blen & 3) || blen > (size_t) (s->end - p)) {
+            return -1;
+        }
+
+        s->pos = p + blen;
+        body = p + 8;
+        last = p + blen - 4;
+
+        switch (type) {
+
+        case TC_PCAPNG_IDB:
+            if (last - body >= 8) {
+                tc_pcapng_add_if(s, body, last);
+            }
+            break;
+
+        case TC_PCAPNG_EPB:
+            if (last - body < 20) {
+                return -1;
+            }
+
+            ifid    = tc_pcap_u32(s, body);
+            *caplen = tc_pcap_u32(s, body + 12);
+            *len    = tc_pcap_u32(s, body + 16);
+            if (ifid >= (uint32_t) s->if_num
+                    || *caplen > (size_t) (last - body - 20)
+                    || (s->ifs[ifid].snaplen
+                        && *caplen > s->ifs[ifid].snaplen))
+            {
+                return -1;
+            }
+
+            t = ((uint64_t) tc_pcap_u32(s, body + 4) << 32)
+                | tc_pcap_u32(s, body + 8);
+            tc_pcap_set_ts(ts, t, s->ifs[ifid].units);
+            *data     = body + 20;
+            *linktype = s->ifs[ifid].linktype;
+            s->last_ts = *ts;
+            return 1;
+
+        case TC_PCAPNG_SPB:
+            /* no timestamp, it goes with the packet before */
+            if (s->if_num == 0 || last - body < 4) {
+                return -1;
+            }
+
+            *len    = tc_pcap_u32(s, body);
+            *caplen = tc_min(*len, (uint32_t) (last - body - 4));
+            *data   = body + 4;
+            *ts     = s->last_ts;
+            *linktype = s->ifs[0].linktype;
+            return 1;
+
+        default:
+            break;
+        }
+    }
+}
+
+
+static int
+tc_pcap_next(tc_pcap_source_t *s, u_char **data, uint32_t *caplen,
+        uint32_t *len, struct timeval *ts, int *linktype)
+{
+    u_char    *p;
+    uint32_t   frac;
+
+    if (s->ng) {
+        return tc_pcapng_next(s, data, caplen, len, ts, linktype);
+    }
+
+    p = s->pos;
+    if (s->end - p < TC_PCAP_REC_HDR_LEN) {
+        return 0;
+    }
+
+    *caplen = tc_pcap_u32(s, p + 8);
+    *len    = tc_pcap_u32(s, p + 12);
+    if (*caplen > (size_t) (s->end - p - TC_PCAP_REC_HDR_LEN)) {
+        tc_log_info(LOG_WARN, 0, "the last record is cut off");
+        return 0;
+    }
+
+    if (s->ifs[0].snaplen && *caplen > s->ifs[0].snaplen) {
+        return -1;
+    }
+
+    frac = tc_pcap_u32(s, p + 4);
+    ts->tv_sec  = tc_pcap_u32(s, p);
+    ts->tv_usec = s->nsec ? frac / 1000 : frac;
+    *data     = p + TC_PCAP_REC_HDR_LEN;
+    *linktype = s->ifs[0].linktype;
+
+    s->pos = *data + *caplen;
+
+    return 1;
+}
+
+
+/* starts the next pass if -K asks for one */
+static bool
+tc_pcap_source_rewind(tc_pcap_source_t *s)
+{
+    if (s->last_us == 0
+            || (clt_settings.loops != -1
+                && s->pass + 1 >= (uint32_t) clt_settings.loops))
+    {
+        return false;
+    }
+
+    s->pass++;
+    s->shift = (uint64_t) s->pass
+        * (s->last_us - s->first_us + TC_PCAP_LOOP_GAP);
+
+    if (s->archive != NULL) {
+        tc_archive_rewind(s->archive);
+    } else {
+        s->pos = s->first;
+    }
+
+    madvise(s->dropped, s->end - s->dropped, MADV_DONTNEED);
+    s->dropped = s->start;
+
+    return true;
+}
+
+
+static void *
+tc_pcap_source_cycle(void *arg)
+{
+    int                ret, l2_len, linktype;
+    u_char            *data, *ip;
+    size_t             n;
+    uint32_t           caplen, len, ip_len;
+    uint64_t           us;
+    struct timeval     ts;
+    tc_pcap_pkt_t     *pkt;
+    tc_pcap_source_t  *s;
+    struct timespec    nap = {0, 100000};
+
+    s = arg;
+
+    /* the cpu after those of the workers, shared if there are too few */
+    if (clt_settings.cpu_num > 1) {
+#if (TC_THREADS)
+        tc_cpu_bind(clt_settings.cpus[(clt_settings.workers + 1)
+                                      % clt_settings.cpu_num]);
+#else
+        tc_cpu_bind(clt_settings.cpus[1]);
+#endif
+    }
+
+    while (!__atomic_load_n(&s->quit, __ATOMIC_RELAXED)) {
+
+        if (s->archive != NULL) {
+            /* archives hold only the ip packets worth replaying */
+            ret = tc_archive_next(s->archive, &ip, &ip_len, &ts);
+            if (ret <= 0) {
+                if (ret == 0 && tc_pcap_source_rewind(s)) {
+                    continue;
+                }
+                break;
+            }
+            s->records++;
+            goto push;
+        }
+
+        ret = tc_pcap_next(s, &data, &caplen, &len, &ts, &linktype);
+        if (ret <= 0) {
+            if (ret < 0) {
+                tc_log_info(LOG_ERR, 0, "malformed record at offset %llu",
+                        (unsigned long long) (s->pos - s->start));
+            } else if (tc_pcap_source_rewind(s)) {
+                continue;
+            }
+            break;
+        }
+
+        s->records++;
+
+        if (caplen < len) {
+            tc_log_info(LOG_WARN, 0, "truncated packets,drop");
+            s->drops++;
+            continue;
+        }
+
+        l2_len = get_l2_len(data, linktype);
+        if (l2_len < (int) ETHERNET_HDR_LEN || len <= (uint32_t) l2_len) {
+            tc_log_info(LOG_WARN, 0, "l2 len is %d", l2_len);
+            s->drops++;
+            continue;
+        }
+
+        ip     = data + l2_len;
+        ip_len = len - l2_len;
+
+    push:
+
+        if (ip_len > TC_PCAP_MAX_PKT) {
+            /* it would never find room on the ring */
+            tc_log_info(LOG_WARN, 0, "packet of %u bytes,drop", ip_len);
+            s->drops++;
+            continue;
+        }
+
+        us = (uint64_t) ts.tv_sec * 1000000 + ts.tv_usec;
+        if (s->pass == 0) {
+            if (s->last_us == 0) {
+                s->first_us = us;
+            }
+            s->last_us = tc_max(s->last_us, us);
+        } else {
+            us += s->shift;
+        }
+
+        /*
+         * files mixed by -i are replayed as if they started together,
+         * packets stamped before the first one, as captures from several
+         * nic queues may be, go with it
+         */
+        if (s->normalize) {
+            us = us < s->first_us
+                 ? 0 : (uint64_t) ((us - s->first_us) / s->speed);
+        }
+
+        if (s->pass > 0 || s->normalize) {
+            ts.tv_sec  = us / 1000000;
+            ts.tv_usec = us % 1000000;
+        }
+
+        for ( ;; ) {
+            pkt = tc_ring_reserve(&s->ring, sizeof(tc_pcap_pkt_t) + ip_len, 0);
+            if (pkt != NULL) {
+                break;
+            }
+
+            /* replay is behind, the ring holds enough to go on with */
+            if (__atomic_load_n(&s->quit, __ATOMIC_RELAXED)) {
+                goto done;
+            }
+            nanosleep(&nap, NULL);
+        }
+
+        pkt->ts  = ts;
+        pkt->len = ip_len;
+        pkt->pass = s->pass;
+        pkt->src  = s->index;
+        memcpy(pkt->ip, ip, ip_len);
+        tc_ring_commit(&s->ring);
+
+        /* pages read are let go, so that the mapping does not pile up */
+        n = s->pos > s->dropped ? s->pos - s->dropped : 0;
+        if (n > TC_PCAP_DROP_BEHIND) {
+            n &= ~((size_t) tc_pagesize - 1);
+            madvise(s->dropped, n, MADV_DONTNEED);
+            s->dropped += n;
+        }
+    }
+
+done:
+
+    __atomic_store_n(&s->over, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+
+/* returns NULL if the file is not one it reads */
+static tc_pcap_source_t *
+tc_pcap_source_open(tc_pcap_file_t *f, uint32_t index, bool mixed)
+{
+    int                fd;
+    u_char            *map;
+    uint32_t           magic;
+    struct stat        st;
+    tc_pcap_source_t  *s;
+
+    fd = open(f->file, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)
+            || st.st_size < TC_PCAP_HDR_LEN)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        tc_log_info(LOG_WARN, errno, "mmap %s failed", f->file);
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    s = tc_alloc(sizeof(tc_pcap_source_t));
+    if (s == NULL) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    tc_memzero(s, sizeof(tc_pcap_source_t));
+
+    s->file      = f->file;
+    s->index     = index;
+    s->speed     = f->speed;
+    s->normalize = (mixed || f->speed != 1);
+    s->start     = map;
+    s->end       = map + st.st_size;
+    s->dropped   = map;
+
+    memcpy(&magic, map, sizeof(uint32_t));
+
+    if (magic == TC_ARCHIVE_MAGIC) {
+        s->archive = tc_archive_open(map, st.st_size);
+        if (s->archive == NULL) {
+            munmap(map, st.st_size);
+            tc_free(s);
+            return NULL;
+        }
+
+    } else if (magic == TC_PCAPNG_SHB) {
+        s->ng  = 1;
+        s->pos = map;
+
+    } else {
+        if (magic == __builtin_bswap32(TC_PCAP_MAGIC)
+                || magic == __builtin_bswap32(TC_PCAP_MAGIC_NSEC))
+        {
+            s->swapped = 1;
+            magic = __builtin_bswap32(magic);
+        }
+
+        if (magic != TC_PCAP_MAGIC && magic != TC_PCAP_MAGIC_NSEC) {
+            munmap(map, st.st_size);
+            tc_free(s);
+            return NULL;
+        }
+
+        s->nsec   = (magic == TC_PCAP_MAGIC_NSEC);
+        s->if_num = 1;
+        s->ifs[0].snaplen  = tc_pcap_u32(s, map + 16);
+        s->ifs[0].linktype = tc_pcap_u32(s, map + 20) & 0xffff;
+        s->pos = map + TC_PCAP_HDR_LEN;
+    }
+
+    s->first = s->pos;
+
+    if (s->archive == NULL && (clt_settings.raw_replay_window != NULL
+                || clt_settings.replay_clt_num > 0))
+    {
+        tc_log_info(LOG_WARN, 0, "-T and -E work only for archives");
+    }
+
+    if (tc_ring_init(&s->ring, TC_PCAP_RING_SIZE) != TC_OK) {
+        goto failed;
+    }
+
+    if (pthread_create(&s->thread, NULL, tc_pcap_source_cycle, s) != 0) {
+        tc_log_info(LOG_ERR, errno, "start read-ahead thread failed");
+        tc_ring_destroy(&s->ring);
+        goto failed;
+    }
+
+    tc_log_info(LOG_NOTICE, 0, "read %s ahead, %s, %llu bytes", f->file,
+            s->archive ? "archive" : (s->ng ? "pcapng" : "pcap"),
+            (unsigned long long) st.st_size);
+
+    return s;
+
+failed:
+
+    if (s->archive != NULL) {
+        tc_archive_close(s->archive);
+    }
+    munmap(map, st.st_size);
+    tc_free(s);
+
+    return NULL;
+}
+
+
+static void
+tc_pcap_source_close(tc_pcap_source_t *s)
+{
+    __atomic_store_n(&s->quit, 1, __ATOMIC_RELAXED);
+    pthread_join(s->thread, NULL);
+
+    tc_log_info(LOG_NOTICE, 0, "pcap %s records:%llu, drops:%llu, passes:%u",
+            s->file, s->records, s->drops, s->pass + 1);
+
+    if (s->archive != NULL) {
+        tc_archive_close(s->archive);
+    }
+    tc_ring_destroy(&s->ring);
+    munmap(s->start, s->end - s->start);
+    tc_free(s);
+}
+
+
+/* returns NULL if a file is not one it reads, libpcap is tried then */
+tc_pcap_reader_t *
+tc_pcap_reader_open(tc_pcap_file_t *files, int num)
+{
+    int                i;
+    tc_pcap_reader_t  *r;
+
+    r = tc_alloc(sizeof(tc_pcap_reader_t));
+    if (r == NULL) {
+        return NULL;
+    }
+    tc_memzero(r, sizeof(tc_pcap_reader_t));
+
+    for (i = 0; i < num; i++) {
+        r->srcs[i] = tc_pcap_source_open(&files[i], i, num > 1);
+        if (r->srcs[i] == NULL) {
+            if (num > 1) {
+                tc_log_info(LOG_ERR, 0, "%s can not be mixed", files[i].file);
+            }
+            tc_pcap_reader_close(r);
+            return NULL;
+        }
+        r->num++;
+    }
+
+    r->cur = r->srcs[0];
+
+    return r;
+}
+
+
+void
+tc_pcap_reader_close(tc_pcap_reader_t *r)
+{
+    int i;
+
+    for (i = 0; i < r->num; i++) {
+        tc_pcap_source_close(r->srcs[i]);
+    }
+
+    tc_free(r);
+}
+
+
+/* returns the next packet or NULL if none is ready yet */
+tc_pcap_pkt_t *
+tc_pcap_reader_peek(tc_pcap_reader_t *r)
+{
+    int                i;
+    uint32_t           len;
+    tc_pcap_pkt_t     *pkt, *next;
+    tc_pcap_source_t  *s;
+
+    if (r->num == 1) {
+        return tc_ring_peek(&r->cur->ring, &len, NULL);
+    }
+
+    /* the earliest packet of all files, once every file has one or is over */
+    next = NULL;
+    for (i = 0; i < r->num; i++) {
+        s = r->srcs[i];
+
+        pkt = tc_ring_peek(&s->ring, &len, NULL);
+        if (pkt == NULL) {
+            if (!__atomic_load_n(&s->over, __ATOMIC_ACQUIRE)) {
+                return NULL;
+            }
+
+            /* the last packet may have come just before it was over */
+            pkt = tc_ring_peek(&s->ring, &len, NULL);
+            if (pkt == NULL) {
+                continue;
+            }
+        }
+
+        if (next == NULL || timercmp(&pkt->ts, &next->ts, <)) {
+            next   = pkt;
+            r->cur = s;
+        }
+    }
+
+    return next;
+}
+
+
+/* takes the packet peeked at last */
+void
+tc_pcap_reader_consume(tc_pcap_reader_t *r)
+{
+    tc_ring_consume(&r->cur->ring);
+}
+
+
+/* every packet was taken */
+bool
+tc_pcap_reader_over(tc_pcap_reader_t *r)
+{
+    int                i;
+    uint32_t           len;
+    tc_pcap_source_t  *s;
+
+    for (i = 0; i < r->num; i++) {
+        s = r->srcs[i];
+        if (!__atomic_load_n(&s->over, __ATOMIC_ACQUIRE)
+                || tc_ring_peek(&s->ring, &len, NULL) != NULL)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,44 @@
+#ifndef  TC_PCAP_READER_INCLUDED
+#define  TC_PCAP_READER_INCLUDED
+
+#include <xcopy.h>
+#include <tcpcopy.h>
+
+/*
+ * Offline capture reader.
+ *
+ * The capture file is mapped and parsed in place by a read-ahead thread,
+ * which faults the file in, finds the ip packet of every record and
+ * copies it into a ring of packets ready for replay.  The replay loop
+ * only takes packets off the ring, so it never waits for the disk.
+ * pcap files with micro or nano second timestamps in either byte order,
+ * pcapng files and replay archives are read.  With -K the file is read
+ * again and again, each pass later in time than the one before.
+ *
+ * Several files are read by a thread each and merged by their times,
+ * which then start at 0 and are divided by the speed of their file.
+ */
+
+#define TC_PCAP_RING_SIZE      (16 * 1024 * 1024)
+#define TC_PCAP_MAX_PKT        262144          /* bytes, far below the ring */
+#define TC_PCAP_MAX_IFS        32
+#define TC_PCAP_DROP_BEHIND    (64 * 1024 * 1024)
+#define TC_PCAP_LOOP_GAP       1000            /* us between two passes */
+
+typedef struct {
+    struct timeval    ts;
+    uint32_t          len;            /* of the ip packet */
+    uint32_t          pass;           /* over the file, see -K */
+    uint32_t          src;            /* index of the file in -i */
+    u_char            ip[];
+} tc_pcap_pkt_t;
+
+typedef struct tc_pcap_reader_s tc_pcap_reader_t;
+
+tc_pcap_reader_t *tc_pcap_reader_open(tc_pcap_file_t *files, int num);
+void tc_pcap_reader_close(tc_pcap_reader_t *r);
+tc_pcap_pkt_t *tc_pcap_reader_peek(tc_pcap_reader_t *r);
+void tc_pcap_reader_consume(tc_pcap_reader_t *r);
+bool tc_pcap_reader_over(tc_pcap_reader_t *r);
+
+#endif /* TC_PCAP_READER_INCLUDED */
@@ -16,6 +16,28 @@ static void sess_timeout(tc_event_timer_t *ev);
 static inline void fill_pro_common_header(tc_iph_t *, tc_tcph_t *);
 static inline int overwhelm(tc_sess_t *, const char *, int, int);
 static inline tc_sess_t *sess_add(uint64_t, tc_iph_t *, tc_tcph_t *);
+#if (!TC_SINGLE)
+static bool clt_in_ranges(uint32_t);
+#endif
+#if (TC_OFFLINE)
+static int sess_loop_park(tc_sess_t *, tc_iph_t *, tc_tcph_t *);
+static void sess_loop_release(tc_sess_t *);
+#endif
+
+#if (!TC_DETECT_MEMORY)
+/* per-packet fields must stay within the first two cache lines */
+tc_static_assert(TC_SESS_HOT_SIZE <= 2 * TC_CPU_CACHE_LINE, sess_hot_part);
+#endif
+
+/* session pool blocks and slide window packets come from here */
+static tc_thread_local tc_slab_t  *sess_slab;
+static tc_thread_local tc_arena_t *sess_arena;
+
+#if (TC_OFFLINE)
+/* sessions waiting for a slot of the closed loop replay, see -j */
+static tc_thread_local link_list  *parked_sess;
+static tc_thread_local uint32_t    loop_live, loop_limit;
+#endif
 
     
 static void 
@@ -44,6 +66,19 @@ reconstruct_sess(tc_sess_t *s)
 }
 
 
+static void
+sess_release_packs(tc_sess_t *s)
+{
+    p_link_node  ln;
+
+    while ((ln = link_list_first(s->slide_win_packs)) != NULL) {
+        link_list_remove(s->slide_win_packs, ln);
+        tc_slab_free(sess_slab, ln->data);
+        tc_slab_free(sess_slab, ln);
+    }
+}
+
+
 static void
 sess_post_disp(tc_sess_t *s,  bool complete)
 {
@@ -51,6 +86,12 @@ sess_post_disp(tc_sess_t *s,  bool complete)
 
     tc_log_debug1(LOG_DEBUG, 0, "sess post disp:%u", ntohs(s->src_port));
 
+#if (TC_OFFLINE)
+    if (s->sm.parked || s->sm.loop_slot) {
+        sess_loop_release(s);
+    }
+#endif
+
 #if (TC_DETECT_MEMORY)
     s->sm.call_sess_post_cnt++;
     if (s->sm.call_sess_post_cnt == 1 && s->sm.timeout) {
@@ -135,13 +176,14 @@ sess_post_disp(tc_sess_t *s,  bool complete)
     }
 #endif
     
-    diff = tc_time() - s->req_snd_con_time;
+    diff = tc_sess_sec_diff(tc_sess_msec(), s->req_snd_con_time);
 
     if (diff > 3600) {
         tc_log_info(LOG_WARN, 0, "session destroyed,time diff:%d, p%u",
                 diff, ntohs(s->src_port));
     }
 
+    sess_release_packs(s);
     tc_destroy_pool(s->pool);
 }
 
@@ -198,13 +240,55 @@ fill_pro_common_header(tc_iph_t *ip, tc_tcph_t *tcp)
 int
 tc_init_sess_table(void)
 {
-    tc_pool_t *pool = tc_create_pool(TC_LR_POOL_SIZE, TC_LR_POOL_SUB_SIZE, 0);
+    size_t     done;
+    tc_pool_t *pool;
+
+    if (clt_settings.use_arena) {
+        sess_arena = tc_arena_create();
+        if (sess_arena == NULL) {
+            return TC_ERR;
+        }
+
+        if (clt_settings.arena_prefault > 0) {
+            done = tc_arena_prefault(sess_arena, 
+                    (size_t) clt_settings.arena_prefault << 20);
+            tc_log_info(LOG_NOTICE, 0, "arena pre-faulted:%lluM, huge:%u/%u",
+                    (unsigned long long) (done >> 20), sess_arena->huge_cnt,
+                    sess_arena->region_cnt);
+        }
+    }
+
+    sess_slab = tc_slab_create(sess_arena);
+    if (sess_slab == NULL) {
+        return TC_ERR;
+    }
+
+    /* the session table is carved from the arena as well */
+    pool = tc_create_slab_pool(sess_slab, TC_LR_POOL_SIZE, 
+            TC_LR_POOL_SUB_SIZE, 0);
     if (pool != NULL) {
 #if (TC_DETECT_MEMORY)
         pool->d.is_traced = 1;
 #endif
         sess_table = hash_create(pool, 65536);
         if (sess_table != NULL) {
+#if (TC_OFFLINE)
+            if (clt_settings.loop_sess > 0) {
+                parked_sess = link_list_create(pool);
+                if (parked_sess == NULL) {
+                    return TC_ERR;
+                }
+
+                /* sessions are sharded over the workers, so are the slots */
+                loop_limit = clt_settings.loop_sess;
+#if (TC_THREADS)
+                if (clt_settings.workers > 0) {
+                    loop_limit = (loop_limit + clt_settings.workers - 1) 
+                        / clt_settings.workers;
+                }
+#endif
+            }
+#endif
             return TC_OK;
         }
     }
@@ -224,6 +308,10 @@ tc_dest_sess_table(void)
     if (sess_table != NULL) {
         tc_log_info(LOG_INFO, 0, "session table, size:%u, total:%u",
                 sess_table->size, sess_table->total);
+#if (TC_OFFLINE)
+        /* no parked session is started any more */
+        loop_limit = 0;
+#endif
         for (i = 0; i < sess_table->size; i++) {
             list = sess_table->lists[i];
             ln   = link_list_first(list);   
@@ -244,6 +332,19 @@ tc_dest_sess_table(void)
         }
         tc_destroy_pool(sess_table->pool);
         sess_table = NULL;
+#if (TC_OFFLINE)
+        parked_sess = NULL;
+#endif
+    }
+
+    if (sess_slab != NULL) {
+        tc_slab_destroy(sess_slab);
+        sess_slab = NULL;
+    }
+
+    if (sess_arena != NULL) {
+        tc_arena_destroy(sess_arena);
+        sess_arena = NULL;
     }
 }
 
@@ -253,9 +354,9 @@ sess_init(tc_sess_t *s)
 {
     s->slide_win_packs = link_list_create(s->pool);
 
-    s->create_time = tc_time();
-    s->rep_rcv_con_time = tc_time();
-    s->req_snd_con_time  = tc_time();
+    s->create_time = tc_sess_msec();
+    s->rep_rcv_con_time = s->create_time;
+    s->req_snd_con_time = s->create_time;
 
     s->sm.state  = CLOSED;
     s->sm.rep_dup_ack_cnt = 0;
@@ -275,20 +376,28 @@ sess_create(tc_iph_t *ip, tc_tcph_t *tcp)
 #else
     sub_pl_size = TC_DEFAULT_UPOOL_SIZE;
 #endif
-    pool = tc_create_pool(TC_DEFAULT_UPOOL_SIZE, sub_pl_size, TC_UPOOL_MAXV);
+    pool = tc_create_slab_pool(sess_slab, TC_DEFAULT_UPOOL_SIZE, sub_pl_size, 
+            TC_UPOOL_MAXV);
 
     if (pool == NULL) {
         return NULL;
     }
 
-    s = (tc_sess_t *) tc_pcalloc(pool, sizeof(tc_sess_t));
+    s = (tc_sess_t *) tc_pmemalign(pool, sizeof(tc_sess_t), 
+            TC_CPU_CACHE_LINE);
     if (s != NULL) {
+        tc_memzero(s, sizeof(tc_sess_t));
         s->pool = pool;
         sess_init(s);
         s->src_addr       = ip->saddr;
         s->online_addr    = ip->daddr;
         s->src_port       = tcp->source;
         s->online_port    = tcp->dest;
+#if (!TC_SINGLE)
+        /* the ranges are looked through once a session */
+        s->sm.in_range    = clt_settings.range_reg 
+                            && clt_in_ranges(s->src_addr);
+#endif
         test = get_test_pair(&(clt_settings.transfer), s->online_addr, 
                 s->online_port);
         if (test == NULL) {
@@ -335,12 +444,12 @@ sess_create(tc_iph_t *ip, tc_tcph_t *tcp)
 
 
 static int
-sess_obso(tc_sess_t *s, time_t cur, time_t thrsh_time, time_t thrsh_keep_time)
+sess_obso(tc_sess_t *s, uint32_t now)
 {
-    int threshold, diff;
+    int threshold, diff, rep_idle;
     
     if (s->sm.pack_lost) {
-        diff = cur - s->pack_lost_time;
+        diff = tc_sess_sec_diff(now, s->pack_lost_time);
         if (diff > PACK_LOSS_TIMEOUT) {
             tc_log_info(LOG_NOTICE, 0, "wait for prev packet timeout,p:%u", 
                         ntohs(s->src_port));
@@ -348,13 +457,14 @@ sess_obso(tc_sess_t *s, time_t cur, time_t thrsh_time, time_t thrsh_keep_time)
             return OBSOLETE;
         }
     }
-    if (s->rep_rcv_con_time < thrsh_time) {
+    rep_idle = tc_sess_sec_diff(now, s->rep_rcv_con_time);
+    if (rep_idle > clt_settings.sess_timeout) {
         if (s->slide_win_packs->size > 0) {
             tc_stat.obs_cnt++;
             return OBSOLETE;
         }  else {
             if (s->sm.state >= SND_REQ) {
-                if (s->rep_rcv_con_time < thrsh_keep_time) {
+                if (rep_idle > clt_settings.sess_keepalive_timeout) {
                     tc_stat.obs_cnt++;
                     tc_log_debug1(LOG_DEBUG, 0, "keepalive timeout ,p:%u", 
                             ntohs(s->src_port));
@@ -374,12 +484,11 @@ sess_obso(tc_sess_t *s, time_t cur, time_t thrsh_time, time_t thrsh_keep_time)
     }
 
     threshold = 256;
-    diff = cur - s->rep_rcv_con_time;
-    if (diff < 6) {
+    if (rep_idle < 6) {
         threshold = threshold << 1;
     }
 
-    diff = cur - s->req_snd_con_time;
+    diff = tc_sess_sec_diff(now, s->req_snd_con_time);
     /* check if the session is idle for 30 sec */
     if (diff < 30) {
         threshold = threshold << 2;
@@ -415,7 +524,6 @@ static void
 sess_timeout(tc_event_timer_t *ev)
 {
     int        result;
-    time_t     now, thrsh_time, thrsh_keep_time;
     tc_sess_t *s;
 
     s = ev->data;
@@ -431,15 +539,18 @@ sess_timeout(tc_event_timer_t *ev)
             return;
         }
 
+#if (TC_OFFLINE)
+        if (s->sm.parked) {
+            tc_event_update_timer(ev, CHECK_SESS_TIMEOUT);
+            return;
+        }
+#endif
+
         tc_log_debug2(LOG_INFO, 0, "sess key:%llu, check timeout:%u", s->hash_key, 
                 ntohs(s->src_port));
-        now = tc_time();
-        thrsh_time = now - clt_settings.sess_timeout;
-        thrsh_keep_time = now - clt_settings.sess_keepalive_timeout;
-
         result = NOT_YET_OBSOLETE;
         if (s->sm.state >= ESTABLISHED) {
-            result = sess_obso(s, now, thrsh_time, thrsh_keep_time);
+            result = sess_obso(s, tc_sess_msec());
         } else {
             result = OBSOLETE;
             s->rtt = 1;
@@ -541,7 +652,7 @@ send_pack(tc_sess_t *s, tc_iph_t *ip, tc_tcph_t *tcp, bool client)
         }
 #endif
         s->sm.state = SND_REQ;
-        s->req_snd_con_time = tc_time();
+        s->req_snd_con_time = tc_sess_msec();
         s->req_con_snd_seq  = ntohl(tcp->seq);
         s->target_nxt_seq = s->target_nxt_seq + s->cur_pack.cont_len;
         s->req_exp_seq = s->target_nxt_seq;
@@ -774,14 +885,72 @@ send_faked_rst(tc_sess_t *s, tc_iph_t *ip, tc_tcph_t *tcp)
 
 
 #if (!TC_SINGLE)
+static bool
+clt_in_ranges(uint32_t ip)
+{
+    int          i;
+    clt_range_t *r;
+
+    ip = ntohl(ip);
+    for (i = 0; i < clt_settings.clt_range_num; i++) {
+        r = &clt_settings.clt_ranges[i];
+        if (ip >= r->first && ip <= r->last) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+ * a session keeps to one connection, so that its messages and responses
+ * are not reordered and a slow connection holds up only its own sessions
+ */
+static int
+sess_conn_fd(tc_sess_t *s, conns_t *conns)
+{
+    int  i, k, fd;
+
+    if (s->sm.in_range) {
+        /* intercept routes the registered clients by port slice */
+        k = tc_port_slice(ntohs(s->src_port), conns->num);
+    } else {
+        /* other bits of the key than those choosing the worker */
+        k = (int) (((s->hash_key * 0x9E3779B97F4A7C15ULL) >> 40) 
+                % conns->num);
+    }
+
+    /* sessions of a closed connection move on to the next one */
+    for (i = 0; i < conns->num; i++) {
+        fd = conns->fds[(k + i) % conns->num];
+        if (fd > 0) {
+            return fd;
+        }
+    }
+
+    return -1;
+}
+
+
+/* the intercept is in front of the target ip */
+#define conns_own(conns, ip)                                                 \
+    ((conns)->mask && ((ip) & (conns)->mask) == (conns)->net)
+
+
 static bool
 send_router_info(tc_sess_t *s, uint16_t type)
 {
-    int          i, fd;
-    bool         result = false;
+    int          i, fd, ret;
+    bool         result = false, owned;
     conns_t     *conns;
     msg_clt_t    msg;
 
+    if (s->sm.in_range && type == CLIENT_ADD) {
+        /* intercept got its whole range when connecting */
+        return real_servers->active_num > 0;
+    }
+
     tc_memzero(&msg, sizeof(msg_clt_t));
     msg.clt_ip = s->src_addr;
     msg.clt_port = s->src_port;
@@ -789,19 +958,34 @@ send_router_info(tc_sess_t *s, uint16_t type)
     msg.target_ip = s->dst_addr;
     msg.target_port = s->dst_port;
 
-    for (i = 0; i < clt_settings.real_servers.num; i++) {
-        conns = &(clt_settings.real_servers.conns[i]);
+    /* only the intercepts in front of the target need it */
+    owned = false;
+    for (i = 0; i < real_servers->num; i++) {
+        conns = &(real_servers->conns[i]);
+        if (conns_own(conns, s->dst_addr)) {
+            owned = true;
+            break;
+        }
+    }
+
+    for (i = 0; i < real_servers->num; i++) {
+        conns = &(real_servers->conns[i]);
+        if (owned && !conns_own(conns, s->dst_addr)) {
+            continue;
+        }
+
         if (conns->active) {
-            fd = conns->fds[conns->index];
-            conns->index = (conns->index + 1) % conns->num;
+            fd = sess_conn_fd(s, conns);
             if (fd > 0) {
-                if (tc_socket_snd(fd, (char *) &msg, MSG_CLT_SIZE) != TC_ERR) {
+                /* a full queue only drops the message, not the server */
+                ret = tc_message_send(fd, &msg, MSG_CLT_SIZE);
+                if (ret == TC_OK) {
                     result = true;
-                } else {
+                } else if (ret == TC_ERR) {
                     tc_log_info(LOG_ERR, 0, "fd:%d, msg send error", fd);
                     if (conns->active != 0) {
                         conns->active = 0;
-                        clt_settings.real_servers.active_num--;
+                        real_servers->active_num--;
                     }
                 }
             }
@@ -942,8 +1126,8 @@ retrans_pack(tc_sess_t *s, uint32_t expected_seq)
             tln = ln;
             ln = link_list_get_next(list, ln);
             link_list_remove(list, tln);
-            tc_pfree(s->pool, tln->data);
-            tc_pfree(s->pool, tln);
+            tc_slab_free(sess_slab, tln->data);
+            tc_slab_free(sess_slab, tln);
         }
     }
 
@@ -1228,8 +1412,8 @@ update_retrans_packs(tc_sess_t *s)
             tln = ln;
             ln = link_list_get_next(list, ln);
             link_list_remove(list, tln);
-            tc_pfree(s->pool, tln->data);
-            tc_pfree(s->pool, tln);
+            tc_slab_free(sess_slab, tln->data);
+            tc_slab_free(sess_slab, tln);
         } else {
             break;
         }
@@ -1267,8 +1451,8 @@ remove_conflict_packs(tc_sess_t *s)
             }
             tc_log_debug1(LOG_INFO, 0, "win backward:%u", ntohs(s->src_port));
             link_list_remove(list, ln);
-            tc_pfree(s->pool, ln->data);
-            tc_pfree(s->pool, ln);
+            tc_slab_free(sess_slab, ln->data);
+            tc_slab_free(sess_slab, ln);
             ln = link_list_tail(list);
         } else {
             break;
@@ -1436,7 +1620,7 @@ proc_bak_pack(tc_sess_t *s, tc_iph_t *ip, tc_tcph_t *tcp)
                 s->sm.rep_dup_ack_cnt = 0;
             }
             tc_stat.resp_cont_cnt++;
-            s->rep_rcv_con_time = tc_time();
+            s->rep_rcv_con_time = tc_sess_msec();
             cur_target_ack_seq = s->cur_pack.seq + s->cur_pack.cont_len;
             last_target_ack_seq = s->target_ack_seq;
 
@@ -1702,8 +1886,8 @@ calculate_rtt(tc_sess_t *s)
         } else {
 #if (TC_OFFLINE)
             s->rtt = (clt_settings.pcap_time - s->rtt);
-            if (clt_settings.accelerated_times > 1) {
-                s->rtt = s->rtt / clt_settings.accelerated_times;
+            if (clt_settings.accelerated_times != 1) {
+                s->rtt = (long) (s->rtt / clt_settings.accelerated_times);
             }
 #else
             s->rtt = tc_milliscond_time() - s->rtt;
@@ -1875,7 +2059,7 @@ check_wait_prev_pack(tc_sess_t *s, tc_iph_t *ip, tc_tcph_t *tcp)
         }
 
         s->sm.pack_lost = 1;
-        s->pack_lost_time = tc_time();
+        s->pack_lost_time = tc_sess_msec();
         return PACK_STOP;
     } else {
         retransmit_seq = s->req_exp_seq - s->cur_pack.cont_len;
@@ -2083,15 +2267,34 @@ get_tf_ip(uint16_t key)
 }
 
 
+/* pure acks of established sessions are not replayed */
+bool
+tc_check_ingress_ack_needed(tc_iph_t *ip, tc_tcph_t *tcp)
+{
+    uint64_t    sess_key;
+    tc_sess_t  *s;
+
+    sess_key =  get_key(ip->saddr, tcp->source);
+    s = hash_find(sess_table, sess_key);
+    if (s) {
+        if (!tcp->rst && !tcp->fin) {
+            if (s->sm.state >= ESTABLISHED) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
 bool
 tc_check_ingress_pack_needed(tc_iph_t *ip)
 {
     bool        is_needed = false;
     uint16_t    size_ip, size_tcp, tot_len, cont_len, hlen, 
                 key, frag_off, tf_key;
-    uint64_t    sess_key;
     tc_tcph_t  *tcp;
-    tc_sess_t  *s;
 
     tc_stat.captured_cnt++;
 
@@ -2213,15 +2416,20 @@ tc_check_ingress_pack_needed(tc_iph_t *ip)
                 } else {
                     /*
                      * RST / FIN 包
+                     * 有replay worker时由会话所在的worker检查
                     */
-                    sess_key =  get_key(ip->saddr, tcp->source);
-                    s = hash_find(sess_table, sess_key);
-                    if (s) {
-                        if (!tcp->rst && !tcp->fin) {
-                            if (s->sm.state >= ESTABLISHED) {
-                                return is_needed;
-                            }
-                        }
+#if (TC_THREADS)
+                    if (!clt_settings.workers)
+#endif
+#if (!TC_OFFLINE)
+                    /* 
+                     * an agent has no sessions, its replayer checks it,
+                     * and a delay line checks it when it is replayed
+                     */
+                    if (!clt_settings.agent_port && !clt_settings.delay)
+#endif
+                    if (!tc_check_ingress_ack_needed(ip, tcp)) {
+                        return is_needed;
                     }
                 }
             } else {
@@ -2239,45 +2447,63 @@ tc_check_ingress_pack_needed(tc_iph_t *ip)
 
 
 void
-tc_output_stat(void)
+tc_output_sess_stat(tc_stat_t *stat, uint32_t active)
 {
     double    ratio;
 
-    if (tc_stat.start_pt != 0) {
-        tc_log_info(LOG_NOTICE, 0, "active:%u,rel:%llu,obs del:%llu,tw:%llu",
-                sess_table->total, tc_stat.leave_cnt, tc_stat.obs_cnt, 
-                tc_stat.time_wait_cnt);
-        tc_log_info(LOG_NOTICE, 0, "conns:%llu,resp:%llu,c-resp:%llu",
-                tc_stat.conn_cnt, tc_stat.resp_cnt, tc_stat.resp_cont_cnt);
-        tc_log_info(LOG_NOTICE, 0, "resp fin:%llu,resp rst:%llu",
-                tc_stat.resp_fin_cnt, tc_stat.resp_rst_cnt);
-        tc_log_info(LOG_NOTICE, 0, "send:%llu,send content:%llu",
-                tc_stat.packs_sent_cnt, tc_stat.con_packs_sent_cnt);
-        tc_log_info(LOG_NOTICE, 0, "send syn:%llu, fin:%llu,reset:%llu",
-                tc_stat.conn_try_cnt, tc_stat.fin_sent_cnt,
-                tc_stat.rst_sent_cnt);
-        tc_log_info(LOG_NOTICE, 0, "reconnect:%llu,for no syn:%llu",
-                tc_stat.recon_for_closed_cnt, tc_stat.recon_for_no_syn_cnt);
-        tc_log_info(LOG_NOTICE, 0, "retransmit:%llu", tc_stat.retrans_cnt);
-        tc_log_info(LOG_NOTICE, 0, "recv packs after retransmission:%llu", 
-                tc_stat.retrans_succ_cnt);
-        tc_log_info(LOG_NOTICE, 0, "syn cnt:%llu,all clt:%llu,clt cont:%llu",
-                tc_stat.clt_syn_cnt, tc_stat.clt_packs_cnt, 
-                tc_stat.clt_cont_cnt);
-        tc_log_info(LOG_NOTICE, 0, "total cont retransmit:%llu, frag:%llu",
-                tc_stat.clt_con_retrans_cnt, tc_stat.frag_cnt);
-        tc_log_info(LOG_NOTICE, 0, "total captured packets:%llu",
-                tc_stat.captured_cnt);
-
-        if ((tc_time() - tc_stat.start_pt) > 3) {
-            if (sess_table->total > 0) {
-                ratio = 100 * tc_stat.conn_cnt / sess_table->total;
-                if (ratio < 80) {
-                    tc_log_info(LOG_WARN, 0, 
-                            "many connections can't be established");
-                }
+    tc_log_info(LOG_NOTICE, 0, "active:%u,rel:%llu,obs del:%llu,tw:%llu",
+            active, stat->leave_cnt, stat->obs_cnt, 
+            stat->time_wait_cnt);
+    tc_log_info(LOG_NOTICE, 0, "conns:%llu,resp:%llu,c-resp:%llu",
+            stat->conn_cnt, stat->resp_cnt, stat->resp_cont_cnt);
+    tc_log_info(LOG_NOTICE, 0, "resp fin:%llu,resp rst:%llu",
+            stat->resp_fin_cnt, stat->resp_rst_cnt);
+    tc_log_info(LOG_NOTICE, 0, "send:%llu,send content:%llu",
+            stat->packs_sent_cnt, stat->con_packs_sent_cnt);
+    tc_log_info(LOG_NOTICE, 0, "send syn:%llu, fin:%llu,reset:%llu",
+            stat->conn_try_cnt, stat->fin_sent_cnt,
+            stat->rst_sent_cnt);
+    tc_log_info(LOG_NOTICE, 0, "reconnect:%llu,for no syn:%llu",
+            stat->recon_for_closed_cnt, stat->recon_for_no_syn_cnt);
+    tc_log_info(LOG_NOTICE, 0, "retransmit:%llu", stat->retrans_cnt);
+    tc_log_info(LOG_NOTICE, 0, "recv packs after retransmission:%llu", 
+            stat->retrans_succ_cnt);
+    tc_log_info(LOG_NOTICE, 0, "syn cnt:%llu,all clt:%llu,clt cont:%llu",
+            stat->clt_syn_cnt, stat->clt_packs_cnt, 
+            stat->clt_cont_cnt);
+    tc_log_info(LOG_NOTICE, 0, "total cont retransmit:%llu, frag:%llu",
+            stat->clt_con_retrans_cnt, stat->frag_cnt);
+    tc_log_info(LOG_NOTICE, 0, "total captured packets:%llu",
+            stat->captured_cnt);
+
+    if ((tc_time() - stat->start_pt) > 3) {
+        if (active > 0) {
+            ratio = 100 * stat->conn_cnt / active;
+            if (ratio < 80) {
+                tc_log_info(LOG_WARN, 0, 
+                        "many connections can't be established");
             }
         }
+    }
+}
+
+
+void
+tc_output_stat(void)
+{
+#if (TC_THREADS)
+    if (clt_settings.workers) {
+        tc_workers_output_stat();
+        return;
+    }
+#endif
+
+    if (tc_stat.start_pt != 0) {
+        tc_output_sess_stat(&tc_stat, sess_table->total);
+        tc_log_info(LOG_NOTICE, 0, "slab chunks:%u,large:%u,objs in use:%llu",
+                sess_slab->chunks, sess_slab->large_cnt, 
+                sess_slab->alloc_cnt - sess_slab->free_cnt);
+        tc_event_output_stat(&event_loop);
     } 
 }
 
@@ -2293,14 +2519,29 @@ tc_interval_disp(tc_event_timer_t *ev)
 void 
 tc_save_pack(tc_sess_t *s, link_list *list, tc_iph_t *ip, tc_tcph_t *tcp)
 {
-    unsigned char  *pkt = (unsigned char *) cp_fr_ip_pack(s->pool, ip);
-    p_link_node     ln  = link_node_malloc(s->pool, pkt);
+    uint16_t        tot_len;
+    p_link_node     ln;
+    unsigned char  *pkt;
 
-    if (ln != NULL) {
-        ln->key = ntohl(tcp->seq);
-        link_list_append_by_order(list, ln);
+    /* slide window packets churn, keep them off the session pool */
+    tot_len = ntohs(ip->tot_len);
+    pkt = (unsigned char *) tc_slab_alloc(sess_slab, 
+            ETHERNET_HDR_LEN + tot_len);
+    ln  = (p_link_node) tc_slab_alloc(sess_slab, sizeof(link_node));
+
+    if (pkt == NULL || ln == NULL) {
+        tc_slab_free(sess_slab, pkt);
+        tc_slab_free(sess_slab, ln);
+        tc_log_info(LOG_ERR, 0, "save pack failed,p:%u", ntohs(s->src_port));
+        return;
     }
 
+    memcpy(pkt + ETHERNET_HDR_LEN, ip, tot_len);
+    tc_memzero(ln, sizeof(link_node));
+    ln->data = pkt;
+    ln->key  = ntohl(tcp->seq);
+    link_list_append_by_order(list, ln);
+
     tc_log_debug4(LOG_INFO, 0, "ln:%llu, pkt:%llu, save:%u,p:%u", ln, pkt, 
             ln->key, ntohs(s->src_port));
 }
@@ -2321,9 +2562,10 @@ proc_clt_pack_directly(tc_sess_t *s, tc_iph_t *ip, tc_tcph_t *tcp)
     }
 #endif
     seq  = ntohl(tcp->seq);
-    diff = tc_time() - s->create_time;
-    if (diff < TCP_MS_TIMEOUT && (s->sm.state & SYN_SENT)) {
-        if (before(seq, s->req_syn_seq)) {
+    /* state is hot, create_time is not */
+    if (s->sm.state & SYN_SENT) {
+        diff = tc_sess_sec_diff(tc_sess_msec(), s->create_time);
+        if (diff < TCP_MS_TIMEOUT && before(seq, s->req_syn_seq)) {
             tc_log_debug1(LOG_INFO, 0, "timeout pack,p:%u", ntohs(s->src_port));
             return;
         }
@@ -2349,6 +2591,12 @@ proc_clt_pack_directly(tc_sess_t *s, tc_iph_t *ip, tc_tcph_t *tcp)
         }
     }
 
+#if (TC_OFFLINE)
+    if (s->sm.parked) {
+        return;
+    }
+#endif
+
     proc_clt_pack_from_buffer(s);
 }
 
@@ -2409,6 +2657,116 @@ proc_clt_pack_from_buffer(tc_sess_t *s)
 }
 
 
+#if (TC_OFFLINE)
+/* 
+ * a new session takes a slot of the closed loop replay if one is free,
+ * or else its packets are kept until a session holding one is over.
+ * It returns TC_OK with a slot, TC_AGAIN if parked and TC_ERR if the
+ * session could not be parked and is dropped.
+ */
+static int
+sess_loop_park(tc_sess_t *s, tc_iph_t *ip, tc_tcph_t *tcp)
+{
+    if (loop_live < loop_limit) {
+        s->sm.loop_slot = 1;
+        loop_live++;
+        __atomic_add_fetch(&tc_loop_live, 1, __ATOMIC_RELAXED);
+        return TC_OK;
+    }
+
+    s->park_node = link_node_malloc(s->pool, s);
+    if (s->park_node == NULL) {
+        /* nothing has been sent for it, no reset either */
+        s->sm.sess_over = 1;
+        sess_post_disp(s, true);
+        return TC_ERR;
+    }
+
+    s->sm.parked = 1;
+    link_list_append(parked_sess, s->park_node);
+    __atomic_add_fetch(&tc_loop_parked, 1, __ATOMIC_RELAXED);
+
+    proc_clt_pack_directly(s, ip, tcp);
+
+    return TC_AGAIN;
+}
+
+
+/* tells if the first packet kept is a syn */
+static bool
+sess_kept_syn(tc_sess_t *s)
+{
+    tc_iph_t     *ip;
+    tc_tcph_t    *tcp;
+    p_link_node   ln;
+
+    ln = link_list_first(s->slide_win_packs);
+    if (ln == NULL) {
+        return false;
+    }
+
+    ip  = (tc_iph_t *) ((char *) ln->data + ETHERNET_HDR_LEN);
+    tcp = (tc_tcph_t *) ((char *) ip + (ip->ihl << 2));
+
+    return tcp->syn;
+}
+
+
+/* the session leaves the closed loop, its slot goes to the next one */
+static void
+sess_loop_release(tc_sess_t *s)
+{
+    uint32_t     now;
+    p_link_node  ln;
+
+    if (s->sm.parked) {
+        s->sm.parked = 0;
+        link_list_remove(parked_sess, s->park_node);
+        __atomic_sub_fetch(&tc_loop_parked, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    s->sm.loop_slot = 0;
+    loop_live--;
+    __atomic_sub_fetch(&tc_loop_live, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&tc_loop_done, 1, __ATOMIC_RELAXED);
+
+    while (loop_live < loop_limit 
+            && (ln = link_list_first(parked_sess)) != NULL) 
+    {
+        s = ln->data;
+        link_list_remove(parked_sess, ln);
+        __atomic_sub_fetch(&tc_loop_parked, 1, __ATOMIC_RELAXED);
+
+        s->sm.parked    = 0;
+        s->sm.loop_slot = 1;
+        loop_live++;
+        __atomic_add_fetch(&tc_loop_live, 1, __ATOMIC_RELAXED);
+
+        /* the session starts now, not when it was captured */
+        now = tc_sess_msec();
+        s->create_time      = now;
+        s->rep_rcv_con_time = now;
+        s->req_snd_con_time = now;
+        if (s->gc_ev != NULL) {
+            tc_event_update_timer(s->gc_ev, SESS_EST_MS_TIMEOUT);
+        }
+
+        tc_log_debug1(LOG_DEBUG, 0, "unpark:%u", ntohs(s->src_port));
+
+#if (!TC_SINGLE)
+        /* without a syn it is told to the intercept by fake_syn */
+        if (!sess_kept_syn(s) || send_router_info(s, CLIENT_ADD)) {
+            proc_clt_pack_from_buffer(s);
+        }
+#else
+        proc_clt_pack_from_buffer(s);
+#endif
+    }
+}
+#endif
+
+
 /*
  * 处理抓到的包
  * 其实就是发出去,发给测试机
@@ -2417,6 +2775,9 @@ bool
 tc_proc_ingress(tc_iph_t *ip, tc_tcph_t *tcp)
 {
     int          rtt;
+#if (TC_OFFLINE)
+    int          status;
+#endif
     bool         larger_seq_detected;
     uint64_t     key;
     tc_sess_t   *s;
@@ -2482,6 +2843,15 @@ tc_proc_ingress(tc_iph_t *ip, tc_tcph_t *tcp)
                     return false;
                 }
                 s->rtt = rtt;
+#if (TC_OFFLINE)
+                /* one faking its syn counts against -j as well */
+                if (parked_sess != NULL) {
+                    status = sess_loop_park(s, ip, tcp);
+                    if (status != TC_OK) {
+                        return status == TC_AGAIN;
+                    }
+                }
+#endif
                 proc_clt_pack_directly(s, ip, tcp);
             } else {
 #if (TC_PLUGIN)
@@ -2501,6 +2871,11 @@ tc_proc_ingress(tc_iph_t *ip, tc_tcph_t *tcp)
         if (s) {
             if (s->sm.timeout) {
                 sess_post_disp(s, true);
+#if (TC_OFFLINE)
+            } else if (s->sm.parked) {
+                /* a retransmitted syn, the first one is kept */
+                return false;
+#endif
             } else {
                 if (ntohl(tcp->seq) != s->req_syn_seq) {
                     s->sm.rcv_nxt_sess = 1;
@@ -2514,6 +2889,15 @@ tc_proc_ingress(tc_iph_t *ip, tc_tcph_t *tcp)
             return false;
         }
 
+#if (TC_OFFLINE)
+        if (parked_sess != NULL) {
+            status = sess_loop_park(s, ip, tcp);
+            if (status != TC_OK) {
+                return status == TC_AGAIN;
+            }
+        }
+#endif
+
 #if (!TC_SINGLE)
         if (send_router_info(s, CLIENT_ADD)) {
             proc_clt_pack_directly(s, ip, tcp);
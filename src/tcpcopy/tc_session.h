@@ -19,8 +19,10 @@ bool tc_proc_ingress(tc_iph_t *, tc_tcph_t *);
 bool tc_proc_outgress(unsigned char *);
 uint32_t get_tf_ip(uint16_t key);
 bool tc_check_ingress_pack_needed(tc_iph_t *);
+bool tc_check_ingress_ack_needed(tc_iph_t *, tc_tcph_t *);
 void tc_interval_disp(tc_event_timer_t *);
 void tc_output_stat(void);
+void tc_output_sess_stat(tc_stat_t *, uint32_t);
 
 
 typedef struct sess_state_machine_s{
@@ -61,6 +63,13 @@ typedef struct sess_state_machine_s{
     uint32_t rtt_cal:2;
     uint32_t rep_payload_type:2;
     uint32_t rep_dup_ack_cnt:8;
+#if (!TC_SINGLE)
+    uint32_t in_range:1;            /* a -c client registered by range */
+#endif
+#if (TC_OFFLINE)
+    uint32_t parked:1;              /* waits for a closed loop slot */
+    uint32_t loop_slot:1;           /* holds one */
+#endif
 #if (TC_DETECT_MEMORY)
     uint32_t active_timer_cnt:8;
     uint32_t call_sess_post_cnt:8;
@@ -74,7 +83,17 @@ typedef struct pack_info_s {
     uint32_t ack_seq;
 }pack_info_t;
 
+/*
+ * The session is laid out by access frequency.  The first cache line holds
+ * the sequence state that proc_clt_pack and proc_bak_pack touch on every
+ * packet, the second one the rest of the per-packet state together with
+ * the slide window and timer pointers, the frame every packet sent is
+ * built in and the rtt the timers of the send path are set from.
+ * Everything from "pool" on is only used at session setup, on timeouts
+ * or by rarely taken paths.
+ */
 struct tc_sess_s {
+    /* cache line 0 */
     sess_state_machine_t sm; 
 
     pack_info_t cur_pack;
@@ -84,79 +103,97 @@ struct tc_sess_s {
     /* next sequence that is sent to backend (host byte order) */
     uint32_t target_nxt_seq;
 
+    /* response variables */
+    /* last acknowledgement seq from backend response (host byte order) */
+    uint32_t rep_ack_seq;
+    /* last seq from backend response (host byte order) */
+    uint32_t rep_seq;
+
+    /* captured variables(host byte order) */
+    /* only refer to online values */
+    /***********************begin************************/
+    uint32_t req_exp_seq;
+    /* last sequence of client content packet which has been sent */
+    uint32_t req_con_snd_seq;
     /* max payload packet sequence (host byte order) */
     uint32_t max_con_seq;
+    /* last ack sequence of client packet which is sent to bakend */
+    uint32_t req_ack_snd_seq;
+    /* last client content packet's ack sequence which is captured */
+    uint32_t req_con_ack_seq;
+    uint32_t req_con_cur_ack_seq;
+    /***********************end***************************/
+
+    uint32_t peer_window;
+
+    /* cache line 1 */
+    uint32_t ts_ec_r;
+    uint32_t ts_value;
 
     /* src or client ip address(network byte order) */
     uint32_t src_addr;
     /* dst or backend ip address(network byte order) */
     uint32_t dst_addr;
-    /* online ip address(network byte order) */
-    uint32_t online_addr; 
     /* src or client port(network byte order) */
     uint16_t src_port;
     /* dst or backend port(network byte order) */
     uint16_t dst_port;
-    /* online port(network byte order) */
-    uint16_t online_port;
     uint16_t req_ip_id;
     uint16_t wscale;
-    
-    uint32_t peer_window;
-    uint32_t ts_ec_r;
-    uint32_t ts_value;
 
-    /* captured variables(host byte order) */
-    /* only refer to online values */
-    /***********************begin************************/
-    /* last sequence of client content packet which has been sent */
-    uint32_t req_con_snd_seq;
-    uint32_t req_exp_seq;
-    /* last ack sequence of client packet which is sent to bakend */
-    uint32_t req_ack_snd_seq;
-    /* last client content packet's ack sequence which is captured */
-    uint32_t req_con_ack_seq;
-    uint32_t req_con_cur_ack_seq;
+    link_list *slide_win_packs;
+    link_node *prev_snd_node;
+    tc_event_timer_t *ev;
+    unsigned char *frame;
+    long     rtt;
+
+    /* cold part */
+    tc_pool_t *pool;
+
+    /* millisecond ticks, see tc_sess_msec() */
+    /* time of sending the last content packet */
+    uint32_t req_snd_con_time;
+    /* time of last receiving backend content */
+    uint32_t rep_rcv_con_time;
+    uint32_t create_time;
+    uint32_t pack_lost_time;
+
     /* last syn sequence of client packet */
     uint32_t req_syn_seq;
     uint32_t req_hop_seq;
-    /***********************end***************************/
-
-    /* response variables */
-    /* last acknowledgement seq from backend response (host byte order) */
-    uint32_t rep_ack_seq;
-    /* last seq from backend response (host byte order) */
-    uint32_t rep_seq;
 #if (TC_DEBUG)
     uint32_t rep_ack_seq_bf_fin;
 #endif
 
+    /* online ip address(network byte order) */
+    uint32_t online_addr; 
+    /* online port(network byte order) */
+    uint16_t online_port;
+
     /* hash key for this session */
     uint64_t hash_key;
 
-    long     rtt;
-    time_t   create_time;
-    /* time of sending the last content packet */
-    time_t   req_snd_con_time;
-    time_t   pack_lost_time;
-    /* time of last receiving backend content */
-    time_t   rep_rcv_con_time;
-
-    unsigned char *frame;
     unsigned char *src_mac;
     unsigned char *dst_mac;
 
-    link_list *slide_win_packs;
-    link_node *prev_snd_node;
-
 #if (TC_PLUGIN)
     void             *data;
 #endif
-    tc_event_timer_t *ev;
+#if (TC_OFFLINE)
+    link_node        *park_node;
+#endif
     tc_event_timer_t *gc_ev;
-    tc_pool_t *pool;
 };
 
+#define TC_SESS_HOT_SIZE  offsetof(tc_sess_t, pool)
+
+/* 
+ * session timestamps are 32-bit millisecond ticks, only differences 
+ * between them are meaningful
+ */
+#define tc_sess_msec()  ((uint32_t) tc_milliscond_time())
+#define tc_sess_sec_diff(now, t)  ((int) ((uint32_t) ((now) - (t)) / 1000))
+
 
 #endif   /* ----- #ifndef TC_SESSION_INCLUDED ----- */
 
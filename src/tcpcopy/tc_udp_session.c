@@ -67,6 +67,7 @@ tc_output_stat()
     tc_log_info(LOG_INFO, 0, 
             "udp packets captured:%llu,packets sent:%llu",
             clt_udp_cnt, clt_udp_send_cnt);
+    tc_event_output_stat(&event_loop);
 }
 
 
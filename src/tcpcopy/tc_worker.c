@@ -0,0 +1,562 @@
+#include <xcopy.h>
+#include <tcpcopy.h>
+
+static tc_worker_t  *workers;
+static int           worker_num;        /* threads started */
+static sem_t         workers_ready;
+#if (TC_OFFLINE)
+static struct timespec  tc_worker_nap = {0, 50000};
+#endif
+
+/* the worker of the calling thread and the workers it has to wake up */
+static tc_thread_local tc_worker_t  *worker_self;
+static tc_thread_local uint64_t      pack_kicks;
+static tc_thread_local uint64_t      resp_kicks;
+
+
+static inline tc_worker_t *
+tc_worker_of(uint32_t ip, uint16_t port)
+{
+    uint64_t key;
+
+    key = get_key(ip, port) * 0x9E3779B97F4A7C15ULL;
+
+    return &workers[(key >> 32) % clt_settings.workers];
+}
+
+
+static void
+tc_worker_kick(int fd)
+{
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        tc_log_info(LOG_ERR, errno, "kick worker failed:%d", fd);
+    }
+}
+
+
+/* wake up the workers that got packets or responses from this thread */
+void
+tc_workers_kick(void)
+{
+    int i;
+
+    while (pack_kicks) {
+        i = __builtin_ctzll(pack_kicks);
+        pack_kicks &= pack_kicks - 1;
+        tc_worker_kick(workers[i].pack_fd);
+    }
+
+    while (resp_kicks) {
+        i = __builtin_ctzll(resp_kicks);
+        resp_kicks &= resp_kicks - 1;
+        tc_worker_kick(workers[i].resp_fd);
+    }
+}
+
+
+bool
+tc_worker_dispatch(tc_iph_t *ip, tc_tcph_t *tcp, bool orig)
+{
+    u_char       *p;
+    uint16_t      port, tot_len;
+    uint32_t      type;
+    tc_worker_t  *w;
+
+    if (tc_stat.start_pt == 0) {
+        tc_stat.start_pt = tc_time();
+    }
+
+    /* sessions are keyed by the shifted port, see tc_proc_ingress */
+    port = tcp->source;
+    if (clt_settings.factor) {
+        port = get_port_from_shift(port, clt_settings.rand_port_shifted,
+                clt_settings.factor);
+    }
+
+    w = tc_worker_of(ip->saddr, port);
+    tot_len = ntohs(ip->tot_len);
+
+    /* only the owner knows whether a pure ack is needed */
+    type = TC_WORKER_PACK;
+    if (orig && !tcp->syn
+            && tot_len == (ip->ihl << 2) + (tcp->doff << 2))
+    {
+        type = TC_WORKER_PACK_ACK;
+    }
+
+    p = tc_ring_reserve(&w->packs, tot_len, type);
+
+#if (TC_OFFLINE)
+    /* nothing has to be dropped offline, reading waits for the worker */
+    while (p == NULL && !tc_over) {
+        tc_worker_kick(w->pack_fd);
+        nanosleep(&tc_worker_nap, NULL);
+        p = tc_ring_reserve(&w->packs, tot_len, type);
+    }
+#endif
+
+    if (p == NULL) {
+        w->pack_drops++;
+        return false;
+    }
+
+    memcpy(p, ip, tot_len);
+    tc_ring_commit(&w->packs);
+    pack_kicks |= (uint64_t) 1 << w->id;
+
+    return true;
+}
+
+
+/* returns true if the response belongs to another worker */
+bool
+tc_worker_pass_resp(unsigned char *msg)
+{
+    u_char       *p;
+    tc_iph_t     *ip;
+    tc_tcph_t    *tcp;
+    tc_worker_t  *w;
+
+    if (worker_self == NULL) {
+        return false;
+    }
+
+    ip  = (tc_iph_t *) msg;
+    tcp = (tc_tcph_t *) ((char *) ip + (ip->ihl << 2));
+
+    w = tc_worker_of(ip->daddr, tcp->dest);
+    if (w == worker_self) {
+        return false;
+    }
+
+    p = tc_ring_reserve(&w->resps[worker_self->id], MSG_SERVER_SIZE, 0);
+    if (p == NULL) {
+        worker_self->resp_drops++;
+        return true;
+    }
+
+    memcpy(p, msg, MSG_SERVER_SIZE);
+    tc_ring_commit(&w->resps[worker_self->id]);
+    worker_self->resp_passed++;
+    resp_kicks |= (uint64_t) 1 << w->id;
+
+    return true;
+}
+
+
+static void
+tc_worker_reset_kick(tc_event_t *rev)
+{
+    uint64_t cnt;
+
+    /* reset before draining, so that later kicks are not lost */
+    if (read(rev->fd, &cnt, sizeof(cnt)) == -1 && errno != EAGAIN) {
+        tc_log_info(LOG_ERR, errno, "read eventfd:%d", rev->fd);
+    }
+}
+
+
+static int
+tc_worker_proc_packs(tc_event_t *rev)
+{
+    int           n, budget;
+    uint32_t      len, type;
+    tc_iph_t     *ip;
+    tc_tcph_t    *tcp;
+    tc_worker_t  *w;
+
+    w = worker_self;
+    tc_worker_reset_kick(rev);
+
+    budget = tc_event_budget(rev);
+    for (n = 0; n < budget; n++) {
+        ip = tc_ring_peek(&w->packs, &len, &type);
+        if (ip == NULL) {
+            break;
+        }
+
+        tcp = (tc_tcph_t *) ((char *) ip + (ip->ihl << 2));
+        if (type != TC_WORKER_PACK_ACK
+                || tc_check_ingress_ack_needed(ip, tcp))
+        {
+            tc_proc_ingress(ip, tcp);
+        }
+
+        tc_ring_consume(&w->packs);
+    }
+
+    tc_event_consumed(rev, n);
+
+    if (n == budget) {
+        /* the rest is processed in the next round */
+        tc_event_backlog(rev, tc_ring_used(&w->packs));
+        tc_worker_kick(rev->fd);
+    }
+
+    return TC_OK;
+}
+
+
+static int
+tc_worker_proc_resps(tc_event_t *rev)
+{
+    int            i, n, budget;
+    uint32_t       len;
+    unsigned char *msg;
+    tc_worker_t   *w;
+
+    w = worker_self;
+    tc_worker_reset_kick(rev);
+
+    n = 0;
+    budget = tc_event_budget(rev);
+    for (i = 0; i < clt_settings.workers && n < budget; i++) {
+        while (n < budget) {
+            msg = tc_ring_peek(&w->resps[i], &len, NULL);
+            if (msg == NULL) {
+                break;
+            }
+
+            tc_proc_outgress(msg);
+            tc_ring_consume(&w->resps[i]);
+            n++;
+        }
+    }
+
+    tc_event_consumed(rev, n);
+
+    if (n == budget) {
+        tc_worker_kick(rev->fd);
+    }
+
+    return TC_OK;
+}
+
+
+static int
+tc_worker_init(tc_worker_t *w)
+{
+    tc_event_t *ev;
+
+    tc_raw_socket_out = TC_INVALID_SOCK;
+    tc_time_init();
+    tc_event_timer_init();
+
+    if (tc_event_loop_init(&event_loop, MAX_FD_NUM) == TC_EVENT_ERROR) {
+        tc_log_info(LOG_ERR, 0, "worker %d: event loop init failed", w->id);
+        return TC_ERR;
+    }
+
+    event_loop.busy_poll = clt_settings.busy_poll;
+
+    w->loop = &event_loop;
+    w->stat = &tc_stat;
+    real_servers = &w->servers;
+
+    if (tcp_copy_replay_init(&event_loop) == TC_ERR) {
+        return TC_ERR;
+    }
+
+    w->sess_table = sess_table;
+
+    if (tc_packets_output_init() == TC_ERR) {
+        return TC_ERR;
+    }
+
+    ev = tc_event_create(event_loop.pool, w->pack_fd, tc_worker_proc_packs,
+            NULL);
+    if (ev == NULL) {
+        return TC_ERR;
+    }
+
+    if (tc_event_add(&event_loop, ev, TC_EVENT_READ) == TC_EVENT_ERROR) {
+        return TC_ERR;
+    }
+
+    ev = tc_event_create(event_loop.pool, w->resp_fd, tc_worker_proc_resps,
+            NULL);
+    if (ev == NULL) {
+        return TC_ERR;
+    }
+
+    ev->prio = TC_EVENT_PRIO_HIGH;
+    if (tc_event_add(&event_loop, ev, TC_EVENT_READ) == TC_EVENT_ERROR) {
+        return TC_ERR;
+    }
+
+    return TC_OK;
+}
+
+
+static void
+tc_worker_exit(tc_worker_t *w)
+{
+    int       i, j;
+    conns_t  *conns;
+
+    w->sess_table = NULL;
+    tc_dest_sess_table();
+
+    for (i = 0; i < w->servers.num; i++) {
+        conns = &w->servers.conns[i];
+        for (j = 0; j < conns->num; j++) {
+            if (conns->fds[j] > 0) {
+                tc_socket_close(conns->fds[j]);
+                conns->fds[j] = -1;
+            }
+        }
+    }
+
+    if (tc_raw_socket_out > 0) {
+        tc_socket_close(tc_raw_socket_out);
+        tc_raw_socket_out = TC_INVALID_SOCK;
+    }
+
+#if (TC_PCAP_SND)
+    tc_pcap_over();
+#endif
+
+    if (w->loop != NULL) {
+        tc_event_loop_finish(&event_loop);
+    }
+}
+
+
+static void *
+tc_worker_cycle(void *arg)
+{
+    tc_worker_t *w = arg;
+
+    worker_self = w;
+
+    /* the first cpu is left to the capturing thread if there are more */
+    if (clt_settings.cpu_num) {
+        tc_cpu_bind(clt_settings.cpus[(w->id + 1) % clt_settings.cpu_num]);
+    }
+
+    w->status = tc_worker_init(w);
+    sem_post(&workers_ready);
+
+    if (w->status == TC_OK) {
+        tc_log_info(LOG_NOTICE, 0, "worker %d started", w->id);
+        tc_event_proc_cycle(&event_loop);
+    }
+
+    /* one worker stopping stops them all */
+    if (!tc_over) {
+        tc_over = SIGRTMAX;
+    }
+
+    /* keep the statistics around until they have been collected */
+    sem_post(&w->stopped);
+    sem_wait(&w->release);
+
+    tc_worker_exit(w);
+
+    return NULL;
+}
+
+
+int
+tc_workers_init(void)
+{
+    int           i, j, n, ret;
+    sigset_t      set, old;
+    tc_worker_t  *w;
+
+    n = clt_settings.workers;
+
+    workers = tc_memalign(TC_CPU_CACHE_LINE, n * sizeof(tc_worker_t));
+    if (workers == NULL) {
+        return TC_ERR;
+    }
+    tc_memzero(workers, n * sizeof(tc_worker_t));
+
+    sem_init(&workers_ready, 0, 0);
+
+    /* all rings exist before any worker may use them */
+    for (i = 0; i < n; i++) {
+        w = &workers[i];
+        w->id = i;
+        w->servers = clt_settings.real_servers;
+        sem_init(&w->stopped, 0, 0);
+        sem_init(&w->release, 0, 0);
+
+        w->pack_fd = eventfd(0, EFD_NONBLOCK);
+        w->resp_fd = eventfd(0, EFD_NONBLOCK);
+        if (w->pack_fd == -1 || w->resp_fd == -1) {
+            tc_log_info(LOG_ERR, errno, "eventfd failed");
+            return TC_ERR;
+        }
+
+        if (tc_ring_init(&w->packs, TC_WORKER_RING_SIZE) != TC_OK) {
+            return TC_ERR;
+        }
+
+        w->resps = tc_alloc(n * sizeof(tc_ring_t));
+        if (w->resps == NULL) {
+            return TC_ERR;
+        }
+        tc_memzero(w->resps, n * sizeof(tc_ring_t));
+
+        for (j = 0; j < n; j++) {
+            if (j != i && tc_ring_init(&w->resps[j], TC_WORKER_RESP_RING_SIZE)
+                    != TC_OK)
+            {
+                return TC_ERR;
+            }
+        }
+    }
+
+    /* signals go to the capturing thread */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+
+    for (i = 0; i < n; i++) {
+        w = &workers[i];
+
+        ret = pthread_create(&w->thread, NULL, tc_worker_cycle, w);
+        if (ret != 0) {
+            tc_log_info(LOG_ERR, ret, "pthread_create failed");
+            break;
+        }
+        worker_num++;
+
+        /* one by one, so that failures are seen here */
+        sem_wait(&workers_ready);
+        if (w->status != TC_OK) {
+            tc_log_info(LOG_ERR, 0, "worker %d init failed", i);
+            break;
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return i == n ? TC_OK : TC_ERR;
+}
+
+
+/* waits until all workers have left their event loops */
+void
+tc_workers_stop(void)
+{
+    int i;
+
+    if (!tc_over) {
+        tc_over = SIGRTMAX;
+    }
+
+    for (i = 0; i < worker_num; i++) {
+        sem_wait(&workers[i].stopped);
+    }
+}
+
+
+void
+tc_workers_release(void)
+{
+    int           i, j;
+    tc_worker_t  *w;
+
+    if (workers == NULL) {
+        return;
+    }
+
+    for (i = 0; i < worker_num; i++) {
+        sem_post(&workers[i].release);
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    for (i = 0; i < clt_settings.workers; i++) {
+        w = &workers[i];
+
+        if (w->pack_fd > 0) {
+            close(w->pack_fd);
+        }
+        if (w->resp_fd > 0) {
+            close(w->resp_fd);
+        }
+
+        tc_ring_destroy(&w->packs);
+        if (w->resps != NULL) {
+            for (j = 0; j < clt_settings.workers; j++) {
+                tc_ring_destroy(&w->resps[j]);
+            }
+            tc_free(w->resps);
+        }
+
+        sem_destroy(&w->stopped);
+        sem_destroy(&w->release);
+    }
+
+    sem_destroy(&workers_ready);
+
+    tc_free(workers);
+    workers = NULL;
+    worker_num = 0;
+}
+
+
+void
+tc_workers_output_stat(void)
+{
+    int           i;
+    size_t        j;
+    uint32_t      active;
+    uint64_t     *sum, *cnt;
+    tc_stat_t     total;
+    tc_worker_t  *w;
+
+    /* what the capturing thread counted */
+    total  = tc_stat;
+    active = 0;
+
+    for (i = 0; i < worker_num; i++) {
+        w = &workers[i];
+        if (w->stat == NULL) {
+            continue;
+        }
+
+        /* all counters are uint64_t and come before start_pt */
+        sum = (uint64_t *) &total;
+        cnt = (uint64_t *) w->stat;
+        for (j = 0; j < offsetof(tc_stat_t, start_pt) / sizeof(uint64_t); j++)
+        {
+            sum[j] += cnt[j];
+        }
+
+        if (w->sess_table != NULL) {
+            active += w->sess_table->total;
+        }
+    }
+
+    if (total.start_pt == 0) {
+        return;
+    }
+
+    tc_output_sess_stat(&total, active);
+
+    for (i = 0; i < worker_num; i++) {
+        w = &workers[i];
+        if (w->loop == NULL || w->sess_table == NULL) {
+            continue;
+        }
+
+        tc_log_info(LOG_NOTICE, 0, "worker %d: active:%u,queued:%llu,"
+                "peak queued:%u,drops:%llu,resp passed:%llu,resp drops:%llu",
+                i, w->sess_table->total, tc_ring_used(&w->packs),
+                w->loop->stat.max_depth[TC_EVENT_PRIO_LOW],
+                w->pack_drops, w->resp_passed, w->resp_drops);
+        tc_log_info(LOG_NOTICE, 0, "worker %d: exhausted resp:%llu,"
+                "timers:%llu,packs:%llu,spins:%llu,sleeps:%llu", i,
+                w->loop->stat.exhausted[TC_EVENT_PRIO_HIGH],
+                w->loop->stat.timer_exhausted,
+                w->loop->stat.exhausted[TC_EVENT_PRIO_LOW],
+                w->loop->stat.spins, w->loop->stat.sleeps);
+    }
+
+    tc_event_output_stat(&event_loop);
+}
+
@@ -0,0 +1,62 @@
+#ifndef  TC_WORKER_INCLUDED
+#define  TC_WORKER_INCLUDED
+
+#include <xcopy.h>
+#include <tcpcopy.h>
+
+/*
+ * Sharded replay workers.
+ *
+ * The capturing thread filters packets as before and hands every packet
+ * over a ring to the worker owning its session, chosen by hashing the
+ * client address the session is keyed by.  Each worker runs its own event
+ * loop with its own session table, timers, sending socket and intercept
+ * connections, so replaying needs no locks.  Responses reaching a worker
+ * that does not own their session are passed on to the owner over one
+ * ring per pair of workers.
+ */
+
+#define TC_MAX_WORKERS             64
+#define TC_WORKER_RING_SIZE        (8 * 1024 * 1024)
+#define TC_WORKER_RESP_RING_SIZE   (256 * 1024)
+
+/* record types in the packet ring */
+#define TC_WORKER_PACK             0
+#define TC_WORKER_PACK_ACK         1    /* a pure ack of a captured packet */
+
+typedef struct tc_worker_s tc_worker_t;
+
+struct tc_worker_s {
+    tc_ring_t          packs;         /* fed by the capturing thread */
+    tc_ring_t         *resps;         /* resps[i] is fed by worker i */
+
+    int                id;
+    int                status;
+    int                pack_fd;       /* eventfd kicked for packs */
+    int                resp_fd;       /* eventfd kicked for resps */
+    pthread_t          thread;
+    sem_t              stopped;
+    sem_t              release;
+
+    /* owned by the worker, read by the capturing thread for statistics */
+    real_ip_addr_t     servers;
+    tc_stat_t         *stat;
+    hash_table        *sess_table;
+    tc_event_loop_t   *loop;
+    uint64_t           resp_passed;
+    uint64_t           resp_drops;
+
+    /* written by the capturing thread */
+    uint64_t           pack_drops;
+};
+
+
+int  tc_workers_init(void);
+void tc_workers_stop(void);
+void tc_workers_release(void);
+void tc_workers_kick(void);
+void tc_workers_output_stat(void);
+bool tc_worker_dispatch(tc_iph_t *ip, tc_tcph_t *tcp, bool orig);
+bool tc_worker_pass_resp(unsigned char *msg);
+
+#endif /* TC_WORKER_INCLUDED */
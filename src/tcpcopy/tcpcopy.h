@@ -20,6 +20,25 @@ typedef struct {
     transfer_map_t **map;     /*转发信息*/
 } transfer_maps_t;
 
+typedef struct {
+    uint32_t      first;
+    uint32_t      last;
+} clt_range_t;
+
+/*
+ * the ports of -c clients are cut into n slices, slice j goes through
+ * connection j of an intercept (ports in host byte order)
+ */
+#define tc_port_slice(port, n)       ((int) (((uint32_t) (port) * (n)) >> 16))
+#define tc_port_slice_first(j, n)    ((uint32_t) (((j) * 65536 + (n) - 1) / (n)))
+
+typedef struct {
+    char         *file;
+    double        speed;
+    int           weight;   /* copies of every session */
+    int           slot;     /* the port shift of its first copy */
+} tc_pcap_file_t;
+
 typedef struct real_ip_addr_s {
     int       num;
     int       active_num;
@@ -99,9 +118,11 @@ typedef struct xcopy_clt_settings {
     unsigned int  replica_num:10;       /* replicated number of each request */
     unsigned int  only_replay_full:1;  
     unsigned int  lonely:1;             /* Lonely for tcpcopy */
+    unsigned int  range_reg:1;          /* register -c clients as ranges */
     unsigned int  gradully:1;
     unsigned int  target_localhost:1;
     unsigned int  do_daemonize:1;       /* daemon flag */
+    unsigned int  use_arena:1;          /* huge page backed session memory */
     unsigned int  percentage:7;         /* percentage of the full flow that 
                                            will be tranfered to the backend */
     
@@ -109,12 +130,48 @@ typedef struct xcopy_clt_settings {
                                            If reaching this value, the session
                                            will be removed */
     int           sess_keepalive_timeout;  
+    int           arena_prefault;       /* megabytes of arena to pre-fault */
+    int           busy_poll;            /* microseconds to spin before 
+                                           blocking in poll */
+    char         *cpu_list;             /* cpus to run on */
+    char         *numa_node;            /* memory node or the nic on it */
+    int           cpu_num;
+    int           cpus[TC_MAX_CPU_LIST];
+#if (TC_THREADS)
+    int           workers;              /* replay worker threads */
+#endif
 
 #if (TC_OFFLINE)
-    int           accelerated_times;    /* accelerated times */
+    double        accelerated_times;    /* speed, below 1 slows down */
+    uint64_t      max_pps;              /* 0 for no cap */
+    int           loops;                /* passes, -1 for ever, 0 once */
+    uint32_t      loop_sess;            /* sessions in flight, see -j */
     pcap_t       *pcap;
+    struct tc_pcap_reader_s *pcap_reader; /* read ahead, or pcap */
     long          pcap_time;
     uint64_t      interval;            
+    char         *archive_file;         /* archive to write from -i */
+    unsigned      archive_zlib:1;
+    char         *raw_replay_window;
+    char         *raw_replay_clts;
+    uint64_t      replay_from;          /* microseconds into the archive */
+    uint64_t      replay_to;            /* 0 for its end */
+    int           replay_clt_num;
+    clt_range_t   replay_clts[MAX_REPLAY_CLTS]; /* host order */
+#endif
+
+#if (!TC_OFFLINE)
+    char         *raw_agent;            /* replayer to stream to, see -Y */
+    char         *raw_agent_listen;     /* [ip:]port for agents, see -y */
+    uint32_t      agent_ip;
+    uint16_t      agent_port;           /* 0 if this is no agent */
+    uint32_t      agent_listen_ip;
+    uint16_t      agent_listen_port;    /* 0 if this takes no agents */
+    unsigned      agent_zlib:1;
+    uint64_t      delay;                /* us, 0 for none, see -J */
+    char         *raw_delay_file;       /* file[:megabytes] of -X */
+    char         *delay_file;
+    uint64_t      delay_size;           /* bytes */
 #endif
 
 #if (TC_PCAP)
@@ -128,13 +185,15 @@ typedef struct xcopy_clt_settings {
     transfer_maps_t    transfer;      
 
     char         *raw_rs_list;         /* raw real server list */
-    uint64_t      tries;  
     char         *user_filter;
 #if (TC_PCAP_SND)
     char         *output_if_name;
 #endif
 #if (TC_OFFLINE)
     char         *pcap_file;            /* pcap file */
+    int           pcap_file_num;
+    int           pcap_slots;           /* port shifts a pass takes */
+    tc_pcap_file_t pcap_files[MAX_PCAP_FILES];
 #endif
     char         *raw_clt_tf_ip;        
     char         *pid_file;             /* pid file */
@@ -154,12 +213,14 @@ typedef struct xcopy_clt_settings {
     uint16_t      srv_port;            /* server listening port */
     uint16_t      rand_port_shifted;   /* random port shifted */
     uint16_t      clt_tf_ip_num;       
+    uint16_t      clt_range_num;
     uint16_t      ip_tf_cnt;
 
     real_ip_addr_t  real_servers;        /* the intercept servers */
     tc_event_t     *ev[MAX_FD_NUM];
     uint32_t        ip_tf[65536]; 
     uint32_t        clt_tf_ip[M_IP_NUM]; /* ip addr from clt to target ip */
+    clt_range_t     clt_ranges[MAX_CLT_RANGES]; /* clt_tf_ip, host order */
     unsigned char   candidate_mtu[256];
     char            filter[MAX_FILTER_LENGH];
  } xcopy_clt_settings;
@@ -192,11 +253,18 @@ typedef struct tc_stat_s {
     time_t   start_pt; 
 }tc_stat_t;
 
-extern int tc_raw_socket_out;
-extern tc_event_loop_t event_loop;
+/* with replay workers each of them has its own copy of these */
+extern tc_thread_local int tc_raw_socket_out;
+extern tc_thread_local tc_event_loop_t event_loop;
+extern tc_thread_local tc_stat_t   tc_stat;
+extern tc_thread_local hash_table *sess_table;
+extern tc_thread_local real_ip_addr_t *real_servers;
 extern xcopy_clt_settings clt_settings;
-extern tc_stat_t   tc_stat;
-extern hash_table *sess_table;
+#if (TC_OFFLINE)
+/* sessions of the closed loop replay over all threads, see -j */
+extern uint32_t tc_loop_live, tc_loop_parked;
+extern uint64_t tc_loop_done;
+#endif
 #if (TC_PLUGIN)
 extern tc_module_t  *tc_modules[];
 #endif
@@ -211,5 +279,15 @@ extern tc_module_t  *tc_modules[];
 #endif
 #include <tc_message_module.h>
 #include <tc_packets_module.h>
+#if (TC_THREADS)
+#include <tc_worker.h>
+#endif
+#if (TC_OFFLINE)
+#include <tc_pcap_reader.h>
+#include <tc_archive.h>
+#else
+#include <tc_agent.h>
+#include <tc_delay.h>
+#endif
 
 #endif /* TC_INCLUDED */
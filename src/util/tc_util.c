@@ -41,7 +41,7 @@ csum(unsigned short *pack, int len)
 } 
 
 
-static unsigned short buf[32768]; 
+static tc_thread_local unsigned short buf[32768]; 
 
 
 unsigned short
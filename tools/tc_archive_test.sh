@@ -0,0 +1,59 @@
+#!/bin/sh
+
+# archives a capture whose last packet does not fit in an archive record:
+# tcpcopy -w must drop it and keep the others.
+#
+#   tc_archive_test.sh <tcpcopy built with --offline>
+
+tcpcopy=$1
+dir=`mktemp -d /tmp/tc_archive_test.XXXXXX` || exit 1
+trap 'rm -rf $dir' 0
+
+# bytes given as numbers
+bytes() {
+    for b in "$@"; do
+        printf "\\`printf %03o $b`"
+    done
+}
+
+# a little endian 32 bit number
+u32() {
+    bytes `expr $1 % 256` `expr $1 / 256 % 256` \
+          `expr $1 / 65536 % 256` `expr $1 / 16777216`
+}
+
+# a pcap record of a tcp packet from 10.9.0.1:10000 to 10.0.0.1:80
+packet() {
+    ip_len=$1
+    u32 1; u32 0; u32 `expr $ip_len + 14`; u32 `expr $ip_len + 14`
+    bytes 0 0 0 0 0 0 17 17 17 17 17 17 8 0
+    bytes 69 0 `expr $ip_len / 256 % 256` `expr $ip_len % 256` 0 1 0 0 \
+          64 6 0 0 10 9 0 1 10 0 0 1
+    bytes 39 16 0 80 0 0 3 232 0 0 0 1 80 16 255 255 0 0 0 0
+    head -c `expr $ip_len - 40` /dev/zero
+}
+
+{
+    u32 2712847316; bytes 2 0 4 0; u32 0; u32 0; u32 262144; u32 1
+
+    # the block is nearly full when the large one comes
+    i=0
+    while [ $i -lt 17 ]; do
+        packet 60000
+        i=`expr $i + 1`
+    done
+    packet 200000
+} > $dir/in.pcap
+
+$tcpcopy -x 80-10.0.0.2:8080 -s 127.0.0.1 -i $dir/in.pcap \
+    -w $dir/out.tca -l $dir/log > $dir/out 2>&1
+ret=$?
+
+if [ $ret -ne 0 ] || ! grep -q "17 of 18 packets" $dir/log; then
+    echo "archive test failed, tcpcopy exited with $ret"
+    cat $dir/out
+    grep archive $dir/log
+    exit 1
+fi
+
+echo "archive test passed"
@@ -0,0 +1,296 @@
+
+/*
+ * Slab allocator benchmark.
+ *
+ * Replays the allocation pattern of replayed sessions: every session
+ * gets its own pool and the session struct, then every captured packet
+ * is saved as a frame and a list node until the backend acknowledges it,
+ * and the session pool is destroyed at the end.  The frames and nodes
+ * go either through the session pool (tc_palloc/tc_pfree, as before the
+ * slab) or through a shared slab (tc_slab_alloc/tc_slab_free) with the
+ * session pools on it, as tcpcopy does now.
+ *
+ * Each mode runs in its own process so that its peak resident size can
+ * be reported as well.  It is built with "make bench":
+ *
+ *   tc_slab_bench [-s sessions] [-p packets] [-w window] [-r rounds]
+ */
+
+#include <xcopy.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define TC_BENCH_SESS_SIZE  224
+
+typedef struct {
+    tc_pool_t      *pool;
+    void           *sess;
+    unsigned char **frames;
+    link_node     **nodes;
+    int             head;         /* oldest packet held */
+    int             held;
+    int             sent;
+} tc_bench_sess_t;
+
+typedef struct {
+    const char     *name;
+    tc_slab_t      *slab;
+} tc_bench_mode_t;
+
+static int  sessions = 1024;
+static int  packets  = 64;
+static int  window   = 8;
+static int  rounds   = 20;
+
+/* ip packet sizes of a typical request mix */
+static int  pack_sizes[] = { 40, 52, 52, 120, 310, 576, 1064, 1500 };
+
+
+static uint64_t
+tc_bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static int
+tc_bench_sess_open(tc_bench_mode_t *m, tc_bench_sess_t *s)
+{
+    if (m->slab) {
+        s->pool = tc_create_slab_pool(m->slab, TC_DEFAULT_UPOOL_SIZE,
+                TC_DEFAULT_UPOOL_SIZE, TC_UPOOL_MAXV);
+    } else {
+        s->pool = tc_create_pool(TC_DEFAULT_UPOOL_SIZE,
+                TC_DEFAULT_UPOOL_SIZE, TC_UPOOL_MAXV);
+    }
+
+    if (s->pool == NULL) {
+        return TC_ERR;
+    }
+
+    s->sess = tc_palloc(s->pool, TC_BENCH_SESS_SIZE);
+    s->head = 0;
+    s->held = 0;
+    s->sent = 0;
+
+    return s->sess != NULL ? TC_OK : TC_ERR;
+}
+
+
+static void
+tc_bench_pack_free(tc_bench_mode_t *m, tc_bench_sess_t *s)
+{
+    int  i;
+
+    i = s->head;
+
+    if (m->slab) {
+        tc_slab_free(m->slab, s->frames[i]);
+        tc_slab_free(m->slab, s->nodes[i]);
+    } else {
+        tc_pfree(s->pool, s->frames[i]);
+        tc_pfree(s->pool, s->nodes[i]);
+    }
+
+    s->head = (s->head + 1) % window;
+    s->held--;
+}
+
+
+static int
+tc_bench_pack_save(tc_bench_mode_t *m, tc_bench_sess_t *s, int len)
+{
+    int             i;
+    link_node      *ln;
+    unsigned char  *frame;
+
+    if (s->held == window) {
+        /* the oldest one has been acknowledged */
+        tc_bench_pack_free(m, s);
+    }
+
+    if (m->slab) {
+        frame = tc_slab_alloc(m->slab, ETHERNET_HDR_LEN + len);
+        ln    = tc_slab_alloc(m->slab, sizeof(link_node));
+    } else {
+        frame = tc_palloc(s->pool, ETHERNET_HDR_LEN + len);
+        ln    = tc_palloc(s->pool, sizeof(link_node));
+    }
+
+    if (frame == NULL || ln == NULL) {
+        return TC_ERR;
+    }
+
+    /* touched as a copied packet would be */
+    frame[ETHERNET_HDR_LEN] = 0x45;
+    ln->data = frame;
+
+    i = (s->head + s->held) % window;
+    s->frames[i] = frame;
+    s->nodes[i]  = ln;
+    s->held++;
+    s->sent++;
+
+    return TC_OK;
+}
+
+
+static void
+tc_bench_sess_close(tc_bench_mode_t *m, tc_bench_sess_t *s)
+{
+    while (s->held > 0) {
+        tc_bench_pack_free(m, s);
+    }
+
+    tc_destroy_pool(s->pool);
+    s->pool = NULL;
+}
+
+
+static int
+tc_bench_run(tc_bench_mode_t *m)
+{
+    int               i, r, k, pk;
+    uint64_t          start, ns, ops;
+    struct rusage     usage;
+    tc_bench_sess_t  *sess;
+
+    sess = calloc(sessions, sizeof(tc_bench_sess_t));
+    if (sess == NULL) {
+        return TC_ERR;
+    }
+
+    for (i = 0; i < sessions; i++) {
+        sess[i].frames = calloc(window, sizeof(unsigned char *));
+        sess[i].nodes  = calloc(window, sizeof(link_node *));
+        if (sess[i].frames == NULL || sess[i].nodes == NULL) {
+            return TC_ERR;
+        }
+    }
+
+    ops   = 0;
+    k     = 0;
+    start = tc_bench_now();
+
+    for (r = 0; r < rounds; r++) {
+
+        for (i = 0; i < sessions; i++) {
+            if (tc_bench_sess_open(m, &sess[i]) != TC_OK) {
+                fprintf(stderr, "%s: session alloc failed\n", m->name);
+                return TC_ERR;
+            }
+        }
+
+        /* the sessions of a round are interleaved as live traffic is */
+        for (pk = 0; pk < packets; pk++) {
+            for (i = 0; i < sessions; i++) {
+                k = (k + 1) % (int) (sizeof(pack_sizes) / sizeof(int));
+                if (tc_bench_pack_save(m, &sess[i], pack_sizes[k]) != TC_OK) {
+                    fprintf(stderr, "%s: packet alloc failed\n", m->name);
+                    return TC_ERR;
+                }
+                ops++;
+            }
+        }
+
+        for (i = 0; i < sessions; i++) {
+            tc_bench_sess_close(m, &sess[i]);
+        }
+    }
+
+    ns = tc_bench_now() - start;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("%-6s %10llu packets %8.1f ns/packet %10.1f ms, max rss %ld KB\n",
+            m->name, (unsigned long long) ops, (double) ns / ops, ns / 1e6,
+            usage.ru_maxrss);
+
+    return TC_OK;
+}
+
+
+static int
+tc_bench_fork(tc_bench_mode_t *m)
+{
+    int    status;
+    pid_t  pid;
+
+    fflush(stdout);
+
+    pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return TC_ERR;
+    }
+
+    if (pid == 0) {
+        if (m->name[0] == 's') {
+            m->slab = tc_slab_create(NULL);
+            if (m->slab == NULL) {
+                _exit(1);
+            }
+        }
+        status = tc_bench_run(m);
+        fflush(stdout);
+        _exit(status == TC_OK ? 0 : 1);
+    }
+
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status)
+            || WEXITSTATUS(status) != 0)
+    {
+        return TC_ERR;
+    }
+
+    return TC_OK;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int              c;
+    tc_bench_mode_t  modes[] = { { "pool", NULL }, { "slab", NULL } };
+
+    while ((c = getopt(argc, argv, "s:p:w:r:")) != -1) {
+        switch (c) {
+        case 's':
+            sessions = atoi(optarg);
+            break;
+        case 'p':
+            packets = atoi(optarg);
+            break;
+        case 'w':
+            window = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s sessions] [-p packets] "
+                    "[-w window] [-r rounds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (sessions <= 0 || packets <= 0 || window <= 0 || rounds <= 0) {
+        fprintf(stderr, "all the numbers must be positive\n");
+        return 1;
+    }
+
+    tc_pagesize = getpagesize();
+
+    printf("%d sessions, %d packets each, %d held, %d rounds\n",
+            sessions, packets, window, rounds);
+
+    if (tc_bench_fork(&modes[0]) != TC_OK
+            || tc_bench_fork(&modes[1]) != TC_OK)
+    {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+
+/*
+ * Timer benchmark.
+ *
+ * Drives the event timers as session traffic does: every session holds a
+ * timer that is rescheduled for nearly every packet, some timers are
+ * cancelled and set again, and the timers that expire are re-armed by
+ * their handler.  Time is simulated a millisecond a tick, so the numbers
+ * do not depend on the clock.  The timer backend is the one configured:
+ * the timing wheel, or the rbtree with --with-rbtree-timer.  It is built
+ * with "make bench".
+ *
+ *   tc_timer_bench [-n timers] [-t ticks] [-u updates] [-d deletes]
+ */
+
+#include <xcopy.h>
+
+static int        timers  = 100000;
+static int        ticks   = 2000;         /* simulated milliseconds */
+static int        updates = 2000;         /* reschedules a tick */
+static int        deletes = 200;          /* cancel and set again a tick */
+
+static uint64_t   fired;
+static uint32_t   seed = 2463534242u;
+
+/* retransmission, keepalive and session timeouts */
+static tc_msec_t  intervals[] = { 1, 5, 20, 50, 200, 1000, 2000, 60000 };
+
+
+static uint32_t
+tc_bench_rand(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    return seed;
+}
+
+
+static tc_msec_t
+tc_bench_interval(void)
+{
+    return intervals[tc_bench_rand() % (sizeof(intervals) /
+            sizeof(tc_msec_t))];
+}
+
+
+static uint64_t
+tc_bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void
+tc_bench_timeout(tc_event_timer_t *ev)
+{
+    fired++;
+    tc_event_update_timer(ev, tc_bench_interval());
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int                 c, i, t;
+    uint64_t            start, add_ns, upd_ns, del_ns, exp_ns, ops;
+    tc_pool_t          *pool;
+    tc_event_timer_t  **evs, *ev;
+
+    while ((c = getopt(argc, argv, "n:t:u:d:")) != -1) {
+        switch (c) {
+        case 'n':
+            timers = atoi(optarg);
+            break;
+        case 't':
+            ticks = atoi(optarg);
+            break;
+        case 'u':
+            updates = atoi(optarg);
+            break;
+        case 'd':
+            deletes = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n timers] [-t ticks] "
+                    "[-u updates] [-d deletes]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (timers <= 0 || ticks <= 0 || updates < 0 || deletes < 0) {
+        fprintf(stderr, "invalid numbers\n");
+        return 1;
+    }
+
+    tc_pagesize = getpagesize();
+    tc_current_time_msec = 1000;
+    tc_event_timer_init();
+
+    pool = tc_create_pool(TC_DEFAULT_POOL_SIZE, 0, 0);
+    evs  = calloc(timers, sizeof(tc_event_timer_t *));
+    if (pool == NULL || evs == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+#if (TC_RBTREE_TIMER)
+    printf("rbtree timers: ");
+#else
+    printf("timing wheel timers: ");
+#endif
+    printf("%d timers, %d ticks, %d updates and %d deletes a tick\n",
+            timers, ticks, updates, deletes);
+
+    start = tc_bench_now();
+    for (i = 0; i < timers; i++) {
+        evs[i] = tc_event_add_timer(pool, tc_bench_interval(), NULL,
+                tc_bench_timeout);
+        if (evs[i] == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+    }
+    add_ns = tc_bench_now() - start;
+
+    upd_ns = 0;
+    del_ns = 0;
+    exp_ns = 0;
+
+    for (t = 0; t < ticks; t++) {
+        tc_current_time_msec++;
+
+        start = tc_bench_now();
+        for (i = 0; i < updates; i++) {
+            ev = evs[tc_bench_rand() % timers];
+            tc_event_update_timer(ev, tc_bench_interval());
+        }
+        upd_ns += tc_bench_now() - start;
+
+        start = tc_bench_now();
+        for (i = 0; i < deletes; i++) {
+            ev = evs[tc_bench_rand() % timers];
+            if (ev->timer_set) {
+                tc_event_del_timer(ev);
+            }
+            tc_event_update_timer(ev, tc_bench_interval());
+        }
+        del_ns += tc_bench_now() - start;
+
+        start = tc_bench_now();
+        tc_event_find_timer();
+        while (tc_event_expire_timers(TC_EVENT_TIMER_BUDGET) != 0) {
+            /* void */
+        }
+        exp_ns += tc_bench_now() - start;
+    }
+
+    ops = (uint64_t) ticks;
+
+    printf("add      %8.1f ns/timer\n", (double) add_ns / timers);
+    if (updates) {
+        printf("update   %8.1f ns/timer\n", (double) upd_ns / (ops * updates));
+    }
+    if (deletes) {
+        printf("del+add  %8.1f ns/timer\n", (double) del_ns / (ops * deletes));
+    }
+    printf("expire   %8.1f ns/timer, %llu fired, %8.1f us/tick\n",
+            fired ? (double) exp_ns / fired : 0.0, (unsigned long long) fired,
+            (double) exp_ns / ops / 1000);
+
+    tc_destroy_pool(pool);
+    free(evs);
+
+    return 0;
+}